@@ -1,9 +1,16 @@
 #include "../mmap_reader.hpp"
+#include "../uring_reader.hpp"
 #include <chrono>
 #include <filesystem>
+#include <format>
+#include <functional>
 #include <fstream>
 #include <iostream>
+#include <span>
 #include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <vector>
 
 using namespace std;
 
@@ -93,6 +100,422 @@ void benchmark_char_read(const string& filename)
          << "\n";
 }
 
+void benchmark_line_scan(const string& filename)
+{
+    cout << "\nTesting line scan per dispatch path:\n";
+
+    mmap_reader mmapReader(filename);
+    const mmap_simd::isa default_isa = mmap_simd::active_isa();
+
+    for (mmap_simd::isa target : {mmap_simd::isa::scalar,
+                                  mmap_simd::isa::sse2,
+                                  mmap_simd::isa::avx2,
+                                  mmap_simd::isa::avx512,
+                                  mmap_simd::isa::neon})
+    {
+        if (!mmap_simd::supported(target)) { continue; }
+        mmap_simd::set_isa(target);
+
+        const int rounds = 10;
+        size_t line_count = 0;
+
+        auto start = chrono::high_resolution_clock::now();
+        for (int i = 0; i < rounds; ++i)
+        {
+            mmapReader.seek(0);
+            for (string_view line : mmapReader.lines()) { line_count += line.empty() ? 0 : 1; }
+        }
+        auto end = chrono::high_resolution_clock::now();
+        auto seconds = chrono::duration<double>(end - start).count();
+
+        cout << mmap_simd::isa_name(target) << ": "
+             << static_cast<double>(mmapReader.size()) * rounds / seconds / 1e9 << " GB/s ("
+             << line_count / rounds << " lines)\n";
+    }
+
+    mmap_simd::set_isa(default_isa);
+}
+
+void benchmark_mapping_options(const string& filename)
+{
+    cout << "\nTesting first scan per mapping mode:\n";
+
+    const pair<const char*, mmap_reader::options> modes[] = {
+        {"default", {}},
+        {"populate", {.populate = true}},
+        {"huge_pages", {.huge_pages = true}},
+        {"populate + huge_pages", {.populate = true, .huge_pages = true}},
+        {"lock", {.lock = true}},
+    };
+
+    for (const auto& [name, opts] : modes)
+    {
+        rusage before {};
+        rusage after {};
+        getrusage(RUSAGE_SELF, &before);
+
+        auto start = chrono::high_resolution_clock::now();
+        size_t checksum = 0;
+        try
+        {
+            mmap_reader mmapReader(filename, opts);
+            for (string_view line : mmapReader.lines()) { checksum += line.size(); }
+        }
+        catch (const system_error& e)
+        {
+            cout << name << ": " << e.what() << "\n";
+            continue;
+        }
+        auto end = chrono::high_resolution_clock::now();
+
+        getrusage(RUSAGE_SELF, &after);
+
+        cout << name << ": " << chrono::duration_cast<chrono::microseconds>(end - start).count()
+             << " us, minor faults: " << after.ru_minflt - before.ru_minflt
+             << ", major faults: " << after.ru_majflt - before.ru_majflt << " (" << checksum
+             << " bytes)\n";
+    }
+}
+
+void benchmark_prefetch(const string& filename)
+{
+    cout << "\nTesting lines() with and without prefetching:\n";
+
+    // Writes back and drops the file from the page cache so the next scan has to fault it in.
+    auto drop_cache = [&]
+    {
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        ::fdatasync(fd);
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    };
+
+    auto scan = [&](const mmap_reader::options& opts)
+    {
+        rusage before {};
+        rusage after {};
+        getrusage(RUSAGE_SELF, &before);
+
+        auto start = chrono::high_resolution_clock::now();
+        size_t checksum = 0;
+        {
+            mmap_reader mmapReader(filename, opts);
+            for (string_view line : mmapReader.lines()) { checksum += line.size(); }
+        }
+        auto end = chrono::high_resolution_clock::now();
+
+        getrusage(RUSAGE_SELF, &after);
+
+        return format("{} us, major faults: {} ({} bytes)",
+                      chrono::duration_cast<chrono::microseconds>(end - start).count(),
+                      after.ru_majflt - before.ru_majflt,
+                      checksum);
+    };
+
+    const pair<const char*, mmap_reader::options> modes[] = {
+        {"no prefetch", {}},
+        {"prefetch 4 MiB", {.prefetch_distance = 4 * 1024 * 1024}},
+        {"prefetch 32 MiB", {.prefetch_distance = 32 * 1024 * 1024}},
+    };
+
+    for (const auto& [name, opts] : modes)
+    {
+        drop_cache();
+        const string cold = scan(opts);
+        const string warm = scan(opts);
+        cout << name << ": cold " << cold << ", warm " << warm << "\n";
+    }
+}
+
+void benchmark_line_index(const string& filename)
+{
+    cout << "\nTesting line index:\n";
+
+    mmap_reader mmapReader(filename);
+    const string sidecar = filename + ".idx";
+
+    for (size_t n_threads : {size_t {1}, size_t {max(thread::hardware_concurrency(), 1U)}})
+    {
+        auto start = chrono::high_resolution_clock::now();
+        mmapReader.build_line_index(n_threads);
+        auto end = chrono::high_resolution_clock::now();
+        cout << "build with " << n_threads << " threads: "
+             << chrono::duration_cast<chrono::microseconds>(end - start).count() << " us\n";
+    }
+    mmapReader.save_line_index(sidecar);
+
+    auto start = chrono::high_resolution_clock::now();
+    mmap_reader reloaded(filename);
+    const bool loaded = reloaded.load_line_index(sidecar);
+    auto end = chrono::high_resolution_clock::now();
+    cout << "load sidecar (" << (loaded ? "ok" : "stale") << "): "
+         << chrono::duration_cast<chrono::microseconds>(end - start).count() << " us, "
+         << filesystem::file_size(sidecar) << " bytes for " << reloaded.line_count() << " lines\n";
+
+    // Random lookups against replaying getline() from the start.
+    const size_t target = mmapReader.line_count() / 2;
+    start = chrono::high_resolution_clock::now();
+    size_t checksum = 0;
+    for (size_t i = 0; i < 100000; ++i) { checksum += mmapReader.line((i * 7919) % target).size(); }
+    end = chrono::high_resolution_clock::now();
+    cout << "100000 line(n): " << chrono::duration_cast<chrono::microseconds>(end - start).count()
+         << " us\n";
+
+    start = chrono::high_resolution_clock::now();
+    mmapReader.seek(0);
+    for (size_t i = 0; i < target; ++i) { checksum += mmapReader.getline()->size(); }
+    end = chrono::high_resolution_clock::now();
+    cout << "one getline() replay to line " << target << ": "
+         << chrono::duration_cast<chrono::microseconds>(end - start).count() << " us (" << checksum
+         << ")\n";
+
+    filesystem::remove(sidecar);
+}
+
+void benchmark_fields(const string& filename)
+{
+    cout << "\nTesting CSV field splitting:\n";
+
+    const string csv_file = filename + ".csv";
+    {
+        ofstream out(csv_file);
+        for (size_t i = 0; i < 1000000; ++i)
+        {
+            out << i << ",name " << i << ",\"quoted, " << i % 97 << "\"," << i * 3 << "\n";
+        }
+    }
+
+    // Splitting every line again in user code, without quote support.
+    auto start = chrono::high_resolution_clock::now();
+    size_t checksum = 0;
+    {
+        mmap_reader mmapReader(csv_file);
+        for (string_view line : mmapReader.lines())
+        {
+            for (size_t pos = 0; pos <= line.size();)
+            {
+                const size_t comma = min(line.find(',', pos), line.size());
+                checksum += comma - pos;
+                pos = comma + 1;
+            }
+        }
+    }
+    auto end = chrono::high_resolution_clock::now();
+    cout << "lines() + find(','): " << chrono::duration_cast<chrono::milliseconds>(end - start).count()
+         << " ms (" << checksum << ")\n";
+
+    start = chrono::high_resolution_clock::now();
+    checksum = 0;
+    {
+        mmap_reader mmapReader(csv_file);
+        for (span<const string_view> row : mmapReader.fields())
+        {
+            for (string_view field : row) { checksum += field.size(); }
+        }
+    }
+    end = chrono::high_resolution_clock::now();
+    cout << "fields(): " << chrono::duration_cast<chrono::milliseconds>(end - start).count() << " ms ("
+         << checksum << ")\n";
+
+    filesystem::remove(csv_file);
+}
+
+void benchmark_numbers(const string& filename)
+{
+    cout << "\nTesting number parsing:\n";
+
+    const string numbers_file = filename + ".numbers";
+    {
+        ofstream out(numbers_file);
+        for (size_t i = 0; i < 1000000; ++i)
+        {
+            out << i * 2654435761 % 1000000007 << ' ' << static_cast<double>(i) / 7 << "\n";
+        }
+    }
+
+    auto start = chrono::high_resolution_clock::now();
+    double sum = 0;
+    {
+        ifstream in(numbers_file);
+        string line;
+        while (getline(in, line))
+        {
+            const size_t space = line.find(' ');
+            sum += static_cast<double>(stoll(line.substr(0, space)));
+            sum += stod(line.substr(space + 1));
+        }
+    }
+    auto end = chrono::high_resolution_clock::now();
+    cout << "getline + stoll/stod: " << chrono::duration_cast<chrono::milliseconds>(end - start).count()
+         << " ms (" << sum << ")\n";
+
+    start = chrono::high_resolution_clock::now();
+    sum = 0;
+    {
+        mmap_reader mmapReader(numbers_file);
+        while (auto value = mmapReader.read_int<int64_t>())
+        {
+            sum += static_cast<double>(*value);
+            sum += mmapReader.read_float<double>().value_or(0);
+        }
+    }
+    end = chrono::high_resolution_clock::now();
+    cout << "read_int/read_float: " << chrono::duration_cast<chrono::milliseconds>(end - start).count()
+         << " ms (" << sum << ")\n";
+
+    filesystem::remove(numbers_file);
+}
+
+void benchmark_backends(const string& filename)
+{
+    cout << "\nTesting line scans with mmap, io_uring and ifstream:\n";
+
+    auto drop_cache = [&]
+    {
+        const int fd = ::open(filename.c_str(), O_RDONLY);
+        ::fdatasync(fd);
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    };
+
+    auto time = [](auto&& scan)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        const size_t checksum = scan();
+        auto end = chrono::high_resolution_clock::now();
+        return format("{} us ({} bytes)",
+                      chrono::duration_cast<chrono::microseconds>(end - start).count(),
+                      checksum);
+    };
+
+    auto scan_mmap = [&]
+    {
+        mmap_reader reader(filename, {.advice = mmap_reader::access_pattern::sequential});
+        size_t checksum = 0;
+        for (string_view line : reader.lines()) { checksum += line.size(); }
+        return checksum;
+    };
+
+    auto scan_uring = [&](const uring_reader::options& opts)
+    {
+        return [&filename, opts]
+        {
+            uring_reader reader(filename, opts);
+            size_t checksum = 0;
+            for (string_view line : reader.lines()) { checksum += line.size(); }
+            return checksum;
+        };
+    };
+
+    auto scan_ifstream = [&]
+    {
+        ifstream in(filename, ios::binary);
+        size_t checksum = 0;
+        for (string line; getline(in, line);) { checksum += line.size(); }
+        return checksum;
+    };
+
+    const pair<const char*, function<size_t()>> backends[] = {
+        {"mmap_reader", scan_mmap},
+        {"uring_reader", scan_uring({})},
+        {"uring_reader O_DIRECT", scan_uring({.direct = true})},
+        {"ifstream", scan_ifstream},
+    };
+
+    for (const auto& [name, scan] : backends)
+    {
+        try
+        {
+            drop_cache();
+            const string cold = time(scan);
+            const string warm = time(scan);
+            cout << name << ": cold " << cold << ", warm " << warm << "\n";
+        }
+        catch (const system_error& e)
+        {
+            cout << name << ": unavailable (" << e.what() << ")\n";
+        }
+    }
+}
+
+void benchmark_cached_open(const string& filename)
+{
+    cout << "\nTesting repeated opens with and without the mapping cache:\n";
+
+    const int n = 10000;
+    auto run = [&](auto open)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        size_t checksum = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            mmap_reader reader = open();
+            checksum += static_cast<unsigned char>(reader.data()[i % 4096]);
+        }
+        auto end = chrono::high_resolution_clock::now();
+        return format("{} ns per open (checksum {})",
+                      chrono::duration_cast<chrono::nanoseconds>(end - start).count() / n,
+                      checksum);
+    };
+
+    cout << "mmap_reader: " << run([&] { return mmap_reader {filename}; }) << "\n";
+    cout << "open_cached: " << run([&] { return mmap_reader::open_cached(filename); }) << "\n";
+    mmap_reader::clear_cache();
+}
+
+void benchmark_search(const string& filename)
+{
+    cout << "\nTesting substring search (\"line 99999\"):\n";
+
+    mmap_reader reader(filename);
+    const string_view pattern = "line 99999";
+
+    auto time = [](auto search)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        const size_t matches = search();
+        auto end = chrono::high_resolution_clock::now();
+        return format("{} us ({} matches)",
+                      chrono::duration_cast<chrono::microseconds>(end - start).count(),
+                      matches);
+    };
+
+    cout << "string_view::find loop: " << time(
+        [&]
+        {
+            size_t matches = 0;
+            const string_view data = reader.view();
+            for (size_t pos = data.find(pattern); pos != string_view::npos;
+                 pos = data.find(pattern, pos + 1))
+            {
+                ++matches;
+            }
+            return matches;
+        }) << "\n";
+
+    const mmap_simd::isa default_isa = mmap_simd::active_isa();
+    for (mmap_simd::isa target : {mmap_simd::isa::scalar,
+                                  mmap_simd::isa::sse2,
+                                  mmap_simd::isa::avx2,
+                                  mmap_simd::isa::avx512,
+                                  mmap_simd::isa::neon})
+    {
+        if (!mmap_simd::supported(target)) { continue; }
+        mmap_simd::set_isa(target);
+        cout << "count, " << mmap_simd::isa_name(target) << ": "
+             << time([&] { return reader.count(pattern); }) << "\n";
+    }
+    mmap_simd::set_isa(default_isa);
+
+    for (size_t n_threads : {2, 4, 8})
+    {
+        cout << "count, " << n_threads << " threads: "
+             << time([&] { return reader.count(pattern, n_threads); }) << "\n";
+    }
+    cout << "lines_matching, 4 threads: "
+         << time([&] { return reader.lines_matching(pattern, 4).size(); }) << "\n";
+}
+
 int main()
 {
     const string filename = "large_lines.txt";
@@ -103,6 +526,15 @@ int main()
     benchmark_whole_file_read(filename);
     benchmark_line_read(filename);
     benchmark_char_read(filename);
+    benchmark_line_scan(filename);
+    benchmark_mapping_options(filename);
+    benchmark_prefetch(filename);
+    benchmark_backends(filename);
+    benchmark_cached_open(filename);
+    benchmark_search(filename);
+    benchmark_line_index(filename);
+    benchmark_fields(filename);
+    benchmark_numbers(filename);
 
     filesystem::remove(filename);
 }
@@ -0,0 +1,491 @@
+// Benchmark suite for regression tracking, built on Google Benchmark:
+//
+//   g++ -std=c++20 -O2 -pthread benchmark/suite_benchmark.cpp -lbenchmark -o suite_benchmark
+//   ./suite_benchmark --max_size=1G --benchmark_filter=Lines --benchmark_repetitions=5
+//
+// --max_size (default 256M) caps the generated test files, from 4 KiB up to 10 GiB; the files are
+// written to the current directory and removed at exit. All other flags are Google Benchmark's,
+// e.g. --benchmark_format=json to compare runs with its compare.py.
+//
+// Every benchmark reports bytes per second and, per iteration, minor and major page faults and
+// read/write system calls. Random access benchmarks also report p50 and p99 per-operation
+// latencies, and /cold:1 variants drop the file from the page cache before every iteration.
+#include "../mmap_reader.hpp"
+#include "../mmap_writer.hpp"
+#include "../uring_reader.hpp"
+#include <algorithm>
+#include <benchmark/benchmark.h>
+#include <charconv>
+#include <chrono>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <map>
+#include <optional>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <sys/resource.h>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+namespace
+{
+size_t max_size = size_t {256} << 20;
+
+// Test files by size and line length, generated on first use.
+class TestFiles
+{
+private:
+    map<pair<size_t, size_t>, string> files;
+
+public:
+    const string& get(size_t size, size_t line_length)
+    {
+        auto [it, inserted] = files.try_emplace({size, line_length});
+        if (!inserted) { return it->second; }
+
+        it->second = format("bench_{}_{}.txt", size, line_length);
+        mmap_writer writer(it->second, true, size);
+        string line;
+        for (size_t written = 0, i = 0; written < size; written += line.size(), ++i)
+        {
+            line = format("line {} ", i);
+            line.resize(max(line.size(), line_length - 1), 'x');
+            line += '\n';
+            line.resize(min(line.size(), size - written));
+            writer.write(line);
+        }
+        return it->second;
+    }
+
+    ~TestFiles()
+    {
+        for (const auto& [key, path] : files) { filesystem::remove(path); }
+    }
+};
+
+TestFiles test_files;
+
+void drop_cache(const string& path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    ::fdatasync(fd);
+    ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+    ::close(fd);
+}
+
+// Page faults and read/write system calls of the process, reported per iteration.
+class ResourceUsage
+{
+private:
+    struct Sample
+    {
+        double minor_faults {0};
+        double major_faults {0};
+        double read_calls {0};
+        double write_calls {0};
+    };
+
+    Sample start {take()};
+
+    static Sample take()
+    {
+        Sample sample;
+        rusage usage {};
+        ::getrusage(RUSAGE_SELF, &usage);
+        sample.minor_faults = static_cast<double>(usage.ru_minflt);
+        sample.major_faults = static_cast<double>(usage.ru_majflt);
+
+        // syscr and syscw count read- and write-like system calls, including pread and pwrite.
+        ifstream io {"/proc/self/io"};
+        for (string key; io >> key;)
+        {
+            double value = 0;
+            io >> value;
+            if (key == "syscr:") { sample.read_calls = value; }
+            if (key == "syscw:") { sample.write_calls = value; }
+        }
+        return sample;
+    }
+
+public:
+    void report(benchmark::State& state) const
+    {
+        const Sample end = take();
+        const auto per_iteration = benchmark::Counter::kAvgIterations;
+        state.counters["minflt"] = {end.minor_faults - start.minor_faults, per_iteration};
+        state.counters["majflt"] = {end.major_faults - start.major_faults, per_iteration};
+        state.counters["syscr"] = {end.read_calls - start.read_calls, per_iteration};
+        state.counters["syscw"] = {end.write_calls - start.write_calls, per_iteration};
+    }
+};
+
+// Per-operation latencies of the random access benchmarks.
+class Latencies
+{
+private:
+    vector<double> samples;
+
+public:
+    template <typename Operation>
+    void measure(Operation&& operation)
+    {
+        const auto start = chrono::steady_clock::now();
+        operation();
+        const auto end = chrono::steady_clock::now();
+        samples.push_back(chrono::duration<double, nano>(end - start).count());
+    }
+
+    void report(benchmark::State& state)
+    {
+        if (samples.empty()) { return; }
+
+        sort(samples.begin(), samples.end());
+        auto percentile = [&](double p)
+        { return samples[static_cast<size_t>(p * static_cast<double>(samples.size() - 1))]; };
+        state.counters["p50_ns"] = percentile(0.50);
+        state.counters["p99_ns"] = percentile(0.99);
+    }
+};
+
+// Runs scan once per iteration over the file, dropping it from the page cache first if cold.
+template <typename Scan>
+void scan_file(benchmark::State& state, const string& path, bool cold, Scan&& scan)
+{
+    const auto size = static_cast<int64_t>(filesystem::file_size(path));
+    const ResourceUsage usage;
+    for (auto _ : state)
+    {
+        if (cold)
+        {
+            state.PauseTiming();
+            drop_cache(path);
+            state.ResumeTiming();
+        }
+        benchmark::DoNotOptimize(scan());
+    }
+    usage.report(state);
+    state.SetBytesProcessed(state.iterations() * size);
+}
+
+// Arguments: file size, line length, cold.
+void lines_mmap_reader(benchmark::State& state)
+{
+    const string& path = test_files.get(state.range(0), state.range(1));
+    scan_file(state,
+              path,
+              state.range(2) != 0,
+              [&]
+              {
+                  mmap_reader reader(path, {.advice = mmap_reader::access_pattern::sequential});
+                  size_t n = 0;
+                  for (string_view line : reader.lines()) { n += line.size(); }
+                  return n;
+              });
+}
+
+void lines_uring_reader(benchmark::State& state)
+{
+    const string& path = test_files.get(state.range(0), state.range(1));
+    try
+    {
+        uring_reader probe(path);
+    }
+    catch (const system_error& e)
+    {
+        state.SkipWithError(e.what());
+        return;
+    }
+
+    scan_file(state,
+              path,
+              state.range(2) != 0,
+              [&]
+              {
+                  uring_reader reader(path);
+                  size_t n = 0;
+                  for (string_view line : reader.lines()) { n += line.size(); }
+                  return n;
+              });
+}
+
+void lines_ifstream(benchmark::State& state)
+{
+    const string& path = test_files.get(state.range(0), state.range(1));
+    scan_file(state,
+              path,
+              state.range(2) != 0,
+              [&]
+              {
+                  ifstream in(path, ios::binary);
+                  size_t n = 0;
+                  for (string line; getline(in, line);) { n += line.size(); }
+                  return n;
+              });
+}
+
+// Arguments: file size, block size, cold. Every iteration reads 256 random blocks.
+template <typename Access>
+void random_access(benchmark::State& state, Access&& access)
+{
+    const auto size = static_cast<size_t>(state.range(0));
+    const auto block = static_cast<size_t>(state.range(1));
+    const string& path = test_files.get(size, 80);
+
+    // Cold iterations reopen the reader, since the cache keeps pages that are still mapped.
+    optional<mmap_reader> reader {in_place, path};
+    mt19937_64 random {42};
+    uniform_int_distribution<size_t> offsets {0, size > block ? size - block : 0};
+    string buf(block, '\0');
+    Latencies latencies;
+
+    const ResourceUsage usage;
+    for (auto _ : state)
+    {
+        if (state.range(2) != 0)
+        {
+            state.PauseTiming();
+            reader.reset();
+            drop_cache(path);
+            reader.emplace(path);
+            state.ResumeTiming();
+        }
+        for (int i = 0; i < 256; ++i)
+        {
+            latencies.measure([&] { access(*reader, buf, offsets(random)); });
+        }
+    }
+    usage.report(state);
+    latencies.report(state);
+    state.SetBytesProcessed(state.iterations() * 256 * static_cast<int64_t>(block));
+}
+
+void random_pread(benchmark::State& state)
+{
+    random_access(state,
+                  [](mmap_reader& reader, string& buf, size_t offset)
+                  { benchmark::DoNotOptimize(reader.pread(buf, offset)); });
+}
+
+// Touches every page of the view, since creating it reads nothing.
+void random_view(benchmark::State& state)
+{
+    random_access(state,
+                  [](mmap_reader& reader, string& buf, size_t offset)
+                  {
+                      const string_view view = reader.view(offset, buf.size());
+                      char sum = 0;
+                      for (size_t i = 0; i < view.size(); i += 4096) { sum += view[i]; }
+                      benchmark::DoNotOptimize(sum);
+                  });
+}
+
+// Arguments: file size, reserved (whether the final size is reserved up front).
+void write_mmap_writer(benchmark::State& state)
+{
+    const auto size = static_cast<size_t>(state.range(0));
+    const string line = format("{:>79}\n", "This is a line");
+    const string path = "bench_write.txt";
+
+    const ResourceUsage usage;
+    for (auto _ : state)
+    {
+        mmap_writer writer(path, true, state.range(1) != 0 ? size : 0);
+        for (size_t written = 0; written < size; written += line.size()) { writer.write(line); }
+    }
+    usage.report(state);
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+    filesystem::remove(path);
+}
+
+void write_ofstream(benchmark::State& state)
+{
+    const auto size = static_cast<size_t>(state.range(0));
+    const string line = format("{:>79}\n", "This is a line");
+    const string path = "bench_write.txt";
+
+    const ResourceUsage usage;
+    for (auto _ : state)
+    {
+        ofstream out(path, ios::binary | ios::trunc);
+        for (size_t written = 0; written < size; written += line.size()) { out << line; }
+    }
+    usage.report(state);
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+    filesystem::remove(path);
+}
+
+// Arguments: file size, threads.
+void write_concurrent_append(benchmark::State& state)
+{
+    const auto size = static_cast<size_t>(state.range(0));
+    const auto n_threads = static_cast<size_t>(state.range(1));
+    const string record = format("{:>63}\n", "This is a record");
+    const string path = "bench_write.txt";
+
+    const ResourceUsage usage;
+    for (auto _ : state)
+    {
+        mmap_writer writer(path, true, size, {.max_capacity = size});
+        vector<jthread> producers;
+        for (size_t t = 0; t < n_threads; ++t)
+        {
+            producers.emplace_back(
+                [&]
+                {
+                    for (size_t i = 0; i < size / record.size() / n_threads; ++i)
+                    {
+                        writer.append(record);
+                    }
+                });
+        }
+    }
+    usage.report(state);
+    state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(size));
+    filesystem::remove(path);
+}
+
+// Arguments: file size, threads.
+void parallel_lines(benchmark::State& state)
+{
+    const string& path = test_files.get(state.range(0), 80);
+    const mmap_reader reader(path);
+    scan_file(state,
+              path,
+              false,
+              [&]
+              {
+                  vector<size_t> n(static_cast<size_t>(state.range(1)), 0);
+                  reader.parallel_lines(state.range(1),
+                                        [&](size_t chunk, string_view line)
+                                        { n[chunk] += line.size(); });
+                  return n;
+              });
+}
+
+void parallel_count(benchmark::State& state)
+{
+    const string& path = test_files.get(state.range(0), 80);
+    const mmap_reader reader(path);
+    scan_file(state,
+              path,
+              false,
+              [&] { return reader.count("line 99999", static_cast<size_t>(state.range(1))); });
+}
+
+// Parses sizes such as 4096, 64K, 16M or 10G.
+size_t parse_size(string_view text)
+{
+    size_t value = 0;
+    const auto [rest, error] = from_chars(text.data(), text.data() + text.size(), value);
+    if (error != errc {}) { throw invalid_argument {format("invalid size: {}", text)}; }
+
+    switch (rest != text.data() + text.size() ? *rest : '\0')
+    {
+    case 'G':
+        return value << 30;
+    case 'M':
+        return value << 20;
+    case 'K':
+        return value << 10;
+    default:
+        return value;
+    }
+}
+
+void register_benchmarks()
+{
+    const size_t threads = max<size_t>(thread::hardware_concurrency(), 1);
+    vector<int64_t> sizes;
+    for (size_t size : {size_t {4} << 10,
+                        size_t {64} << 10,
+                        size_t {1} << 20,
+                        size_t {16} << 20,
+                        size_t {256} << 20,
+                        size_t {1} << 30,
+                        size_t {10} << 30})
+    {
+        if (size <= max_size) { sizes.push_back(static_cast<int64_t>(size)); }
+    }
+
+    using function_t = void (*)(benchmark::State&);
+
+    const pair<const char*, function_t> line_scans[] {{"lines/mmap_reader", lines_mmap_reader},
+                                                      {"lines/uring_reader", lines_uring_reader},
+                                                      {"lines/ifstream", lines_ifstream}};
+    for (const auto& [name, function] : line_scans)
+    {
+        benchmark::RegisterBenchmark(name, function)
+            ->ArgNames({"size", "line", "cold"})
+            ->ArgsProduct({sizes, {16, 80, 1000}, {0, 1}})
+            ->Unit(benchmark::kMicrosecond);
+    }
+
+    const pair<const char*, function_t> random_reads[] {{"random/pread", random_pread},
+                                                        {"random/view", random_view}};
+    for (const auto& [name, function] : random_reads)
+    {
+        auto* registered = benchmark::RegisterBenchmark(name, function)
+                               ->ArgNames({"size", "block", "cold"})
+                               ->Unit(benchmark::kMicrosecond);
+        for (int64_t size : sizes)
+        {
+            for (int64_t block : {64, 4096, 1 << 20})
+            {
+                if (block > size) { continue; }
+                for (int64_t cold : {0, 1}) { registered->Args({size, block, cold}); }
+            }
+        }
+    }
+
+    benchmark::RegisterBenchmark("write/mmap_writer", write_mmap_writer)
+        ->ArgNames({"size", "reserved"})
+        ->ArgsProduct({sizes, {0, 1}})
+        ->Unit(benchmark::kMicrosecond);
+    benchmark::RegisterBenchmark("write/ofstream", write_ofstream)
+        ->ArgNames({"size"})
+        ->ArgsProduct({sizes})
+        ->Unit(benchmark::kMicrosecond);
+
+    vector<int64_t> thread_counts;
+    for (size_t n = 1; n <= threads; n *= 2) { thread_counts.push_back(static_cast<int64_t>(n)); }
+    const vector<int64_t> large_sizes {sizes.back()};
+
+    // Threads are joined inside the iteration, so the wall clock is the meaningful time.
+    const pair<const char*, function_t> threaded[] {{"threads/append", write_concurrent_append},
+                                                    {"threads/parallel_lines", parallel_lines},
+                                                    {"threads/count", parallel_count}};
+    for (const auto& [name, function] : threaded)
+    {
+        benchmark::RegisterBenchmark(name, function)
+            ->ArgNames({"size", "threads"})
+            ->ArgsProduct({large_sizes, thread_counts})
+            ->UseRealTime()
+            ->Unit(benchmark::kMicrosecond);
+    }
+}
+} // namespace
+
+int main(int argc, char** argv)
+{
+    // Take --max_size out before Google Benchmark sees the arguments.
+    int kept = 1;
+    for (int i = 1; i < argc; ++i)
+    {
+        const string_view arg = argv[i];
+        if (arg.starts_with("--max_size=")) { max_size = parse_size(arg.substr(11)); }
+        else { argv[kept++] = argv[i]; }
+    }
+    argc = kept;
+
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) { return 1; }
+
+    register_benchmarks();
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+}
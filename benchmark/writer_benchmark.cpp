@@ -4,7 +4,11 @@
 #include <format>
 #include <fstream>
 #include <iostream>
+#include <mutex>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
 
 using namespace std;
 
@@ -38,12 +42,208 @@ void bench(const string& filename, size_t size)
          << "\n";
 }
 
+void bench_growth_policies(const string& filename, size_t size)
+{
+    cout << "\nwithout reserved_size:\n";
+
+    vector<string> lines;
+    for (size_t i = 0; i < size; ++i) { lines.emplace_back(format("This is line {}\n", i)); }
+
+    const pair<const char*, mmap_writer::growth_policy> policies[] = {
+        {"fixed(8192)", mmap_writer::growth_policy::fixed()},
+        {"fixed(1 MiB)", mmap_writer::growth_policy::fixed(1024 * 1024)},
+        {"geometric(2)", mmap_writer::growth_policy::geometric()},
+        {"geometric(1.5)", mmap_writer::growth_policy::geometric(1.5)},
+        {"capped_geometric(2, 64 MiB)",
+         mmap_writer::growth_policy::capped_geometric(2.0, 64 * 1024 * 1024)},
+        {"huge_page_aligned(2)", mmap_writer::growth_policy::huge_page_aligned()},
+    };
+
+    for (const auto& [name, policy] : policies)
+    {
+        size_t remaps = 0;
+        size_t total_size = 0;
+
+        auto start = chrono::high_resolution_clock::now();
+        {
+            mmap_writer writer(filename, true, 0, mmap_writer::options {.growth = policy});
+            size_t capacity = writer.capacity();
+            for (const auto& str : lines)
+            {
+                writer.write(str);
+                if (writer.capacity() != capacity)
+                {
+                    capacity = writer.capacity();
+                    ++remaps;
+                }
+            }
+            total_size = writer.size();
+        }
+        auto end = chrono::high_resolution_clock::now();
+        auto seconds = chrono::duration<double>(end - start).count();
+
+        cout << name << ": " << remaps << " remaps, " << seconds * 1000 << " ms, "
+             << static_cast<double>(total_size) / seconds / 1e6 << " MB/s\n";
+    }
+}
+
+void bench_concurrent_append(const string& filename, size_t size)
+{
+    cout << "\nconcurrent producers:\n";
+
+    const string record = format("{:>63}\n", "This is a record");
+    const size_t max_threads = max<size_t>(4, thread::hardware_concurrency());
+
+    for (size_t n_threads = 1; n_threads <= max_threads; n_threads *= 2)
+    {
+        const size_t per_thread = size / n_threads;
+        const size_t total_size = per_thread * n_threads * record.size();
+
+        auto run = [&](auto&& produce)
+        {
+            auto start = chrono::high_resolution_clock::now();
+            {
+                vector<jthread> producers;
+                for (size_t t = 0; t < n_threads; ++t) { producers.emplace_back(produce); }
+            }
+            auto end = chrono::high_resolution_clock::now();
+            return chrono::duration<double>(end - start).count();
+        };
+
+        double append_seconds = 0;
+        {
+            mmap_writer writer(filename,
+                               true,
+                               0,
+                               mmap_writer::options {.growth = mmap_writer::growth_policy::geometric(),
+                                                     .max_capacity = size_t {1} << 36});
+            append_seconds = run(
+                [&]
+                {
+                    for (size_t i = 0; i < per_thread; ++i) { writer.append(record); }
+                });
+        }
+
+        double mutex_seconds = 0;
+        {
+            mmap_writer writer(filename,
+                               true,
+                               0,
+                               mmap_writer::options {.growth = mmap_writer::growth_policy::geometric()});
+            mutex mtx;
+            mutex_seconds = run(
+                [&]
+                {
+                    for (size_t i = 0; i < per_thread; ++i)
+                    {
+                        const scoped_lock lock {mtx};
+                        writer.write(record);
+                    }
+                });
+        }
+
+        cout << n_threads << " threads: append "
+             << static_cast<double>(total_size) / append_seconds / 1e6 << " MB/s, mutex + write "
+             << static_cast<double>(total_size) / mutex_seconds / 1e6 << " MB/s\n";
+    }
+}
+
+void bench_print(const string& filename, size_t size)
+{
+    cout << "\nformatted output, end to end:\n";
+
+    auto time = [](auto&& produce)
+    {
+        auto start = chrono::high_resolution_clock::now();
+        produce();
+        auto end = chrono::high_resolution_clock::now();
+        return chrono::duration_cast<chrono::milliseconds>(end - start).count();
+    };
+
+    auto fstream_duration = time(
+        [&]
+        {
+            ofstream out(filename);
+            for (size_t i = 0; i < size; ++i) { out << format("This is line {}\n", i); }
+        });
+
+    const mmap_writer::options opts {.growth = mmap_writer::growth_policy::geometric()};
+
+    auto write_duration = time(
+        [&]
+        {
+            mmap_writer writer(filename, true, 0, opts);
+            for (size_t i = 0; i < size; ++i) { writer.write(format("This is line {}\n", i)); }
+        });
+
+    auto print_duration = time(
+        [&]
+        {
+            mmap_writer writer(filename, true, 0, opts);
+            for (size_t i = 0; i < size; ++i) { writer.print("This is line {}\n", i); }
+        });
+
+    auto format_to_duration = time(
+        [&]
+        {
+            mmap_writer writer(filename, true, 0, opts);
+            for (size_t i = 0; i < size; ++i) { format_to(writer.output(), "This is line {}\n", i); }
+        });
+
+    cout << "ofstream << format: " << fstream_duration << " ms\n";
+    cout << "write(format): " << write_duration << " ms\n";
+    cout << "print: " << print_duration << " ms\n";
+    cout << "format_to(output()): " << format_to_duration << " ms\n";
+}
+
+void bench_nontemporal(const string& filename)
+{
+    cout << "\nbulk writes, regular vs non-temporal stores:\n";
+
+    const size_t total = size_t {256} << 20;
+    const string chunk(size_t {1} << 20, 'x');
+
+    // A working set standing in for a co-located service; re-reading it after the bulk write shows
+    // how much of it the write evicted from the cache.
+    vector<char> working_set(size_t {4} << 20, 1);
+    auto scan_working_set = [&]
+    {
+        auto start = chrono::high_resolution_clock::now();
+        volatile size_t sum = 0;
+        for (size_t i = 0; i < working_set.size(); i += 64) { sum = sum + working_set[i]; }
+        auto end = chrono::high_resolution_clock::now();
+        return chrono::duration_cast<chrono::microseconds>(end - start).count();
+    };
+
+    for (size_t threshold : {size_t {0}, size_t {64} << 10})
+    {
+        scan_working_set();
+
+        auto start = chrono::high_resolution_clock::now();
+        {
+            mmap_writer writer(filename, true, total, {.nontemporal_threshold = threshold});
+            for (size_t written = 0; written < total; written += chunk.size()) { writer.write(chunk); }
+        }
+        auto end = chrono::high_resolution_clock::now();
+        auto rescan = scan_working_set();
+
+        cout << (threshold == 0 ? "regular" : "non-temporal") << " ("
+             << mmap_simd::isa_name(mmap_simd::active_isa()) << "): "
+             << chrono::duration_cast<chrono::milliseconds>(end - start).count()
+             << " ms, working set re-scan " << rescan << " us\n";
+    }
+}
+
 int main()
 {
     const string filename = "large_lines.txt";
     const size_t num_lines = 100'0000;
 
     bench(filename, num_lines);
+    bench_growth_policies(filename, num_lines);
+    bench_concurrent_append(filename, num_lines);
+    bench_print(filename, num_lines);
+    bench_nontemporal(filename);
 
     filesystem::remove(filename);
 }
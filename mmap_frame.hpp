@@ -0,0 +1,113 @@
+#pragma once
+
+#include "mmap_simd.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+
+// Length-prefixed record framing shared by mmap_writer::append_record and
+// mmap_reader::framed_records.
+//
+// A frame is a varint header holding (payload size << 2) | (has checksum << 1) | 1, then the
+// CRC-32C of the payload as four little-endian bytes if it has one, then the payload. The low bit
+// of the header is always set, so the zero bytes left behind by growing a file never parse as a
+// frame.
+namespace mmap_frame
+{
+inline constexpr size_t max_header_size {10 + 4};
+
+struct header
+{
+    size_t size;         // bytes before the payload
+    size_t payload_size;
+    bool checksum;
+    uint32_t crc;
+};
+
+// Writes the header for payload into out, which must hold max_header_size bytes, and returns
+// its size.
+inline size_t encode_header(char* out, std::string_view payload, bool checksum) noexcept
+{
+    uint64_t value = (static_cast<uint64_t>(payload.size()) << 2) | (checksum ? 2 : 0) | 1;
+
+    size_t size = 0;
+    for (; value >= 0x80; value >>= 7) { out[size++] = static_cast<char>(value | 0x80); }
+    out[size++] = static_cast<char>(value);
+
+    if (checksum)
+    {
+        const uint32_t crc = mmap_simd::crc32c(payload.data(), payload.size());
+        for (int i = 0; i < 4; ++i) { out[size++] = static_cast<char>(crc >> (8 * i)); }
+    }
+
+    return size;
+}
+
+// Parses the header at the start of [first, last). Returns false if it is incomplete or malformed.
+inline bool parse_header(const char* first, const char* last, header& out) noexcept
+{
+    uint64_t value = 0;
+    size_t size = 0;
+    for (unsigned shift = 0;; shift += 7)
+    {
+        if (first + size == last || shift >= 64) { return false; }
+
+        const auto byte = static_cast<unsigned char>(first[size++]);
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) { break; }
+    }
+
+    if ((value & 1) == 0) { return false; }
+
+    out.payload_size = static_cast<size_t>(value >> 2);
+    out.checksum = (value & 2) != 0;
+    out.crc = 0;
+
+    if (out.checksum)
+    {
+        if (last - (first + size) < 4) { return false; }
+        for (int i = 0; i < 4; ++i)
+        {
+            out.crc |= static_cast<uint32_t>(static_cast<unsigned char>(first[size++])) << (8 * i);
+        }
+    }
+
+    out.size = size;
+    return true;
+}
+
+// Checks the payload of a parsed frame against its checksum, if it has one.
+[[nodiscard]]
+inline bool verify(const header& frame, std::string_view payload) noexcept
+{
+    return !frame.checksum || mmap_simd::crc32c(payload.data(), payload.size()) == frame.crc;
+}
+
+// Reads the frame at pos of a file of the given size, mapping bytes through at(pos, len), which
+// returns the address of [pos, pos + len). Returns false at end of file or if the frame is
+// incomplete or corrupt; otherwise sets payload and the offset of the next frame.
+template <typename At>
+bool read_frame(At&& at, size_t pos, size_t size, std::string_view& payload, size_t& next)
+{
+    if (pos >= size) { return false; }
+
+    const size_t available = size - pos;
+    const size_t header_len = std::min(available, max_header_size);
+    const char* first = at(pos, header_len);
+
+    header frame {};
+    if (!parse_header(first, first + header_len, frame) ||
+        frame.payload_size > available - frame.size)
+    {
+        return false;
+    }
+
+    payload = {at(pos + frame.size, frame.payload_size), frame.payload_size};
+    if (!verify(frame, payload)) { return false; }
+
+    next = pos + frame.size + frame.payload_size;
+    return true;
+}
+} // namespace mmap_frame
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstddef>
+#include <exception>
+#include <thread>
+#include <vector>
+
+// Fork-join helper shared by the parallel scans of mmap_reader and zstd_reader.
+namespace mmap_parallel
+{
+// Runs work(0) .. work(n - 1) on n threads, including the calling one, and rethrows the first
+// exception once all of them have finished.
+template <typename Work>
+void run(size_t n, Work work)
+{
+    std::vector<std::exception_ptr> errors(n);
+
+    auto guarded = [&](size_t index)
+    {
+        try
+        {
+            work(index);
+        }
+        catch (...)
+        {
+            errors[index] = std::current_exception();
+        }
+    };
+
+    {
+        std::vector<std::jthread> threads;
+        for (size_t i = 1; i < n; ++i) { threads.emplace_back(guarded, i); }
+        if (n > 0) { guarded(0); }
+    }
+
+    for (const std::exception_ptr& error : errors)
+    {
+        if (error) { std::rethrow_exception(error); }
+    }
+}
+} // namespace mmap_parallel
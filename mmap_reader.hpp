@@ -1,21 +1,90 @@
 #pragma once
 
+#include "mmap_frame.hpp"
+#include "mmap_parallel.hpp"
+#include "mmap_simd.hpp"
+#include "mmap_stats.hpp"
+
 #include <algorithm>
 #include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
 #include <cstdio>  // perror
+#include <exception>
 #include <fcntl.h> // open
 #include <format>
+#include <functional>
+#include <limits>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <numeric>
 #include <optional>
 #include <span>
 #include <stdexcept>
 #include <string>
 #include <string_view>
-#include <sys/mman.h> // mmap, munmap, msync
+#include <thread>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h> // mmap, munmap, madvise, mlock, mincore
 #include <sys/stat.h> // fstat
 #include <unistd.h>   // close
 
-class mmap_reader
+// Compile-time configuration of basic_mmap_reader. Derive from it and redeclare the members to
+// change them.
+struct mmap_reader_traits
+{
+    static constexpr char delimiter {'\n'}; // default of lines(), getline() and the parallel scans
+    static constexpr bool checked {true};   // throw on bad line numbers and record views
+    static constexpr bool stats {mmap_stats::enabled}; // count calls, see mmap_stats.hpp
+};
+
+template <typename Traits = mmap_reader_traits>
+class basic_mmap_reader
 {
+public:
+    enum class access_pattern : unsigned char
+    {
+        normal,
+        sequential,
+        random,
+        willneed,
+        dontneed,
+        hugepage
+    };
+
+    struct options
+    {
+        access_pattern advice {access_pattern::normal};
+        bool populate {false};   // MAP_POPULATE: prefault the whole file at construction
+        bool huge_pages {false}; // 2 MiB aligned mapping with transparent huge pages
+        bool lock {false};       // mlock the mapping
+        size_t window_size {0};  // map a sliding window of this size, 0 maps the whole file
+        size_t prefetch_distance {0}; // prefault this far ahead on a helper thread, 0 disables it
+        bool follow {false}; // tail a growing file, holding back the bytes after the last '\n'
+        std::chrono::milliseconds poll_interval {10}; // longest sleep of wait_for_data()
+    };
+
+    // Delimiter for lines() and getline() matching any one of the given bytes.
+    struct any_of
+    {
+        std::string_view bytes;
+    };
+
+    // Delimiter for lines() and getline() splitting on '\n' and dropping a '\r' right before it.
+    struct crlf_t
+    {};
+    static constexpr crlf_t crlf {};
+
 private:
     struct File
     {
@@ -54,8 +123,19 @@ private:
 
         File(const File&) = delete;
         File& operator=(const File&) = delete;
-        File(File&& that) noexcept = delete;
-        File& operator=(File&& that) noexcept = delete;
+        File(File&& that) noexcept
+            : fd {that.fd}, should_close {std::exchange(that.should_close, false)}
+        {}
+        File& operator=(File&& that) noexcept
+        {
+            if (this != &that)
+            {
+                close();
+                fd = that.fd;
+                should_close = std::exchange(that.should_close, false);
+            }
+            return *this;
+        }
     };
 
     struct MmapData
@@ -75,11 +155,80 @@ private:
             return state_buf.st_size;
         }
 
-        void memory_map(int fd)
+        static size_t page_size() noexcept
+        {
+            static const auto size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            return size;
+        }
+
+        static constexpr size_t huge_page_size {2 * 1024 * 1024};
+
+        // Transparent huge pages need a huge-page-aligned virtual address, which mmap does not
+        // guarantee, so reserve a larger area first and place the file mapping inside it.
+        void* map_huge_aligned(int flags, size_t offset, size_t len) const
+        {
+            const size_t area_size = len + huge_page_size;
+            void* area = counters.timed(mmap_stats::call::mmap,
+                                        ::mmap,
+                                        nullptr,
+                                        area_size,
+                                        PROT_NONE,
+                                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                        -1,
+                                        0);
+            if (area == MAP_FAILED) { return MAP_FAILED; }
+
+            const auto area_begin = reinterpret_cast<uintptr_t>(area);
+            const uintptr_t aligned = (area_begin + huge_page_size - 1) & ~(huge_page_size - 1);
+
+            void* addr = counters.timed(mmap_stats::call::mmap,
+                                        ::mmap,
+                                        reinterpret_cast<void*>(aligned),
+                                        len,
+                                        PROT_READ,
+                                        flags | MAP_FIXED,
+                                        fd,
+                                        static_cast<off_t>(offset));
+            if (addr == MAP_FAILED)
+            {
+                const int saved_errno = errno;
+                ::munmap(area, area_size);
+                errno = saved_errno;
+                return MAP_FAILED;
+            }
+
+            const uintptr_t mapped_end = (aligned + len + page_size() - 1) & ~(page_size() - 1);
+            if (aligned > area_begin) { ::munmap(area, aligned - area_begin); }
+            if (area_begin + area_size > mapped_end)
+            {
+                ::munmap(reinterpret_cast<void*>(mapped_end), area_begin + area_size - mapped_end);
+            }
+
+            return addr;
+        }
+
+        void memory_map(size_t offset, size_t len)
         {
-            map_size = file_size(fd);
+            // A followed file may start out empty, which mmap rejects.
+            if (opts.follow && len == 0)
+            {
+                map_offset = offset;
+                return;
+            }
 
-            void* addr = ::mmap(nullptr, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+            const int flags = MAP_PRIVATE | (opts.populate ? MAP_POPULATE : 0);
+
+            void* addr =
+                opts.huge_pages
+                    ? map_huge_aligned(flags, offset, len)
+                    : counters.timed(mmap_stats::call::mmap,
+                                     ::mmap,
+                                     nullptr,
+                                     len,
+                                     PROT_READ,
+                                     flags,
+                                     fd,
+                                     static_cast<off_t>(offset));
             if (addr == MAP_FAILED)
             {
                 throw std::system_error {errno,
@@ -89,229 +238,2347 @@ private:
             }
 
             mapped_ptr = static_cast<char*>(addr);
+            map_offset = offset;
+            map_size = len;
+            mapped_len = len;
+
+            try
+            {
+                if (opts.huge_pages) { advise(access_pattern::hugepage, offset, len); }
+                if (opts.advice != access_pattern::normal) { advise(opts.advice, offset, len); }
+                if (opts.lock &&
+                    counters.timed(mmap_stats::call::madvise, ::mlock, mapped_ptr, map_size) == -1)
+                {
+                    throw std::system_error {errno,
+                                             std::system_category(),
+                                             "mmap_reader: mlock failed"};
+                }
+            }
+            catch (...)
+            {
+                unmap();
+                throw;
+            }
+        }
+
+        void unmap() noexcept
+        {
+            if (owner != nullptr) { owner.reset(); }
+            else if (mapped_ptr != nullptr)
+            {
+                const int result =
+                    counters.timed(mmap_stats::call::munmap, ::munmap, mapped_ptr, mapped_len);
+                if (result == -1)
+                {
+                    perror("mmap_reader: munmap failed");
+                }
+            }
+
+            mapped_ptr = nullptr;
+            map_size = 0;
+            mapped_len = 0;
+        }
+
+        // Returns the offset just past the last '\n' in [from, to), or from if there is none.
+        size_t line_end(size_t from, size_t to) const noexcept
+        {
+            if (to <= from) { return from; }
+            if (!windowed())
+            {
+                const void* found = ::memrchr(mapped_ptr + from, '\n', to - from);
+                if (found == nullptr) { return from; }
+                return static_cast<size_t>(static_cast<const char*>(found) - mapped_ptr) + 1;
+            }
+
+            char buf[64 * 1024];
+            while (to > from)
+            {
+                const size_t len = std::min(sizeof(buf), to - from);
+                const ssize_t n = ::pread(fd, buf, len, static_cast<off_t>(to - len));
+                if (n == -1 && errno == EINTR) { continue; }
+                if (n != static_cast<ssize_t>(len)) { break; }
+
+                to -= len;
+                const void* found = ::memrchr(buf, '\n', len);
+                if (found != nullptr)
+                {
+                    return to + static_cast<size_t>(static_cast<const char*>(found) - buf) + 1;
+                }
+            }
+            return from;
+        }
+
+        // Resizes the whole-file mapping to the current file size.
+        void remap_whole(size_t new_len)
+        {
+            if (mapped_ptr == nullptr || new_len == 0)
+            {
+                unmap();
+                memory_map(0, new_len);
+                return;
+            }
+
+            void* addr = counters.timed(mmap_stats::call::mremap,
+                                        ::mremap,
+                                        mapped_ptr,
+                                        mapped_len,
+                                        new_len,
+                                        MREMAP_MAYMOVE);
+            if (addr == MAP_FAILED)
+            {
+                throw std::system_error {
+                    errno, std::system_category(), "mmap_reader: mremap failed"};
+            }
+            mapped_ptr = static_cast<char*>(addr);
+            mapped_len = new_len;
+        }
+
+        // Maps a window starting at the page containing pos that covers at least len bytes. At a
+        // page-aligned end of the file, where that page is empty, the window ends at pos instead.
+        void slide(size_t pos, size_t len)
+        {
+            size_t begin = pos & ~(page_size() - 1);
+            if (begin == total_size) { begin -= std::min(opts.window_size, begin); }
+            const size_t window_len =
+                std::min(std::max(opts.window_size, pos + len - begin), total_size - begin);
+
+            unmap();
+            memory_map(begin, window_len);
+
+            // Start kernel readahead of the following window so sequential scans do not stall
+            // at the window boundary.
+            const size_t window_end = begin + window_len;
+            if (window_end < total_size)
+            {
+                ::posix_fadvise(fd,
+                                static_cast<off_t>(window_end),
+                                static_cast<off_t>(opts.window_size),
+                                POSIX_FADV_WILLNEED);
+            }
         }
 
-        void unmap()
+        static int to_madvise(access_pattern pattern) noexcept
         {
-            if (::munmap(mapped_ptr, map_size) == -1) { perror("mmap_reader: munmap failed"); }
+            switch (pattern)
+            {
+            case access_pattern::sequential:
+                return MADV_SEQUENTIAL;
+            case access_pattern::random:
+                return MADV_RANDOM;
+            case access_pattern::willneed:
+                return MADV_WILLNEED;
+            case access_pattern::dontneed:
+                return MADV_DONTNEED;
+            case access_pattern::hugepage:
+                return MADV_HUGEPAGE;
+            default:
+                return MADV_NORMAL;
+            }
         }
 
     public:
-        char* mapped_ptr;
-        size_t map_size;
+        int fd;
+        options opts;
+
+        char* mapped_ptr {};
+        size_t map_offset {0}; // file offset of mapped_ptr
+        size_t map_size {0};   // length of the mapping, up to total_size
+        size_t mapped_len {0}; // length passed to mmap, more than map_size when following a file
+        size_t total_size;     // length of the file, in follow mode up to the last complete line
+        size_t file_end {0};   // in follow mode, the file size seen by the last refresh()
+        std::shared_ptr<const void> owner; // keeps a shared mapping alive instead of unmapping it
+        [[no_unique_address]] mutable mmap_stats::counters<Traits::stats> counters;
+
+        MmapData(int fd_, const options& opts_)
+            : fd {fd_}, opts {opts_}, total_size {file_size(fd_)}
+        {
+            if (windowed())
+            {
+                opts.window_size = (opts.window_size + page_size() - 1) & ~(page_size() - 1);
+                if (opts.follow)
+                {
+                    file_end = total_size;
+                    total_size = line_end(0, file_end);
+                }
+                memory_map(0, std::min(opts.window_size, total_size));
+            }
+            else
+            {
+                memory_map(0, total_size);
+                if (opts.follow)
+                {
+                    file_end = total_size;
+                    total_size = map_size = line_end(0, file_end);
+                }
+            }
+        }
+
+        // Views the whole-file mapping of source, which owner_ keeps alive.
+        MmapData(const MmapData& source, std::shared_ptr<const void> owner_, const options& opts_)
+            : fd {source.fd},
+              opts {opts_},
+              mapped_ptr {source.mapped_ptr},
+              map_size {source.map_size},
+              mapped_len {source.mapped_len},
+              total_size {source.total_size},
+              owner {std::move(owner_)}
+        {
+            if (opts.advice != access_pattern::normal) { advise(opts.advice, 0, map_size); }
+        }
 
-        explicit MmapData(int fd) { memory_map(fd); }
         ~MmapData() { unmap(); }
 
         MmapData(const MmapData&) = delete;
         MmapData& operator=(const MmapData&) = delete;
 
-        MmapData(MmapData&& that) noexcept = delete;
-
-        MmapData& operator=(MmapData&& that) noexcept = delete;
-    };
-
-    File file;
-    MmapData mmap_data;
+        // Leaves that empty, at the end of a zero-length file.
+        MmapData(MmapData&& that) noexcept
+            : fd {that.fd},
+              opts {that.opts},
+              mapped_ptr {std::exchange(that.mapped_ptr, nullptr)},
+              map_offset {std::exchange(that.map_offset, 0)},
+              map_size {std::exchange(that.map_size, 0)},
+              mapped_len {std::exchange(that.mapped_len, 0)},
+              total_size {std::exchange(that.total_size, 0)},
+              file_end {std::exchange(that.file_end, 0)},
+              owner {std::move(that.owner)},
+              counters {that.counters}
+        {}
+
+        MmapData& operator=(MmapData&& that) noexcept
+        {
+            if (this != &that)
+            {
+                unmap();
+                fd = that.fd;
+                opts = that.opts;
+                mapped_ptr = std::exchange(that.mapped_ptr, nullptr);
+                map_offset = std::exchange(that.map_offset, 0);
+                map_size = std::exchange(that.map_size, 0);
+                mapped_len = std::exchange(that.mapped_len, 0);
+                total_size = std::exchange(that.total_size, 0);
+                file_end = std::exchange(that.file_end, 0);
+                owner = std::move(that.owner);
+                counters = that.counters;
+            }
+            return *this;
+        }
 
-    size_t read_pos {0};
+        [[nodiscard]]
+        bool windowed() const noexcept
+        {
+            return opts.window_size != 0;
+        }
 
-    enum class seekdir : unsigned char
-    {
-        beg,
-        cur,
-        end
-    };
+        // Picks up the lines completed since the last call in follow mode. Returns false if the
+        // file shrank below total_size, e.g. truncated for log rotation.
+        bool refresh()
+        {
+            const size_t new_end = file_size(fd);
+            const bool shrunk = new_end < total_size;
 
-private:
-    [[nodiscard]]
-    bool eof() const noexcept
-    {
-        return read_pos >= mmap_data.map_size;
-    }
+            if (windowed())
+            {
+                if (shrunk) { unmap(); }
+            }
+            else if (new_end != mapped_len) { remap_whole(new_end); }
 
-    char next_char() noexcept { return mmap_data.mapped_ptr[read_pos++]; }
+            total_size = line_end(shrunk ? 0 : total_size, new_end);
+            file_end = new_end;
+            if (!windowed()) { map_size = total_size; }
 
-    std::string_view next_line(char delimiter) noexcept
-    {
-        int found_delimiter = 0;
+            return !shrunk;
+        }
 
-        size_t cur = read_pos;
-        while (cur < mmap_data.map_size)
+        // Returns the address of file offset pos, with [pos, pos + len) mapped.
+        const char* at(size_t pos, size_t len)
         {
-            if (mmap_data.mapped_ptr[cur++] == delimiter)
+            len = std::min(len, total_size - pos);
+            if (mapped_ptr == nullptr || pos < map_offset || pos + len > map_offset + map_size)
             {
-                found_delimiter = 1;
-                break;
+                slide(pos, len);
             }
+
+            return mapped_ptr + (pos - map_offset);
         }
 
-        std::string_view line {mmap_data.mapped_ptr + read_pos, cur - read_pos - found_delimiter};
+        // Copies [offset, offset + len) into dst without moving the window.
+        size_t copy_out(size_t offset, char* dst, size_t len) const noexcept
+        {
+            if (offset >= map_offset && offset + len <= map_offset + map_size)
+            {
+                std::copy_n(mapped_ptr + (offset - map_offset), len, dst);
+                return len;
+            }
 
-        read_pos = cur;
+            size_t copied = 0;
+            while (copied < len)
+            {
+                const ssize_t n =
+                    ::pread(fd, dst + copied, len - copied, static_cast<off_t>(offset + copied));
+                if (n == -1 && errno == EINTR) { continue; }
+                if (n <= 0) { break; }
+                copied += static_cast<size_t>(n);
+            }
 
-        return line;
-    }
+            return copied;
+        }
 
-    struct Sentinel
-    {};
+        void advise(access_pattern pattern, size_t offset, size_t len) const
+        {
+            // Only the mapped part of [offset, offset + len) can be advised.
+            const size_t map_end = map_offset + map_size;
+            if (offset >= map_end) { return; }
+
+            const size_t begin = std::max(offset, map_offset);
+            const size_t end = (len >= map_end - offset) ? map_end : offset + len;
+            if (begin >= end) { return; }
+
+            // madvise requires a page-aligned start address.
+            const size_t aligned_begin = (begin - map_offset) & ~(page_size() - 1);
+
+            if (counters.timed(mmap_stats::call::madvise,
+                               ::madvise,
+                               mapped_ptr + aligned_begin,
+                               end - map_offset - aligned_begin,
+                               to_madvise(pattern)) == -1)
+            {
+                throw std::system_error {errno,
+                                         std::system_category(),
+                                         "mmap_reader: madvise failed"};
+            }
+        }
+    };
 
-    class LineReader
+    // Faults in pages ahead of a sequential scan so that the reading thread does not stall on
+    // them. The whole-file mapping is touched directly; a windowed mapping may move under the
+    // helper thread, so there only the page cache is warmed with posix_fadvise. It keeps its own
+    // copy of the file descriptor and mapping address, which stay the same when the reader moves.
+    // In follow mode the mapping can move or shrink; refresh() pauses the helper around that.
+    struct Prefetcher
     {
     private:
-        mmap_reader& reader;
-        char delimiter;
+        static constexpr size_t chunk_size {1024 * 1024};
 
-        class iterator
+        int fd;
+        bool follow;
+
+        std::mutex mutex;
+        std::condition_variable_any wakeup;
+        std::condition_variable_any idle;
+        const char* mapped_ptr; // nullptr for a windowed mapping
+        size_t limit;           // nothing at or past this offset is touched
+        size_t cursor {0};      // everything in [requested_begin, cursor) has been prefetched
+        size_t requested_begin {0};
+        size_t requested_end {0};
+        bool paused {false};
+        bool busy {false}; // a chunk is being prefetched without the lock
+
+        std::jthread thread;
+
+        void prefetch(const char* base, size_t offset, size_t len) const noexcept
         {
-        private:
-            mmap_reader& reader;
-            char delimiter {};
+            if (base == nullptr)
+            {
+                ::posix_fadvise(fd,
+                                static_cast<off_t>(offset),
+                                static_cast<off_t>(len),
+                                POSIX_FADV_WILLNEED);
+                return;
+            }
 
-        public:
-            iterator(mmap_reader& in_, char delimiter_) : reader {in_}, delimiter {delimiter_} {}
+            // Queue readahead for the whole chunk first, then take the faults one page at a time.
+            const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            const size_t begin = offset & ~(page - 1);
+            void* addr = const_cast<char*>(base) + begin;
+            ::madvise(addr, offset + len - begin, MADV_WILLNEED);
 
-            std::string_view operator*() const noexcept { return reader.next_line(delimiter); }
+            // MADV_POPULATE_READ reports pages past the end of a file truncated under the mapping
+            // as an error, where touching them raises SIGBUS.
+#ifdef MADV_POPULATE_READ
+            if (::madvise(addr, offset + len - begin, MADV_POPULATE_READ) == 0 || errno != EINVAL)
+            {
+                return;
+            }
+#endif
+            if (follow) { return; } // a followed file may be truncated at any time
 
-            iterator& operator++() { return *this; }
+            for (size_t pos = begin; pos < offset + len; pos += page)
+            {
+                static_cast<void>(*static_cast<const volatile char*>(base + pos));
+            }
+        }
 
-            bool operator!=(Sentinel /*unused*/) const noexcept { return !reader.eof(); }
-        };
+        void run(const std::stop_token& stop)
+        {
+            std::unique_lock lock {mutex};
+            while (!stop.stop_requested())
+            {
+                wakeup.wait(lock, stop, [this] { return !paused && cursor < requested_end; });
+                if (stop.stop_requested()) { break; }
+
+                const size_t begin = cursor;
+                const size_t len = std::min(chunk_size, requested_end - cursor);
+                const char* base = mapped_ptr;
+
+                busy = true;
+                lock.unlock();
+                prefetch(base, begin, len);
+                lock.lock();
+                busy = false;
+                idle.notify_all();
+
+                // A seek may have restarted the request while the lock was released.
+                if (cursor == begin) { cursor += len; }
+            }
+        }
 
     public:
-        explicit LineReader(mmap_reader& r, char delim) : reader {r}, delimiter {delim} {}
+        explicit Prefetcher(const MmapData& mmap_data)
+            : fd {mmap_data.fd},
+              follow {mmap_data.opts.follow},
+              mapped_ptr {mmap_data.windowed() ? nullptr : mmap_data.mapped_ptr},
+              limit {mmap_data.total_size},
+              thread {[this](std::stop_token stop) { run(stop); }}
+        {}
+
+        Prefetcher(const Prefetcher&) = delete;
+        Prefetcher& operator=(const Prefetcher&) = delete;
+        Prefetcher(Prefetcher&& that) noexcept = delete;
+        Prefetcher& operator=(Prefetcher&& that) noexcept = delete;
+
+        // Asks for [begin, end) to be prefetched, keeping earlier progress if it overlaps.
+        void request(size_t begin, size_t end)
+        {
+            {
+                const std::scoped_lock lock {mutex};
+                end = std::min(end, limit);
+                if (cursor < begin || cursor > end || begin < requested_begin) { cursor = begin; }
+                requested_begin = begin;
+                requested_end = end;
+            }
+            wakeup.notify_one();
+        }
 
-        iterator begin() { return iterator {reader, delimiter}; }
-        Sentinel end() { return {}; }
+        // Stops touching the mapping until resume(), waiting for the chunk in progress.
+        void pause()
+        {
+            std::unique_lock lock {mutex};
+            paused = true;
+            idle.wait(lock, [this] { return !busy; });
+        }
+
+        // Continues with the current mapping of mmap_data, dropping requests past its end.
+        void resume(const MmapData& mmap_data)
+        {
+            {
+                const std::scoped_lock lock {mutex};
+                mapped_ptr = mmap_data.windowed() ? nullptr : mmap_data.mapped_ptr;
+                limit = mmap_data.total_size;
+                requested_end = std::min(requested_end, limit);
+                cursor = std::min(cursor, requested_end);
+                paused = false;
+            }
+            wakeup.notify_one();
+        }
     };
 
-    class CharReader
+    // inotify watch used by wait_for_data() to wake up when a followed file changes. Writes
+    // through a shared mapping, as mmap_writer does them, are not reported, so waits stay bounded
+    // by options::poll_interval; without inotify they are plain polling.
+    struct Watch
     {
-    private:
-        mmap_reader& reader;
+        int fd;
 
-        class iterator
+        explicit Watch(int file_fd) : fd {::inotify_init1(IN_NONBLOCK | IN_CLOEXEC)}
         {
-        private:
-            mmap_reader& reader;
-
-        public:
-            explicit iterator(mmap_reader& in_) : reader {in_} {}
-
-            char operator*() const noexcept { return reader.next_char(); }
+            const std::string path = std::format("/proc/self/fd/{}", file_fd);
+            if (fd != -1 &&
+                ::inotify_add_watch(fd, path.c_str(), IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE) == -1)
+            {
+                ::close(fd);
+                fd = -1;
+            }
+        }
 
-            iterator& operator++() { return *this; }
+        ~Watch()
+        {
+            if (fd != -1 && ::close(fd) == -1) { perror("mmap_reader: close inotify failed"); }
+        }
 
-            bool operator!=(Sentinel /*unused*/) const noexcept { return !reader.eof(); }
-        };
+        Watch(const Watch&) = delete;
+        Watch& operator=(const Watch&) = delete;
+        Watch(Watch&& that) noexcept = delete;
+        Watch& operator=(Watch&& that) noexcept = delete;
 
-    public:
-        explicit CharReader(mmap_reader& r) : reader {r} {}
+        // Sleeps until the file changes or timeout passes. poll() ignores a negative fd.
+        void wait(std::chrono::milliseconds timeout) const noexcept
+        {
+            pollfd watched {fd, POLLIN, 0};
+            if (::poll(&watched, 1, static_cast<int>(timeout.count())) <= 0) { return; }
 
-        iterator begin() { return iterator {reader}; }
-        Sentinel end() { return {}; }
+            alignas(inotify_event) char events[4096];
+            while (::read(fd, events, sizeof(events)) > 0)
+            {}
+        }
     };
 
-public:
-    explicit mmap_reader(std::string_view path) : file {path}, mmap_data {file.fd} {}
-    explicit mmap_reader(int fd) : file {fd}, mmap_data {fd} {}
-
-    explicit operator bool() const noexcept { return !eof(); }
-
-    [[nodiscard]]
-    const char* data() const noexcept
+    // A whole-file mapping shared by all cached readers of one version of a file.
+    struct SharedMapping
     {
-        return mmap_data.mapped_ptr;
-    }
+        File file;
+        MmapData data;
 
-    [[nodiscard]]
-    size_t size() const noexcept
-    {
-        return mmap_data.map_size;
-    }
+        SharedMapping(std::string_view path, const options& opts) : file {path}, data {file.fd, opts}
+        {}
+    };
 
-    [[nodiscard]]
-    size_t tell() const noexcept
+    // Process-wide cache of shared mappings keyed by device, inode, modification time and size, so
+    // that a file that changed is mapped afresh. The least recently used mappings beyond the
+    // capacity leave the cache; readers still using them keep them alive.
+    struct MappingCache
     {
-        return read_pos;
-    }
-
-    void seek(size_t pos) noexcept { read_pos = std::min(pos, mmap_data.map_size); }
+        struct Key
+        {
+            dev_t dev;
+            ino_t ino;
+            time_t mtime_sec;
+            long mtime_nsec;
+            off_t size;
 
-    static const seekdir beg {seekdir::beg};
-    static const seekdir cur {seekdir::cur};
-    static const seekdir end {seekdir::end};
+            bool operator==(const Key&) const = default;
+        };
 
-    void seek(ptrdiff_t off, seekdir dir) noexcept
-    {
-        switch (dir)
+        struct KeyHash
         {
-        case seekdir::beg:
-            if (off < 0) { read_pos = 0; }
-            else { read_pos = std::min(static_cast<size_t>(off), mmap_data.map_size); }
-            break;
-        case seekdir::cur:
-            if (off < 0)
-            {
-                read_pos = (static_cast<size_t>(-off) > read_pos)
-                               ? 0
-                               : read_pos - static_cast<size_t>(-off);
-            }
-            else { read_pos = std::min(read_pos + static_cast<size_t>(off), mmap_data.map_size); }
-            break;
-        case seekdir::end:
-            if (off < 0)
+            size_t operator()(const Key& key) const noexcept
             {
-                read_pos = (static_cast<size_t>(-off) > mmap_data.map_size)
-                               ? 0
-                               : mmap_data.map_size - static_cast<size_t>(-off);
+                size_t hash = 0;
+                for (const auto value : {static_cast<uint64_t>(key.dev),
+                                         static_cast<uint64_t>(key.ino),
+                                         static_cast<uint64_t>(key.mtime_sec),
+                                         static_cast<uint64_t>(key.mtime_nsec),
+                                         static_cast<uint64_t>(key.size)})
+                {
+                    hash ^= std::hash<uint64_t> {}(value) + 0x9e3779b97f4a7c15 + (hash << 6) +
+                            (hash >> 2);
+                }
+                return hash;
             }
-            else { read_pos = mmap_data.map_size; }
-            break;
-        default:
-            break;
-        }
-    }
+        };
 
-    std::span<char> read(std::span<char> buf) noexcept
-    {
-        const size_t to_read = std::min(buf.size(), mmap_data.map_size - read_pos);
-        std::copy_n(mmap_data.mapped_ptr + read_pos, to_read, buf.data());
+        struct Entry
+        {
+            std::shared_ptr<const SharedMapping> mapping;
+            std::list<Key>::iterator recent_pos;
+        };
 
-        read_pos += to_read;
+        std::mutex mutex;
+        size_t capacity {64};
+        std::list<Key> recent; // most recently used first
+        std::unordered_map<Key, Entry, KeyHash> entries;
 
-        return buf.first(to_read);
-    }
+        static Key key_of(const struct stat& state_buf) noexcept
+        {
+            return {state_buf.st_dev,
+                    state_buf.st_ino,
+                    state_buf.st_mtim.tv_sec,
+                    state_buf.st_mtim.tv_nsec,
+                    state_buf.st_size};
+        }
 
-    size_t pread(std::span<char> buf, size_t offset) const noexcept
-    {
-        if (offset >= mmap_data.map_size) { return 0; }
+        static MappingCache& instance()
+        {
+            static MappingCache cache;
+            return cache;
+        }
 
-        const size_t to_read = std::min(buf.size(), mmap_data.map_size - offset);
-        std::copy_n(mmap_data.mapped_ptr + offset, to_read, buf.data());
+        std::shared_ptr<const SharedMapping> find(const Key& key)
+        {
+            const std::scoped_lock lock {mutex};
+            return find_locked(key);
+        }
 
-        return to_read;
-    }
+        std::shared_ptr<const SharedMapping> find_locked(const Key& key)
+        {
+            const auto it = entries.find(key);
+            if (it == entries.end()) { return nullptr; }
 
-    [[nodiscard]]
-    std::optional<std::string_view> getline(char delimiter = '\n') noexcept
-    {
-        if (eof()) { return std::nullopt; }
-        return next_line(delimiter);
-    }
+            recent.splice(recent.begin(), recent, it->second.recent_pos);
+            return it->second.mapping;
+        }
 
-    [[nodiscard]]
-    std::optional<char> getchar() noexcept
-    {
-        if (eof()) { return std::nullopt; }
-        return next_char();
-    }
+        // Returns the mapping cached for key, which is the given one unless another thread
+        // inserted one first.
+        std::shared_ptr<const SharedMapping>
+        insert(const Key& key, std::shared_ptr<const SharedMapping> mapping)
+        {
+            std::vector<std::shared_ptr<const SharedMapping>> evicted; // unmapped after unlocking
+            const std::scoped_lock lock {mutex};
 
-    [[nodiscard]]
-    LineReader lines(char delimiter = '\n')
-    {
-        return LineReader(*this, delimiter);
-    }
+            if (auto cached = find_locked(key)) { return cached; }
+            if (capacity == 0) { return mapping; }
+
+            recent.push_front(key);
+            entries.emplace(key, Entry {mapping, recent.begin()});
+            evict(evicted);
+            return mapping;
+        }
+
+        void evict(std::vector<std::shared_ptr<const SharedMapping>>& evicted)
+        {
+            while (entries.size() > capacity)
+            {
+                const auto it = entries.find(recent.back());
+                evicted.push_back(std::move(it->second.mapping));
+                entries.erase(it);
+                recent.pop_back();
+            }
+        }
+
+        void set_capacity(size_t n)
+        {
+            std::vector<std::shared_ptr<const SharedMapping>> evicted;
+            const std::scoped_lock lock {mutex};
+            capacity = n;
+            evict(evicted);
+        }
+
+        void clear()
+        {
+            std::unordered_map<Key, Entry, KeyHash> evicted;
+            const std::scoped_lock lock {mutex};
+            evicted.swap(entries);
+            recent.clear();
+        }
+    };
+
+    // Start offsets of all lines, stored compactly as the varint length of every line (delimiter
+    // included) plus an absolute checkpoint every block_lines lines, so that looking up a line
+    // decodes at most block_lines varints.
+    struct LineIndex
+    {
+        static constexpr size_t block_lines {64};
+
+        struct Checkpoint
+        {
+            uint64_t offset;    // file offset of the first line of the block
+            uint64_t delta_pos; // position of the length of that line in deltas
+        };
+
+        // Sidecar file layout, followed by the checkpoints and the deltas in native byte order.
+        struct Header
+        {
+            char magic[8];
+            uint64_t file_size;
+            int64_t mtime_sec;
+            int64_t mtime_nsec;
+            uint64_t delimiter;
+            uint64_t count;
+            uint64_t checkpoints;
+            uint64_t deltas;
+        };
+
+        static constexpr char magic[8] {'m', 'm', 'l', 'i', 'd', 'x', '1', '\0'};
+
+        bool built {false};
+        char delimiter {'\n'};
+        size_t count {0};
+        std::vector<Checkpoint> checkpoints;
+        std::vector<unsigned char> deltas;
+
+        static void put_varint(std::vector<unsigned char>& out, uint64_t value)
+        {
+            for (; value >= 0x80; value >>= 7)
+            {
+                out.push_back(static_cast<unsigned char>(value | 0x80));
+            }
+            out.push_back(static_cast<unsigned char>(value));
+        }
+
+        // Returns false instead of reading past last.
+        static bool
+        get_varint(const unsigned char*& p, const unsigned char* last, uint64_t& value) noexcept
+        {
+            value = 0;
+            for (unsigned shift = 0; p != last && shift < 64; shift += 7)
+            {
+                const unsigned char byte = *p++;
+                value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) { return true; }
+            }
+            return false;
+        }
+
+        // Returns the offset and length, delimiter included, of line n < count.
+        [[nodiscard]]
+        std::pair<size_t, size_t> locate(size_t n) const noexcept
+        {
+            const Checkpoint& checkpoint = checkpoints[n / block_lines];
+            const unsigned char* p = deltas.data() + checkpoint.delta_pos;
+            const unsigned char* last = deltas.data() + deltas.size();
+
+            size_t offset = checkpoint.offset;
+            uint64_t len = 0;
+            for (size_t i = n % block_lines; i > 0; --i)
+            {
+                get_varint(p, last, len);
+                offset += len;
+            }
+            get_varint(p, last, len);
+
+            return {offset, len};
+        }
+
+        // Checks that a loaded index decodes cleanly and covers exactly total_size bytes.
+        [[nodiscard]]
+        bool consistent(size_t total_size) const noexcept
+        {
+            if (checkpoints.size() != (count + block_lines - 1) / block_lines) { return false; }
+
+            const unsigned char* p = deltas.data();
+            const unsigned char* last = deltas.data() + deltas.size();
+            uint64_t offset = 0;
+            for (size_t n = 0; n < count; ++n)
+            {
+                if (n % block_lines == 0)
+                {
+                    const Checkpoint& checkpoint = checkpoints[n / block_lines];
+                    if (checkpoint.offset != offset ||
+                        checkpoint.delta_pos != static_cast<uint64_t>(p - deltas.data()))
+                    {
+                        return false;
+                    }
+                }
+
+                uint64_t len = 0;
+                if (!get_varint(p, last, len) || len == 0 || len > total_size - offset)
+                {
+                    return false;
+                }
+                offset += len;
+            }
+
+            return p == last && offset == total_size;
+        }
+
+        static bool read_all(int fd, void* buf, size_t len) noexcept
+        {
+            auto* dst = static_cast<char*>(buf);
+            while (len > 0)
+            {
+                const ssize_t n = ::read(fd, dst, len);
+                if (n == -1 && errno == EINTR) { continue; }
+                if (n <= 0) { return false; }
+                dst += n;
+                len -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+
+        static bool write_all(int fd, const void* buf, size_t len) noexcept
+        {
+            const auto* src = static_cast<const char*>(buf);
+            while (len > 0)
+            {
+                const ssize_t n = ::write(fd, src, len);
+                if (n == -1 && errno == EINTR) { continue; }
+                if (n == -1) { return false; }
+                src += n;
+                len -= static_cast<size_t>(n);
+            }
+            return true;
+        }
+    };
+
+    basic_mmap_reader(std::shared_ptr<const SharedMapping> mapping, const options& opts)
+        : file {mapping->file.fd}, mmap_data {mapping->data, mapping, opts}
+    {
+        if (opts.prefetch_distance > 0) { prefetcher = std::make_unique<Prefetcher>(mmap_data); }
+    }
+
+    File file;
+    // The window of a windowed mapping is a cache, so const accessors may move it.
+    mutable MmapData mmap_data;
+    // Declared after mmap_data so that the helper thread stops before the mapping goes away.
+    std::unique_ptr<Prefetcher> prefetcher;
+
+    size_t read_pos {0};
+    size_t prefetch_pos {SIZE_MAX}; // read_pos of the last prefetch request
+
+    LineIndex line_index;
+
+    std::unique_ptr<Watch> watch; // created by the first wait_for_data()
+
+    enum class seekdir : unsigned char
+    {
+        beg,
+        cur,
+        end
+    };
+
+private:
+    [[nodiscard]]
+    bool eof() const noexcept
+    {
+        return read_pos >= mmap_data.total_size;
+    }
+
+    // Re-requests the prefetch distance ahead of read_pos every quarter of the distance, and
+    // immediately after a backward seek.
+    void prefetch_ahead()
+    {
+        if (prefetcher == nullptr) { return; }
+
+        const size_t distance = mmap_data.opts.prefetch_distance;
+        if (read_pos >= prefetch_pos && read_pos - prefetch_pos < std::max<size_t>(distance / 4, 1))
+        {
+            return;
+        }
+
+        prefetcher->request(read_pos, std::min(read_pos + distance, mmap_data.total_size));
+        prefetch_pos = read_pos;
+    }
+
+    char next_char()
+    {
+        prefetch_ahead();
+        const char c = *mmap_data.at(read_pos, 1);
+        ++read_pos;
+        return c;
+    }
+
+    // Traits::delimiter is scanned with kernels instantiated for it, other bytes through the
+    // runtime-dispatched ones.
+    static const char* find_delimiter(const char* first, const char* last, char delimiter) noexcept
+    {
+        if (delimiter == Traits::delimiter)
+        {
+            return mmap_simd::find<Traits::delimiter>(first, last);
+        }
+        return mmap_simd::find(first, last, delimiter);
+    }
+    static const char*
+    find_delimiter(const char* first, const char* last, std::string_view delimiter) noexcept
+    {
+        return mmap_simd::search(first, last, delimiter);
+    }
+    static const char*
+    find_delimiter(const char* first, const char* last, any_of delimiter) noexcept
+    {
+        return mmap_simd::find_any(first, last, delimiter.bytes);
+    }
+    static const char*
+    find_delimiter(const char* first, const char* last, crlf_t /*unused*/) noexcept
+    {
+        return mmap_simd::find<'\n'>(first, last);
+    }
+
+    static size_t delimiter_size(std::string_view delimiter) noexcept { return delimiter.size(); }
+    template <typename Delimiter>
+    static size_t delimiter_size(Delimiter /*unused*/) noexcept
+    {
+        return 1;
+    }
+
+    static void check_delimiter(std::string_view delimiter)
+    {
+        if (delimiter.empty()) { throw std::invalid_argument {"mmap_reader: empty delimiter"}; }
+    }
+    static void check_delimiter(any_of delimiter) { check_delimiter(delimiter.bytes); }
+
+    template <typename Delimiter>
+    std::string_view next_line(const Delimiter& delimiter)
+    {
+        prefetch_ahead();
+        const char* first = mmap_data.at(read_pos, 0);
+        const char* scan_from = first;
+
+        for (;;)
+        {
+            const char* last = mmap_data.mapped_ptr + mmap_data.map_size;
+            const char* found = find_delimiter(scan_from, last, delimiter);
+
+            // In windowed mode a line may continue past the window; remap so that it fits.
+            if (found == last && mmap_data.map_offset + mmap_data.map_size < mmap_data.total_size)
+            {
+                const auto scanned = static_cast<size_t>(last - first);
+                first = mmap_data.at(read_pos, scanned + mmap_data.opts.window_size);
+                // Rescan the tail, since a multi-byte delimiter may straddle the old window end.
+                scan_from = first + scanned - std::min(scanned, delimiter_size(delimiter) - 1);
+                continue;
+            }
+
+            std::string_view line {first, static_cast<size_t>(found - first)};
+            read_pos += line.size() + (found != last ? delimiter_size(delimiter) : 0);
+
+            if constexpr (std::is_same_v<Delimiter, crlf_t>)
+            {
+                if (found != last && line.ends_with('\r')) { line.remove_suffix(1); }
+            }
+
+            mmap_data.counters.add_line();
+            return line;
+        }
+    }
+
+    static constexpr std::string_view whitespace {" \t\n\v\f\r"};
+
+    // Skips whitespace and returns the token that follows, mapped in full, without consuming it.
+    std::string_view peek_token()
+    {
+        prefetch_ahead();
+        for (;;)
+        {
+            if (eof()) { return {}; }
+
+            const char* first = mmap_data.at(read_pos, 1);
+            const char* last = mmap_data.mapped_ptr + mmap_data.map_size;
+            const char* p = first;
+            while (p != last && whitespace.find(*p) != std::string_view::npos) { ++p; }
+
+            read_pos += static_cast<size_t>(p - first);
+            if (p != last) { break; }
+        }
+
+        const char* first = mmap_data.at(read_pos, 0);
+        const char* scan_from = first;
+        for (;;)
+        {
+            const char* last = mmap_data.mapped_ptr + mmap_data.map_size;
+            const char* found = mmap_simd::find_any(scan_from, last, whitespace);
+
+            // In windowed mode a token may continue past the window; remap so that it fits.
+            if (found == last && mmap_data.map_offset + mmap_data.map_size < mmap_data.total_size)
+            {
+                const auto scanned = static_cast<size_t>(last - first);
+                first = mmap_data.at(read_pos, scanned + mmap_data.opts.window_size);
+                scan_from = first + scanned;
+                continue;
+            }
+
+            return {first, static_cast<size_t>(found - first)};
+        }
+    }
+
+    // std::from_chars for base 10, taking eight digits at a time while they last, falling back to
+    // std::from_chars itself for types wider than 64 bits or more than 19 digits. Returns first on
+    // failure, including when the value does not fit in T.
+    template <typename T>
+    static const char* parse_decimal(const char* first, const char* last, T& value) noexcept
+    {
+        auto fallback = [&]
+        {
+            const auto [ptr, ec] = std::from_chars(first, last, value);
+            return ec == std::errc {} ? ptr : first;
+        };
+
+        if constexpr (sizeof(T) > sizeof(uint64_t)) { return fallback(); }
+        else
+        {
+            const char* p = first;
+            const bool negative = std::is_signed_v<T> && p != last && *p == '-';
+            if (negative) { ++p; }
+
+            // Up to 19 digits always fit in a uint64_t.
+            const char* digits = p;
+            uint64_t magnitude = 0;
+            while (last - p >= 8 && p - digits <= 8 && mmap_simd::is_eight_digits(p))
+            {
+                magnitude = magnitude * 100000000 + mmap_simd::parse_eight_digits(p);
+                p += 8;
+            }
+            while (p != last && static_cast<unsigned char>(*p - '0') < 10 && p - digits < 19)
+            {
+                magnitude = magnitude * 10 + static_cast<uint64_t>(*p - '0');
+                ++p;
+            }
+
+            if (p == digits) { return first; }
+            if (p != last && static_cast<unsigned char>(*p - '0') < 10) { return fallback(); }
+
+            using U = std::make_unsigned_t<T>;
+            const uint64_t limit =
+                static_cast<uint64_t>(std::numeric_limits<T>::max()) + (negative ? 1 : 0);
+            if (magnitude > limit) { return first; }
+
+            value = negative ? static_cast<T>(U {0} - static_cast<U>(magnitude))
+                             : static_cast<T>(magnitude);
+            return p;
+        }
+    }
+
+    bool read_frame(size_t pos, std::string_view& payload, size_t& next) const
+    {
+        auto at = [this](size_t offset, size_t len) { return mmap_data.at(offset, len); };
+        return mmap_frame::read_frame(at, pos, mmap_data.total_size, payload, next);
+    }
+
+    // Yields the structural bytes (both delimiters and the quote) of a range in order, classifying
+    // 64 bytes per mmap_simd::mask_any call and walking the bits of the mask in between.
+    class StructuralScanner
+    {
+    private:
+        const char* last {nullptr};
+        size_t window_offset {0};
+        const char* block {nullptr};
+        uint64_t bits {0};
+        char set[3];
+
+        void load(const char* p) noexcept
+        {
+            block = p;
+            const auto available = static_cast<size_t>(last - p);
+            if (available >= 64)
+            {
+                bits = mmap_simd::mask_any(p, {set, sizeof(set)});
+                return;
+            }
+
+            char tail[64] {};
+            std::copy_n(p, available, tail);
+            const uint64_t valid = (uint64_t {1} << available) - 1;
+            bits = mmap_simd::mask_any(tail, {set, sizeof(set)}) & valid;
+        }
+
+    public:
+        StructuralScanner(char line_delimiter, char field_delimiter, char quote)
+            : set {line_delimiter, field_delimiter, quote}
+        {}
+
+        // Keeps the cached mask across rows as long as the same window is scanned.
+        void scan(const MmapData& mmap_data) noexcept
+        {
+            const char* window_last = mmap_data.mapped_ptr + mmap_data.map_size;
+            if (window_last != last || mmap_data.map_offset != window_offset) { block = nullptr; }
+            last = window_last;
+            window_offset = mmap_data.map_offset;
+        }
+
+        // Returns the first structural byte at or after p, or last if there is none. Callers move
+        // forward through the range, so bits before p are dropped as they are passed.
+        const char* next(const char* p) noexcept
+        {
+            if (p >= last) { return last; }
+            if (block == nullptr || p < block || p - block >= 64) { load(p); }
+
+            for (;;)
+            {
+                if (bits != 0)
+                {
+                    const char* hit = block + __builtin_ctzll(bits);
+                    if (hit >= p) { return hit; }
+                    bits &= bits - 1;
+                    continue;
+                }
+
+                if (last - block <= 64) { return last; }
+                load(block + 64);
+            }
+        }
+    };
+
+    // Splits the row starting at first into row and returns the address just past it. Returns
+    // nullptr if the row may continue past last, unless complete says that last is the end of file.
+    static const char* parse_row(const char* first,
+                                 const char* last,
+                                 bool complete,
+                                 char line_delimiter,
+                                 char quote,
+                                 StructuralScanner& scanner,
+                                 std::vector<std::string_view>& row)
+    {
+        row.clear();
+
+        // A quote that does not open a field is an ordinary byte.
+        auto next_delimiter = [&](const char* p)
+        {
+            p = scanner.next(p);
+            while (p != last && *p == quote) { p = scanner.next(p + 1); }
+            return p;
+        };
+
+        for (;;)
+        {
+            const char* field_end = nullptr;
+            if (first != last && *first == quote)
+            {
+                const char* content = first + 1;
+                const char* closing = content;
+                for (;;)
+                {
+                    closing = scanner.next(closing);
+                    if (closing != last && *closing != quote)
+                    {
+                        ++closing;
+                        continue;
+                    }
+
+                    // A quote at the very end may still turn out to be the first half of "".
+                    if (!complete && (closing == last || closing + 1 == last)) { return nullptr; }
+                    if (closing == last || closing + 1 == last || closing[1] != quote) { break; }
+                    closing += 2;
+                }
+
+                row.emplace_back(content, static_cast<size_t>(closing - content));
+                // Anything between the closing quote and the next delimiter is ignored.
+                first = closing == last ? last : closing + 1;
+                field_end = next_delimiter(first);
+            }
+            else
+            {
+                field_end = next_delimiter(first);
+                row.emplace_back(first, static_cast<size_t>(field_end - first));
+            }
+
+            if (field_end == last) { return complete ? last : nullptr; }
+            if (*field_end == line_delimiter) { return field_end + 1; }
+            first = field_end + 1;
+        }
+    }
+
+    void next_row(char line_delimiter,
+                  char quote,
+                  StructuralScanner& scanner,
+                  std::vector<std::string_view>& row)
+    {
+        prefetch_ahead();
+        const char* first = mmap_data.at(read_pos, 0);
+
+        for (;;)
+        {
+            const char* last = mmap_data.mapped_ptr + mmap_data.map_size;
+            const bool complete =
+                mmap_data.map_offset + mmap_data.map_size >= mmap_data.total_size;
+
+            scanner.scan(mmap_data);
+            const char* end =
+                parse_row(first, last, complete, line_delimiter, quote, scanner, row);
+            if (end != nullptr)
+            {
+                read_pos += static_cast<size_t>(end - first);
+                return;
+            }
+
+            // In windowed mode a row may continue past the window; remap and parse it again.
+            const auto scanned = static_cast<size_t>(last - first);
+            first = mmap_data.at(read_pos, scanned + mmap_data.opts.window_size);
+        }
+    }
+
+    template <typename Callback>
+    static void for_each_line(std::string_view chunk, char delimiter, Callback& callback)
+    {
+        const char* first = chunk.data();
+        const char* last = chunk.data() + chunk.size();
+        while (first != last)
+        {
+            const char* found = find_delimiter(first, last, delimiter);
+            callback(std::string_view {first, static_cast<size_t>(found - first)});
+            first = found != last ? found + 1 : last;
+        }
+    }
+
+    // Splits the offsets at which a match of pattern can start into at most n ranges [first,
+    // second) of similar length.
+    [[nodiscard]]
+    std::vector<std::pair<size_t, size_t>> match_ranges(std::string_view pattern, size_t n) const
+    {
+        if (mmap_data.windowed())
+        {
+            throw std::logic_error {"mmap_reader: searching requires a whole-file mapping"};
+        }
+        if (pattern.empty()) { throw std::invalid_argument {"mmap_reader: empty search pattern"}; }
+
+        std::vector<std::pair<size_t, size_t>> ranges;
+        if (mmap_data.map_size < pattern.size()) { return ranges; }
+
+        const size_t starts = mmap_data.map_size - pattern.size() + 1;
+        n = std::clamp<size_t>(n, 1, starts);
+        for (size_t i = 0; i < n; ++i)
+        {
+            ranges.emplace_back(starts * i / n, starts * (i + 1) / n);
+        }
+        return ranges;
+    }
+
+    // Calls callback(match) for every occurrence of pattern starting in range, in order.
+    template <typename Callback>
+    void for_each_match(std::pair<size_t, size_t> range,
+                        std::string_view pattern,
+                        Callback&& callback) const
+    {
+        const char* first = mmap_data.mapped_ptr + range.first;
+        const char* last = mmap_data.mapped_ptr + range.second + pattern.size() - 1;
+        for (; (first = mmap_simd::search(first, last, pattern)) != last; ++first)
+        {
+            callback(first);
+        }
+    }
+
+    template <typename Work>
+    static void run_parallel(size_t n, Work work)
+    {
+        mmap_parallel::run(n, std::move(work));
+    }
+
+    [[nodiscard]]
+    struct stat file_status() const
+    {
+        struct stat state_buf;
+        if (::fstat(file.fd, &state_buf) == -1)
+        {
+            throw std::system_error {errno,
+                                     std::system_category(),
+                                     std::string {"mmap_reader: fstat failed with fd = "} +
+                                         std::to_string(file.fd)};
+        }
+
+        return state_buf;
+    }
+
+    const LineIndex& indexed() const
+    {
+        if (Traits::checked && !line_index.built)
+        {
+            throw std::logic_error {"mmap_reader: no line index, call build_line_index first"};
+        }
+
+        return line_index;
+    }
+
+    struct Sentinel
+    {};
+
+    class IndexedLines
+    {
+    private:
+        const basic_mmap_reader& reader;
+
+    public:
+        // Random access over the indexed lines. Dereferencing yields the line by value, so like
+        // std::ranges::iota_view it only claims input_iterator_tag for legacy algorithms.
+        class iterator
+        {
+        private:
+            const basic_mmap_reader* reader {};
+            size_t n {0};
+
+        public:
+            using iterator_concept = std::random_access_iterator_tag;
+            using iterator_category = std::input_iterator_tag;
+            using value_type = std::string_view;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+            iterator(const basic_mmap_reader& r, size_t n_) : reader {&r}, n {n_} {}
+
+            std::string_view operator*() const { return reader->line(n); }
+            std::string_view operator[](difference_type i) const
+            {
+                return reader->line(n + static_cast<size_t>(i));
+            }
+
+            iterator& operator++()
+            {
+                ++n;
+                return *this;
+            }
+            iterator operator++(int)
+            {
+                iterator old = *this;
+                ++n;
+                return old;
+            }
+            iterator& operator--()
+            {
+                --n;
+                return *this;
+            }
+            iterator operator--(int)
+            {
+                iterator old = *this;
+                --n;
+                return old;
+            }
+
+            iterator& operator+=(difference_type i)
+            {
+                n += static_cast<size_t>(i);
+                return *this;
+            }
+            iterator& operator-=(difference_type i)
+            {
+                n -= static_cast<size_t>(i);
+                return *this;
+            }
+            iterator operator+(difference_type i) const { return iterator {*this} += i; }
+            iterator operator-(difference_type i) const { return iterator {*this} -= i; }
+            friend iterator operator+(difference_type i, const iterator& it) { return it + i; }
+
+            difference_type operator-(const iterator& that) const noexcept
+            {
+                return static_cast<difference_type>(n) - static_cast<difference_type>(that.n);
+            }
+
+            bool operator==(const iterator& that) const noexcept { return n == that.n; }
+            auto operator<=>(const iterator& that) const noexcept { return n <=> that.n; }
+        };
+
+        explicit IndexedLines(const basic_mmap_reader& r) : reader {r} {}
+
+        iterator begin() const { return iterator {reader, 0}; }
+        iterator end() const { return iterator {reader, reader.line_count()}; }
+
+        size_t size() const { return reader.line_count(); }
+        std::string_view operator[](size_t n) const { return reader.line(n); }
+    };
+
+    template <typename Delimiter>
+    class LineReader
+    {
+    private:
+        basic_mmap_reader& reader;
+        Delimiter delimiter;
+        [[no_unique_address]] mmap_stats::fault_scope<Traits::stats> faults;
+
+        class iterator
+        {
+        private:
+            basic_mmap_reader& reader;
+            Delimiter delimiter {};
+
+        public:
+            iterator(basic_mmap_reader& in_, Delimiter delimiter_)
+                : reader {in_}, delimiter {delimiter_}
+            {}
+
+            std::string_view operator*() const { return reader.next_line(delimiter); }
+
+            iterator& operator++() { return *this; }
+
+            bool operator!=(Sentinel /*unused*/) const noexcept { return !reader.eof(); }
+        };
+
+    public:
+        explicit LineReader(basic_mmap_reader& r, Delimiter delim)
+            : reader {r}, delimiter {delim}, faults {r.mmap_data.counters}
+        {}
+
+        iterator begin() { return iterator {reader, delimiter}; }
+        Sentinel end() { return {}; }
+    };
+
+    class FieldReader
+    {
+    private:
+        basic_mmap_reader& reader;
+        char line_delimiter;
+        char quote;
+        StructuralScanner scanner;
+        std::vector<std::string_view> row;
+
+        class iterator
+        {
+        private:
+            FieldReader& fields;
+
+        public:
+            explicit iterator(FieldReader& fields_) : fields {fields_} {}
+
+            std::span<const std::string_view> operator*() const
+            {
+                fields.reader.next_row(fields.line_delimiter,
+                                       fields.quote,
+                                       fields.scanner,
+                                       fields.row);
+                return fields.row;
+            }
+
+            iterator& operator++() { return *this; }
+
+            bool operator!=(Sentinel /*unused*/) const noexcept { return !fields.reader.eof(); }
+        };
+
+    public:
+        FieldReader(basic_mmap_reader& r, char line_delim, char field_delim, char quote_)
+            : reader {r},
+              line_delimiter {line_delim},
+              quote {quote_},
+              scanner {line_delim, field_delim, quote_}
+        {}
+
+        iterator begin() { return iterator {*this}; }
+        Sentinel end() { return {}; }
+    };
+
+    class FrameReader
+    {
+    private:
+        const basic_mmap_reader& reader;
+
+        class iterator
+        {
+        private:
+            const basic_mmap_reader& reader;
+            size_t next {0};
+            std::string_view payload;
+            bool valid;
+
+        public:
+            explicit iterator(const basic_mmap_reader& r)
+                : reader {r}, valid {r.read_frame(0, payload, next)}
+            {}
+
+            std::string_view operator*() const { return payload; }
+
+            iterator& operator++()
+            {
+                valid = reader.read_frame(next, payload, next);
+                return *this;
+            }
+
+            bool operator!=(Sentinel /*unused*/) const noexcept { return valid; }
+        };
+
+    public:
+        explicit FrameReader(const basic_mmap_reader& r) : reader {r} {}
+
+        iterator begin() const { return iterator {reader}; }
+        Sentinel end() const { return {}; }
+    };
+
+    class CharReader
+    {
+    private:
+        basic_mmap_reader& reader;
+        [[no_unique_address]] mmap_stats::fault_scope<Traits::stats> faults;
+
+        class iterator
+        {
+        private:
+            basic_mmap_reader& reader;
+
+        public:
+            explicit iterator(basic_mmap_reader& in_) : reader {in_} {}
+
+            char operator*() const { return reader.next_char(); }
+
+            iterator& operator++() { return *this; }
+
+            bool operator!=(Sentinel /*unused*/) const noexcept { return !reader.eof(); }
+        };
+
+    public:
+        explicit CharReader(basic_mmap_reader& r) : reader {r}, faults {r.mmap_data.counters} {}
+
+        iterator begin() { return iterator {reader}; }
+        Sentinel end() { return {}; }
+    };
+
+    class AsyncLines
+    {
+    private:
+        static constexpr size_t batch_bytes {1024 * 1024};
+
+        const basic_mmap_reader& reader;
+        char delimiter;
+        std::function<void(std::coroutine_handle<>)> schedule;
+
+        size_t pos {0};
+        size_t batch_len {batch_bytes};
+        std::vector<std::string_view> batch;
+        std::vector<unsigned char> residency;
+
+        // The batch the worker faults in before it passes the waiting coroutine to schedule.
+        std::mutex mutex;
+        std::condition_variable_any wakeup;
+        size_t fault_begin {0};
+        size_t fault_end {0};
+        std::coroutine_handle<> waiting;
+
+        // Declared last, so it is joined before the members it uses are destroyed.
+        std::jthread worker;
+
+        [[nodiscard]]
+        size_t limit(size_t len) const noexcept
+        {
+            return std::min(pos + len, reader.mmap_data.total_size);
+        }
+
+        // Returns the offset just past the last delimiter in [pos, limit(len)), the end of the
+        // file if the range reaches it, or 0 if there is no delimiter.
+        [[nodiscard]]
+        size_t batch_end(size_t len) const noexcept
+        {
+            const size_t end = limit(len);
+            if (end == reader.mmap_data.total_size) { return end; }
+
+            const char* base = reader.mmap_data.mapped_ptr;
+            const void* found = ::memrchr(base + pos, delimiter, end - pos);
+            if (found == nullptr) { return 0; }
+            return static_cast<size_t>(static_cast<const char*>(found) - base) + 1;
+        }
+
+        // Whether the pages of [begin, end) are in memory, so that scanning them does not fault.
+        bool resident(size_t begin, size_t end)
+        {
+            const auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            const size_t first = begin & ~(page - 1);
+            residency.resize((end - first + page - 1) / page);
+            if (::mincore(reader.mmap_data.mapped_ptr + first, end - first, residency.data()) == -1)
+            {
+                return false;
+            }
+
+            return std::ranges::all_of(residency, [](unsigned char page_state)
+                                       { return (page_state & 1) != 0; });
+        }
+
+        // Faults in [begin, end) of the mapping at base.
+        static void prefault(const char* base, size_t begin, size_t end) noexcept
+        {
+            const auto page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            const size_t first = begin & ~(page - 1);
+            ::madvise(const_cast<char*>(base) + first, end - first, MADV_WILLNEED);
+            for (size_t offset = first; offset < end; offset += page)
+            {
+                static_cast<void>(*static_cast<const volatile char*>(base + offset));
+            }
+        }
+
+        void run(const std::stop_token& stop)
+        {
+            std::unique_lock lock {mutex};
+            while (wakeup.wait(lock, stop, [this] { return waiting != nullptr; }))
+            {
+                const std::coroutine_handle<> handle = std::exchange(waiting, nullptr);
+                const size_t begin = fault_begin;
+                const size_t end = fault_end;
+
+                lock.unlock();
+                prefault(reader.mmap_data.mapped_ptr, begin, end);
+                schedule(handle);
+                lock.lock();
+            }
+        }
+
+        class NextBatch
+        {
+        private:
+            AsyncLines& lines;
+
+        public:
+            explicit NextBatch(AsyncLines& lines_) noexcept : lines {lines_} {}
+
+            // Ready if the pages of the next batch are resident, growing it until it holds a
+            // delimiter.
+            bool await_ready()
+            {
+                if (lines.pos >= lines.reader.mmap_data.total_size) { return true; }
+
+                for (lines.batch_len = batch_bytes;; lines.batch_len *= 2)
+                {
+                    if (!lines.resident(lines.pos, lines.limit(lines.batch_len))) { return false; }
+                    if (lines.batch_end(lines.batch_len) != 0) { return true; }
+                }
+            }
+
+            // Hands the batch to the worker, which faults it in and then passes the coroutine to
+            // the scheduler.
+            void await_suspend(std::coroutine_handle<> handle)
+            {
+                {
+                    const std::scoped_lock lock {lines.mutex};
+                    lines.fault_begin = lines.pos;
+                    lines.fault_end = lines.limit(lines.batch_len);
+                    lines.waiting = handle;
+                }
+                lines.wakeup.notify_one();
+            }
+
+            std::span<const std::string_view> await_resume()
+            {
+                std::vector<std::string_view>& batch = lines.batch;
+                batch.clear();
+                if (lines.pos >= lines.reader.mmap_data.total_size) { return {}; }
+
+                size_t end = 0;
+                for (size_t len = lines.batch_len; (end = lines.batch_end(len)) == 0; len *= 2)
+                {}
+
+                auto collect = [&batch](std::string_view line) { batch.push_back(line); };
+                const char* first = lines.reader.mmap_data.mapped_ptr + lines.pos;
+                for_each_line({first, end - lines.pos}, lines.delimiter, collect);
+                lines.pos = end;
+                return batch;
+            }
+        };
+
+    public:
+        AsyncLines(const basic_mmap_reader& r,
+                   std::function<void(std::coroutine_handle<>)> schedule_,
+                   char delim)
+            : reader {r}, delimiter {delim}, schedule {std::move(schedule_)}
+        {
+            if (reader.mmap_data.windowed())
+            {
+                throw std::logic_error {"mmap_reader: async_lines requires a whole-file mapping"};
+            }
+            if (!schedule) { throw std::invalid_argument {"mmap_reader: schedule is empty"}; }
+
+            worker = std::jthread {[this](std::stop_token stop) { run(stop); }};
+        }
+
+        // The worker refers to this object, which therefore cannot move. A coroutine that is
+        // still waiting for a batch when it is destroyed is never scheduled.
+        AsyncLines(const AsyncLines&) = delete;
+        AsyncLines& operator=(const AsyncLines&) = delete;
+        AsyncLines(AsyncLines&&) = delete;
+        AsyncLines& operator=(AsyncLines&&) = delete;
+        ~AsyncLines() = default;
+
+        // Awaits the next batch of lines, which stays valid until the next call. An empty batch
+        // marks the end of the file.
+        [[nodiscard]]
+        NextBatch next() noexcept
+        {
+            return NextBatch {*this};
+        }
+    };
+
+public:
+    explicit basic_mmap_reader(std::string_view path) : basic_mmap_reader {path, options {}} {}
+    explicit basic_mmap_reader(int fd) : basic_mmap_reader {fd, options {}} {}
+
+    basic_mmap_reader(std::string_view path, const options& opts)
+        : file {path}, mmap_data {file.fd, opts}
+    {
+        if (opts.prefetch_distance > 0) { prefetcher = std::make_unique<Prefetcher>(mmap_data); }
+    }
+    basic_mmap_reader(int fd, const options& opts) : file {fd}, mmap_data {fd, opts}
+    {
+        if (opts.prefetch_distance > 0) { prefetcher = std::make_unique<Prefetcher>(mmap_data); }
+    }
+
+    // A moved-from reader is at the end of an empty file and may only be destroyed or assigned to.
+    basic_mmap_reader(basic_mmap_reader&& that) noexcept = default;
+
+    // Stops the prefetcher before the mapping it reads is replaced.
+    basic_mmap_reader& operator=(basic_mmap_reader&& that) noexcept
+    {
+        if (this != &that)
+        {
+            prefetcher.reset();
+            mmap_data = std::move(that.mmap_data);
+            file = std::move(that.file);
+            prefetcher = std::move(that.prefetcher);
+            read_pos = std::exchange(that.read_pos, 0);
+            prefetch_pos = std::exchange(that.prefetch_pos, SIZE_MAX);
+            line_index = std::move(that.line_index);
+            watch = std::move(that.watch);
+        }
+        return *this;
+    }
+
+    // Opens path through the process-wide mapping cache. Readers of the same version of a file
+    // share one read-only whole-file mapping, so a repeated open costs a stat() and a hash lookup.
+    // populate, huge_pages and lock take effect when the shared mapping is created; advice is
+    // applied by every reader to the whole shared mapping. Throws std::invalid_argument if
+    // opts.window_size is set.
+    [[nodiscard]]
+    static basic_mmap_reader open_cached(std::string_view path)
+    {
+        return open_cached(path, options {});
+    }
+
+    [[nodiscard]]
+    static basic_mmap_reader open_cached(std::string_view path, const options& opts)
+    {
+        if (opts.window_size != 0 || opts.follow)
+        {
+            throw std::invalid_argument {
+                "mmap_reader: a cached mapping cannot be windowed or followed"};
+        }
+
+        struct stat state_buf;
+        if (::stat(path.data(), &state_buf) == -1)
+        {
+            throw std::system_error {errno,
+                                     std::system_category(),
+                                     std::format("mmap_reader: cannot stat file {}", path)};
+        }
+
+        MappingCache& cache = MappingCache::instance();
+        std::shared_ptr<const SharedMapping> mapping = cache.find(MappingCache::key_of(state_buf));
+        if (mapping == nullptr)
+        {
+            auto created = std::make_shared<const SharedMapping>(path, opts);
+
+            // The file may have been replaced since the stat(), so key it by what was opened.
+            if (::fstat(created->file.fd, &state_buf) == -1)
+            {
+                throw std::system_error {errno,
+                                         std::system_category(),
+                                         std::format("mmap_reader: cannot stat file {}", path)};
+            }
+            mapping = cache.insert(MappingCache::key_of(state_buf), std::move(created));
+        }
+
+        return basic_mmap_reader {std::move(mapping), opts};
+    }
+
+    // In follow mode, picks up the lines appended to the file since construction or the last call
+    // and returns the new size(). Positions stay valid, but in whole-file mode the mapping may
+    // move, which invalidates data() and earlier views. If the file shrank below size(), e.g.
+    // truncated by log rotation, reading restarts at offset 0.
+    size_t refresh()
+    {
+        if (!mmap_data.opts.follow)
+        {
+            throw std::logic_error {"mmap_reader: refresh() requires options::follow"};
+        }
+
+        // The helper thread touches the whole-file mapping, which mremap may move or shrink.
+        if (prefetcher != nullptr) { prefetcher->pause(); }
+
+        if (!mmap_data.refresh()) { read_pos = 0; }
+
+        if (prefetcher != nullptr)
+        {
+            prefetcher->resume(mmap_data);
+            prefetch_pos = SIZE_MAX;
+        }
+
+        return mmap_data.total_size;
+    }
+
+    // In follow mode, waits up to timeout for a complete line past the read position, calling
+    // refresh() whenever the file changes and at least every options::poll_interval. Returns
+    // false on timeout.
+    bool wait_for_data(std::chrono::milliseconds timeout)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        for (;;)
+        {
+            refresh();
+            if (!eof()) { return true; }
+
+            const auto now = std::chrono::steady_clock::now();
+            if (now >= deadline) { return false; }
+
+            if (watch == nullptr) { watch = std::make_unique<Watch>(file.fd); }
+            watch->wait(std::min(std::chrono::ceil<std::chrono::milliseconds>(deadline - now),
+                                 mmap_data.opts.poll_interval));
+        }
+    }
+
+    // Sets how many shared mappings open_cached() keeps, least recently used first out. 0 disables
+    // caching. Default: 64.
+    static void set_cache_capacity(size_t n) { MappingCache::instance().set_capacity(n); }
+
+    // Drops all shared mappings from the cache. Readers still using them are not affected.
+    static void clear_cache() { MappingCache::instance().clear(); }
+
+    explicit operator bool() const noexcept { return !eof(); }
+
+    [[nodiscard]]
+    const char* data() const noexcept
+    {
+        return mmap_data.mapped_ptr;
+    }
+
+    [[nodiscard]]
+    size_t size() const noexcept
+    {
+        return mmap_data.total_size;
+    }
+
+    [[nodiscard]]
+    size_t tell() const noexcept
+    {
+        return read_pos;
+    }
+
+    // Counters of this reader since it was opened or reset_stats() was called. All zero unless
+    // built with MMAP_STATS (see mmap_stats.hpp).
+    [[nodiscard]]
+    mmap_stats::reader_stats stats() const noexcept
+    {
+        return mmap_data.counters.reader();
+    }
+
+    void reset_stats() const noexcept { mmap_data.counters.reset(); }
+
+    void advise(access_pattern pattern) const
+    {
+        mmap_data.advise(pattern, mmap_data.map_offset, mmap_data.map_size);
+    }
+
+    void advise(access_pattern pattern, size_t offset, size_t len) const
+    {
+        mmap_data.advise(pattern, offset, len);
+    }
+
+    void seek(size_t pos) noexcept { read_pos = std::min(pos, mmap_data.total_size); }
+
+    static const seekdir beg {seekdir::beg};
+    static const seekdir cur {seekdir::cur};
+    static const seekdir end {seekdir::end};
+
+    void seek(ptrdiff_t off, seekdir dir) noexcept
+    {
+        switch (dir)
+        {
+        case seekdir::beg:
+            if (off < 0) { read_pos = 0; }
+            else { read_pos = std::min(static_cast<size_t>(off), mmap_data.total_size); }
+            break;
+        case seekdir::cur:
+            if (off < 0)
+            {
+                read_pos = (static_cast<size_t>(-off) > read_pos)
+                               ? 0
+                               : read_pos - static_cast<size_t>(-off);
+            }
+            else { read_pos = std::min(read_pos + static_cast<size_t>(off), mmap_data.total_size); }
+            break;
+        case seekdir::end:
+            if (off < 0)
+            {
+                read_pos = (static_cast<size_t>(-off) > mmap_data.total_size)
+                               ? 0
+                               : mmap_data.total_size - static_cast<size_t>(-off);
+            }
+            else { read_pos = mmap_data.total_size; }
+            break;
+        default:
+            break;
+        }
+    }
+
+    std::span<char> read(std::span<char> buf) noexcept
+    {
+        const size_t to_read = std::min(buf.size(), mmap_data.total_size - read_pos);
+        const size_t copied = mmap_data.copy_out(read_pos, buf.data(), to_read);
+
+        read_pos += copied;
+        mmap_data.counters.add_bytes(copied);
+
+        return buf.first(copied);
+    }
+
+    size_t pread(std::span<char> buf, size_t offset) const noexcept
+    {
+        if (offset >= mmap_data.total_size) { return 0; }
+
+        const size_t to_read = std::min(buf.size(), mmap_data.total_size - offset);
+        const size_t copied = mmap_data.copy_out(offset, buf.data(), to_read);
+        mmap_data.counters.add_bytes(copied);
+        return copied;
+    }
+
+    [[nodiscard]]
+    std::optional<std::string_view> getline(char delimiter = Traits::delimiter)
+    {
+        if (eof()) { return std::nullopt; }
+        return next_line(delimiter);
+    }
+
+    // Splits on a multi-byte delimiter such as "\x1e\n". Throws std::invalid_argument if empty.
+    [[nodiscard]]
+    std::optional<std::string_view> getline(std::string_view delimiter)
+    {
+        check_delimiter(delimiter);
+        if (eof()) { return std::nullopt; }
+        return next_line(delimiter);
+    }
+
+    [[nodiscard]]
+    std::optional<std::string_view> getline(any_of delimiter)
+    {
+        check_delimiter(delimiter);
+        if (eof()) { return std::nullopt; }
+        return next_line(delimiter);
+    }
+
+    [[nodiscard]]
+    std::optional<std::string_view> getline(crlf_t delimiter)
+    {
+        if (eof()) { return std::nullopt; }
+        return next_line(delimiter);
+    }
+
+    [[nodiscard]]
+    std::optional<char> getchar()
+    {
+        if (eof()) { return std::nullopt; }
+        return next_char();
+    }
+
+    // Skips whitespace and returns the next whitespace-delimited token, or nullopt at end of file.
+    [[nodiscard]]
+    std::optional<std::string_view> read_token()
+    {
+        const std::string_view token = peek_token();
+        if (token.empty()) { return std::nullopt; }
+
+        read_pos += token.size();
+        return token;
+    }
+
+    // Skips whitespace and parses an integer in place, like std::from_chars. Only the parsed
+    // characters are consumed; on failure or overflow the position stays at the start of the token.
+    template <std::integral T>
+    [[nodiscard]]
+    std::optional<T> read_int(int base = 10)
+    {
+        static_assert(!std::is_same_v<T, bool>, "mmap_reader: read_int does not parse bool");
+
+        const std::string_view token = peek_token();
+        const char* first = token.data();
+        const char* last = token.data() + token.size();
+
+        T value {};
+        const char* end = first;
+        if (base == 10) { end = parse_decimal(first, last, value); }
+        else
+        {
+            const auto [ptr, ec] = std::from_chars(first, last, value, base);
+            if (ec == std::errc {}) { end = ptr; }
+        }
+
+        if (end == first) { return std::nullopt; }
+
+        read_pos += static_cast<size_t>(end - first);
+        return value;
+    }
+
+    // Skips whitespace and parses a floating-point number in place, like std::from_chars.
+    template <std::floating_point T>
+    [[nodiscard]]
+    std::optional<T> read_float(std::chars_format format = std::chars_format::general)
+    {
+        const std::string_view token = peek_token();
+
+        T value {};
+        const auto [ptr, ec] =
+            std::from_chars(token.data(), token.data() + token.size(), value, format);
+        if (ec != std::errc {} || ptr == token.data()) { return std::nullopt; }
+
+        read_pos += static_cast<size_t>(ptr - token.data());
+        return value;
+    }
+
+    [[nodiscard]]
+    LineReader<char> lines(char delimiter = Traits::delimiter)
+    {
+        return LineReader<char>(*this, delimiter);
+    }
+
+    // The delimiter bytes are not copied and must outlive the returned range.
+    [[nodiscard]]
+    LineReader<std::string_view> lines(std::string_view delimiter)
+    {
+        check_delimiter(delimiter);
+        return LineReader<std::string_view>(*this, delimiter);
+    }
+
+    [[nodiscard]]
+    LineReader<any_of> lines(any_of delimiter)
+    {
+        check_delimiter(delimiter);
+        return LineReader<any_of>(*this, delimiter);
+    }
+
+    [[nodiscard]]
+    LineReader<crlf_t> lines(crlf_t delimiter)
+    {
+        return LineReader<crlf_t>(*this, delimiter);
+    }
+
+    // Returns a range of rows, each a span of fields pointing into the mapping. The span is reused
+    // and stays valid until the next row is read.
+    [[nodiscard]]
+    FieldReader fields(char line_delimiter = Traits::delimiter,
+                       char field_delimiter = ',',
+                       char quote = '"')
+    {
+        return FieldReader(*this, line_delimiter, field_delimiter, quote);
+    }
+
+    // Replaces the doubled quotes inside a quoted field returned by fields() with single ones.
+    [[nodiscard]]
+    static std::string unescape(std::string_view field, char quote = '"')
+    {
+        std::string result;
+        result.reserve(field.size());
+        for (size_t i = 0; i < field.size(); ++i)
+        {
+            result += field[i];
+            if (field[i] == quote && i + 1 < field.size() && field[i + 1] == quote) { ++i; }
+        }
+        return result;
+    }
+
+    // Splits the file into at most n chunks, each ending right after a delimiter (or at end of file).
+    [[nodiscard]]
+    std::vector<std::string_view> split(size_t n, char delimiter = Traits::delimiter) const
+    {
+        if (mmap_data.windowed())
+        {
+            throw std::logic_error {"mmap_reader: split requires a whole-file mapping"};
+        }
+
+        std::vector<std::string_view> chunks;
+        if (n == 0 || mmap_data.map_size == 0) { return chunks; }
+
+        const char* last = mmap_data.mapped_ptr + mmap_data.map_size;
+        const char* begin = mmap_data.mapped_ptr;
+        for (size_t i = 1; i <= n && begin != last; ++i)
+        {
+            const char* target = mmap_data.mapped_ptr + mmap_data.map_size / n * i;
+            const char* end = (i == n) ? last : std::max(begin, target);
+            if (end != last)
+            {
+                end = mmap_simd::find(end, last, delimiter);
+                if (end != last) { ++end; }
+            }
+
+            chunks.emplace_back(begin, static_cast<size_t>(end - begin));
+            begin = end;
+        }
+
+        return chunks;
+    }
+
+    // Returns batches of lines for a coroutine on an event loop, split as lines(delimiter) splits
+    // them; the read position is not used. co_await next() completes at once if the pages of the
+    // next batch are resident. Otherwise it suspends, and a worker thread owned by the returned
+    // object faults them in and passes the coroutine to schedule, which must queue it for the
+    // loop rather than resume it. The reader must not be refreshed or destroyed while the object
+    // lives.
+    [[nodiscard]]
+    AsyncLines async_lines(std::function<void(std::coroutine_handle<>)> schedule,
+                           char delimiter = Traits::delimiter) const
+    {
+        return AsyncLines {*this, std::move(schedule), delimiter};
+    }
+
+    // Calls callback(line) or callback(chunk_index, line) for every line, using up to n_threads threads.
+    // Lines of one chunk are visited in order by a single thread; the read position is not used.
+    template <typename Callback>
+    void
+    parallel_lines(size_t n_threads, Callback callback, char delimiter = Traits::delimiter) const
+    {
+        const std::vector<std::string_view> chunks =
+            split(std::max<size_t>(n_threads, 1), delimiter);
+
+        run_parallel(chunks.size(),
+                     [&](size_t index)
+                     {
+                         const mmap_stats::fault_scope<Traits::stats> faults {mmap_data.counters};
+                         if constexpr (std::is_invocable_v<Callback&, size_t, std::string_view>)
+                         {
+                             auto with_index = [&](std::string_view line)
+                             { callback(index, line); };
+                             for_each_line(chunks[index], delimiter, with_index);
+                         }
+                         else { for_each_line(chunks[index], delimiter, callback); }
+                     });
+    }
+
+    // Returns the offsets of all occurrences of pattern in ascending order, overlapping ones
+    // included, searching with up to n_threads threads. The read position is not used.
+    [[nodiscard]]
+    std::vector<size_t> find_all(std::string_view pattern, size_t n_threads = 1) const
+    {
+        const std::vector<std::pair<size_t, size_t>> ranges = match_ranges(pattern, n_threads);
+
+        std::vector<std::vector<size_t>> parts(ranges.size());
+        run_parallel(ranges.size(),
+                     [&](size_t index)
+                     {
+                         for_each_match(ranges[index],
+                                        pattern,
+                                        [&](const char* match)
+                                        {
+                                            parts[index].push_back(static_cast<size_t>(
+                                                match - mmap_data.mapped_ptr));
+                                        });
+                     });
+
+        std::vector<size_t> offsets;
+        for (const std::vector<size_t>& part : parts)
+        {
+            offsets.insert(offsets.end(), part.begin(), part.end());
+        }
+        return offsets;
+    }
+
+    // Returns the number of occurrences of pattern, overlapping ones included, searching with up
+    // to n_threads threads.
+    [[nodiscard]]
+    size_t count(std::string_view pattern, size_t n_threads = 1) const
+    {
+        const std::vector<std::pair<size_t, size_t>> ranges = match_ranges(pattern, n_threads);
+
+        std::vector<size_t> counts(ranges.size(), 0);
+        run_parallel(ranges.size(),
+                     [&](size_t index)
+                     {
+                         size_t n = 0;
+                         auto counter = [&n](const char* /*match*/) { ++n; };
+                         for_each_match(ranges[index], pattern, counter);
+                         counts[index] = n;
+                     });
+        return std::accumulate(counts.begin(), counts.end(), size_t {0});
+    }
+
+    // Returns the lines containing pattern in file order, each once, searching with up to
+    // n_threads threads. Lines are split as lines(delimiter) splits them, so a pattern that
+    // contains the delimiter matches no line.
+    [[nodiscard]]
+    std::vector<std::string_view>
+    lines_matching(std::string_view pattern,
+                   size_t n_threads = 1,
+                   char delimiter = Traits::delimiter) const
+    {
+        if (pattern.empty()) { throw std::invalid_argument {"mmap_reader: empty search pattern"}; }
+        if (pattern.find(delimiter) != std::string_view::npos) { return {}; }
+
+        const std::vector<std::string_view> chunks =
+            split(std::max<size_t>(n_threads, 1), delimiter);
+
+        std::vector<std::vector<std::string_view>> parts(chunks.size());
+        run_parallel(chunks.size(),
+                     [&](size_t index)
+                     {
+                         // first is always the start of a line.
+                         const char* first = chunks[index].data();
+                         const char* last = first + chunks[index].size();
+                         while (first != last)
+                         {
+                             const char* match = mmap_simd::search(first, last, pattern);
+                             if (match == last) { break; }
+
+                             const void* before =
+                                 ::memrchr(first, delimiter, static_cast<size_t>(match - first));
+                             const char* begin =
+                                 before != nullptr ? static_cast<const char*>(before) + 1 : first;
+                             const char* end = find_delimiter(match, last, delimiter);
+
+                             parts[index].emplace_back(begin, static_cast<size_t>(end - begin));
+                             first = end != last ? end + 1 : last;
+                         }
+                     });
+
+        std::vector<std::string_view> lines;
+        for (const std::vector<std::string_view>& part : parts)
+        {
+            lines.insert(lines.end(), part.begin(), part.end());
+        }
+        return lines;
+    }
+
+    // Builds the line index used by line(), seek_line() and indexed_lines(), scanning with up to
+    // n_threads threads. Lines are split exactly as lines() splits them.
+    void build_line_index(size_t n_threads = 1, char delimiter = Traits::delimiter)
+    {
+        const std::vector<std::string_view> chunks =
+            split(std::max<size_t>(n_threads, 1), delimiter);
+
+        // First pass: count the lines of every chunk to learn the line number each one starts at,
+        // which decides where the checkpoints fall.
+        std::vector<size_t> first_line(chunks.size() + 1, 0);
+        run_parallel(chunks.size(),
+                     [&](size_t index)
+                     {
+                         size_t count = 0;
+                         auto counter = [&count](std::string_view /*line*/) { ++count; };
+                         for_each_line(chunks[index], delimiter, counter);
+                         first_line[index + 1] = count;
+                     });
+        std::partial_sum(first_line.begin(), first_line.end(), first_line.begin());
+
+        // Second pass: encode every chunk separately, then concatenate the parts.
+        std::vector<LineIndex> parts(chunks.size());
+        run_parallel(chunks.size(),
+                     [&](size_t index)
+                     {
+                         LineIndex& part = parts[index];
+                         size_t n = first_line[index];
+                         const char* first = chunks[index].data();
+                         const char* last = first + chunks[index].size();
+                         while (first != last)
+                         {
+                             const char* found = find_delimiter(first, last, delimiter);
+                             const char* next = found != last ? found + 1 : last;
+
+                             if (n % LineIndex::block_lines == 0)
+                             {
+                                 part.checkpoints.push_back(
+                                     {static_cast<uint64_t>(first - mmap_data.mapped_ptr),
+                                      part.deltas.size()});
+                             }
+                             LineIndex::put_varint(part.deltas,
+                                                   static_cast<uint64_t>(next - first));
+
+                             first = next;
+                             ++n;
+                         }
+                     });
+
+        LineIndex index;
+        index.delimiter = delimiter;
+        index.count = first_line.back();
+        for (const LineIndex& part : parts)
+        {
+            for (typename LineIndex::Checkpoint checkpoint : part.checkpoints)
+            {
+                checkpoint.delta_pos += index.deltas.size();
+                index.checkpoints.push_back(checkpoint);
+            }
+            index.deltas.insert(index.deltas.end(), part.deltas.begin(), part.deltas.end());
+        }
+        index.built = true;
+
+        line_index = std::move(index);
+    }
+
+    [[nodiscard]]
+    bool has_line_index() const noexcept
+    {
+        return line_index.built;
+    }
+
+    [[nodiscard]]
+    size_t line_count() const
+    {
+        return indexed().count;
+    }
+
+    // Returns line n, without its delimiter, in constant time.
+    [[nodiscard]]
+    std::string_view line(size_t n) const
+    {
+        const LineIndex& index = indexed();
+        if (Traits::checked && n >= index.count)
+        {
+            throw std::out_of_range {"mmap_reader: line number out of range"};
+        }
+
+        const auto [offset, len] = index.locate(n);
+        std::string_view result = view(offset, len);
+        if (!result.empty() && result.back() == index.delimiter) { result.remove_suffix(1); }
+        return result;
+    }
+
+    // Moves the read position to the start of line n.
+    void seek_line(size_t n)
+    {
+        const LineIndex& index = indexed();
+        if (Traits::checked && n >= index.count)
+        {
+            throw std::out_of_range {"mmap_reader: line number out of range"};
+        }
+
+        read_pos = index.locate(n).first;
+    }
+
+    [[nodiscard]]
+    IndexedLines indexed_lines() const
+    {
+        static_cast<void>(indexed());
+        return IndexedLines {*this};
+    }
+
+    // Writes the line index to a sidecar file, stamped with the size and mtime of the mapped file.
+    void save_line_index(std::string_view path) const
+    {
+        const LineIndex& index = indexed();
+        const struct stat state_buf = file_status();
+
+        typename LineIndex::Header header {};
+        std::copy_n(LineIndex::magic, sizeof(header.magic), header.magic);
+        header.file_size = mmap_data.total_size;
+        header.mtime_sec = state_buf.st_mtim.tv_sec;
+        header.mtime_nsec = state_buf.st_mtim.tv_nsec;
+        header.delimiter = static_cast<unsigned char>(index.delimiter);
+        header.count = index.count;
+        header.checkpoints = index.checkpoints.size();
+        header.deltas = index.deltas.size();
+
+        const int fd = ::open(path.data(), O_WRONLY | O_CREAT | O_TRUNC, S_IRUSR | S_IWUSR);
+        if (fd == -1)
+        {
+            throw std::system_error {errno,
+                                     std::system_category(),
+                                     std::format("mmap_reader: cannot open file {}", path)};
+        }
+
+        const bool written =
+            LineIndex::write_all(fd, &header, sizeof(header)) &&
+            LineIndex::write_all(fd,
+                                 index.checkpoints.data(),
+                                 index.checkpoints.size() * sizeof(index.checkpoints[0])) &&
+            LineIndex::write_all(fd, index.deltas.data(), index.deltas.size());
+        const int saved_errno = errno;
+
+        if (::close(fd) == -1 || !written)
+        {
+            throw std::system_error {written ? errno : saved_errno,
+                                     std::system_category(),
+                                     std::format("mmap_reader: cannot write file {}", path)};
+        }
+    }
+
+    // Loads a sidecar written by save_line_index. Returns false, leaving the current index alone,
+    // if the sidecar is missing, malformed, or was written for a different size or mtime.
+    bool load_line_index(std::string_view path)
+    {
+        const struct stat state_buf = file_status();
+
+        const int fd = ::open(path.data(), O_RDONLY);
+        if (fd == -1) { return false; }
+
+        LineIndex index;
+        typename LineIndex::Header header {};
+        // Sizes are checked before allocating anything; at most ten varint bytes per line.
+        bool loaded =
+            LineIndex::read_all(fd, &header, sizeof(header)) &&
+            std::equal(header.magic, header.magic + sizeof(header.magic), LineIndex::magic) &&
+            header.file_size == mmap_data.total_size &&
+            header.mtime_sec == state_buf.st_mtim.tv_sec &&
+            header.mtime_nsec == state_buf.st_mtim.tv_nsec && header.delimiter <= 0xff &&
+            header.count <= header.file_size &&
+            header.checkpoints ==
+                (header.count + LineIndex::block_lines - 1) / LineIndex::block_lines &&
+            header.deltas <= header.count * 10;
+
+        if (loaded)
+        {
+            index.delimiter = static_cast<char>(header.delimiter);
+            index.count = header.count;
+            index.checkpoints.resize(header.checkpoints);
+            index.deltas.resize(header.deltas);
+
+            char extra = 0;
+            loaded =
+                LineIndex::read_all(fd,
+                                    index.checkpoints.data(),
+                                    index.checkpoints.size() * sizeof(index.checkpoints[0])) &&
+                LineIndex::read_all(fd, index.deltas.data(), index.deltas.size()) &&
+                ::read(fd, &extra, 1) == 0 && index.consistent(mmap_data.total_size);
+        }
+        ::close(fd);
+
+        if (!loaded) { return false; }
+
+        index.built = true;
+        line_index = std::move(index);
+        return true;
+    }
 
     [[nodiscard]]
     CharReader chars()
@@ -328,22 +2595,97 @@ public:
     [[nodiscard]]
     std::string str() const
     {
-        return {mmap_data.mapped_ptr, mmap_data.map_size};
+        std::string content;
+        if (!mmap_data.windowed()) { content.assign(mmap_data.mapped_ptr, mmap_data.map_size); }
+        else
+        {
+            content.resize(mmap_data.total_size);
+            content.resize(mmap_data.copy_out(0, content.data(), content.size()));
+        }
+
+        mmap_data.counters.add_bytes(content.size());
+        return content;
     }
 
     [[nodiscard]]
-    std::string_view view(size_t offset, size_t len) const noexcept
+    std::string_view view(size_t offset, size_t len) const
     {
-        if (offset >= mmap_data.map_size) { return {}; }
+        if (offset >= mmap_data.total_size) { return {}; }
 
-        const size_t available = mmap_data.map_size - offset;
+        const size_t available = mmap_data.total_size - offset;
         const size_t actual_len = std::min(len, available);
-        return {mmap_data.mapped_ptr + offset, actual_len};
+        return {mmap_data.at(offset, actual_len), actual_len};
     }
 
     [[nodiscard]]
     std::string str(size_t offset, size_t len) const
     {
-        return std::string {view(offset, len)};
+        std::string content {view(offset, len)};
+        mmap_data.counters.add_bytes(content.size());
+        return content;
+    }
+
+    // Views count records of type T stored at offset, without copying. In windowed mode the span
+    // is valid until the window moves.
+    template <typename T>
+    [[nodiscard]]
+    std::span<const T> as_span(size_t offset, size_t count) const
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "mmap_reader: T must be trivially copyable");
+        static_assert(4096 % alignof(T) == 0, "mmap_reader: T must not be over-aligned");
+
+        if constexpr (Traits::checked)
+        {
+            if (offset % alignof(T) != 0)
+            {
+                throw std::invalid_argument {
+                    "mmap_reader: offset is not aligned for the record type"};
+            }
+            if (offset > mmap_data.total_size ||
+                count > (mmap_data.total_size - offset) / sizeof(T))
+            {
+                throw std::out_of_range {"mmap_reader: records extend past the end of the file"};
+            }
+        }
+
+        // Mappings start on a page boundary, so aligned file offsets give aligned addresses.
+        const char* first = mmap_data.at(offset, count * sizeof(T));
+        return {reinterpret_cast<const T*>(first), count};
+    }
+
+    // Returns a range over the payloads of the framed records written by
+    // mmap_writer::append_record. It ends at the end of file or at the first incomplete or corrupt
+    // frame. In windowed mode each payload is valid until the next one is read.
+    [[nodiscard]]
+    FrameReader framed_records() const
+    {
+        return FrameReader {*this};
+    }
+
+    // Returns the number of bytes covered by valid framed records from the start of the file,
+    // which is where a writer should continue after a crash.
+    [[nodiscard]]
+    size_t framed_size() const
+    {
+        size_t pos = 0;
+        std::string_view payload;
+        while (read_frame(pos, payload, pos))
+        {}
+        return pos;
+    }
+
+    // Views the whole file as an array of T; a trailing partial record is ignored.
+    template <typename T>
+    [[nodiscard]]
+    std::span<const T> records() const
+    {
+        if (mmap_data.windowed())
+        {
+            throw std::logic_error {"mmap_reader: records requires a whole-file mapping"};
+        }
+
+        return as_span<T>(0, mmap_data.total_size / sizeof(T));
     }
 };
+
+using mmap_reader = basic_mmap_reader<>;
@@ -0,0 +1,532 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cstdint>
+#include <cstdio>  // perror
+#include <cstring>
+#include <ctime>
+#include <fcntl.h> // open
+#include <format>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+#include <system_error>
+#include <linux/futex.h>
+#include <sys/file.h>    // flock
+#include <sys/mman.h>    // mmap, munmap, msync
+#include <sys/stat.h>    // fstat
+#include <sys/syscall.h> // futex
+#include <unistd.h>      // close, ftruncate
+
+// Fixed-slot ring buffer in a file mapped with MAP_SHARED, for passing messages between threads
+// or processes that open the same file. It supports one consumer and one producer, or several
+// producers with options::multi_producer.
+//
+// Every slot carries a sequence number that tells producers it is free and the consumer that it
+// is published, so producers and the consumer only contend on the slot they touch. The claim
+// position of the producers and the read position of the consumer sit on separate cache lines.
+// Blocking waits sleep on futexes in the mapping and cost no syscall when nobody is waiting.
+//
+// The ring lives on in the file: messages that were published but not consumed are still there
+// when the file is opened again, e.g. after a crash.
+class mmap_ring
+{
+public:
+    struct options
+    {
+        size_t slot_size {256};      // payload bytes per slot
+        size_t slot_count {1024};    // number of slots, a power of two
+        bool multi_producer {false}; // producers claim slots with a compare-and-swap
+    };
+
+private:
+    static constexpr size_t cache_line {64};
+    static constexpr char magic[8] {'m', 'm', 'r', 'i', 'n', 'g', '1', '\0'};
+    // Size of a slot abandoned by a producer that died before committing it; see recover().
+    static constexpr uint64_t abandoned {UINT64_MAX};
+
+    struct Header
+    {
+        char magic[8];
+        uint64_t slot_size;
+        uint64_t slot_count;
+        alignas(cache_line) uint64_t claim; // next position a producer claims
+        alignas(cache_line) uint64_t tail;  // next position the consumer reads
+        alignas(cache_line) uint32_t data_event;
+        uint32_t consumers_waiting;
+        alignas(cache_line) uint32_t space_event;
+        uint32_t producers_waiting;
+    };
+
+    // Position p owns a slot while sequence == p, and the slot holds a published message while
+    // sequence == p + 1. Consuming it hands it over to position p + slot_count.
+    struct Slot
+    {
+        uint64_t sequence;
+        uint64_t size;
+    };
+
+    static_assert(std::atomic_ref<uint64_t>::is_always_lock_free &&
+                  std::atomic_ref<uint32_t>::is_always_lock_free);
+
+    struct File
+    {
+    private:
+        static int open(std::string_view path)
+        {
+            const int fd = ::open(path.data(), O_RDWR | O_CREAT | O_CLOEXEC, S_IRUSR | S_IWUSR);
+            if (fd == -1)
+            {
+                throw std::system_error {errno,
+                                         std::system_category(),
+                                         std::format("mmap_ring: cannot open file {}", path)};
+            }
+
+            return fd;
+        }
+
+    public:
+        int fd;
+
+        explicit File(std::string_view path) : fd {open(path)} {}
+
+        ~File()
+        {
+            if (::close(fd) == -1) { perror("mmap_ring: close file failed"); }
+        }
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+        File(File&& that) noexcept = delete;
+        File& operator=(File&& that) noexcept = delete;
+
+        [[nodiscard]]
+        size_t size() const
+        {
+            struct stat state_buf;
+            if (::fstat(fd, &state_buf) == -1)
+            {
+                throw std::system_error {errno, std::system_category(), "mmap_ring: fstat failed"};
+            }
+
+            return static_cast<size_t>(state_buf.st_size);
+        }
+    };
+
+    // Holds an exclusive flock on the file while the ring is created or validated, so that two
+    // processes opening a new file do not both initialize it.
+    struct Lock
+    {
+        int fd;
+
+        explicit Lock(int fd_) : fd {fd_}
+        {
+            while (::flock(fd, LOCK_EX) == -1)
+            {
+                if (errno != EINTR)
+                {
+                    throw std::system_error {
+                        errno, std::system_category(), "mmap_ring: flock failed"};
+                }
+            }
+        }
+
+        ~Lock() { ::flock(fd, LOCK_UN); }
+
+        Lock(const Lock&) = delete;
+        Lock& operator=(const Lock&) = delete;
+        Lock(Lock&& that) noexcept = delete;
+        Lock& operator=(Lock&& that) noexcept = delete;
+    };
+
+    struct MmapData
+    {
+        char* mapped_ptr;
+        size_t map_size;
+
+        MmapData(int fd, size_t size) : map_size {size}
+        {
+            void* addr = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            if (addr == MAP_FAILED)
+            {
+                throw std::system_error {errno, std::system_category(), "mmap_ring: mmap failed"};
+            }
+
+            mapped_ptr = static_cast<char*>(addr);
+        }
+
+        ~MmapData()
+        {
+            if (::munmap(mapped_ptr, map_size) == -1) { perror("mmap_ring: munmap failed"); }
+        }
+
+        MmapData(const MmapData&) = delete;
+        MmapData& operator=(const MmapData&) = delete;
+        MmapData(MmapData&& that) noexcept = delete;
+        MmapData& operator=(MmapData&& that) noexcept = delete;
+    };
+
+    static options validated(const options& opts)
+    {
+        if (opts.slot_size == 0 || opts.slot_count < 2 || !std::has_single_bit(opts.slot_count))
+        {
+            throw std::invalid_argument {
+                "mmap_ring: slot_size must be positive and slot_count a power of two"};
+        }
+
+        return opts;
+    }
+
+    static size_t stride_of(size_t slot_size) noexcept
+    {
+        return (sizeof(Slot) + slot_size + cache_line - 1) & ~(cache_line - 1);
+    }
+
+    static size_t file_size_of(const options& opts) noexcept
+    {
+        return sizeof(Header) + opts.slot_count * stride_of(opts.slot_size);
+    }
+
+    // Sizes an empty file for the ring and checks the size of an existing one.
+    static size_t prepare_file(const File& file, const options& opts)
+    {
+        const size_t size = file.size();
+        if (size == 0)
+        {
+            if (::ftruncate(file.fd, static_cast<off_t>(file_size_of(opts))) == -1)
+            {
+                throw std::system_error {
+                    errno, std::system_category(), "mmap_ring: ftruncate failed"};
+            }
+            return file_size_of(opts);
+        }
+
+        if (size != file_size_of(opts))
+        {
+            throw std::invalid_argument {"mmap_ring: the file holds a ring of a different size"};
+        }
+        return size;
+    }
+
+    template <typename T>
+    static std::atomic_ref<T> atomic(T& value) noexcept
+    {
+        return std::atomic_ref<T> {value};
+    }
+
+    static void futex_wait(uint32_t& word, uint32_t expected, std::chrono::nanoseconds timeout)
+    {
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+        const timespec relative {static_cast<time_t>(seconds.count()),
+                                 static_cast<long>((timeout - seconds).count())};
+        // Not FUTEX_PRIVATE_FLAG: waiters and wakers may be in different processes.
+        ::syscall(SYS_futex, &word, FUTEX_WAIT, expected, &relative, nullptr, 0);
+    }
+
+    static void futex_wake(uint32_t& word) noexcept
+    {
+        ::syscall(SYS_futex, &word, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+    }
+
+    // Waits until ready() holds or timeout passes. The waiter count is raised before ready() is
+    // checked again, so a notify() that follows the state change it waits for cannot miss it.
+    template <typename Ready>
+    static bool
+    wait(uint32_t& event, uint32_t& waiting, std::chrono::milliseconds timeout, Ready ready)
+    {
+        const auto deadline = std::chrono::steady_clock::now() + timeout;
+        for (;;)
+        {
+            if (ready()) { return true; }
+
+            const uint32_t observed = atomic(event).load(std::memory_order_acquire);
+            atomic(waiting).fetch_add(1, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+
+            const auto now = std::chrono::steady_clock::now();
+            const bool done = ready();
+            if (!done && now < deadline) { futex_wait(event, observed, deadline - now); }
+
+            atomic(waiting).fetch_sub(1, std::memory_order_relaxed);
+            if (done) { return true; }
+            if (now >= deadline) { return false; }
+        }
+    }
+
+    static void notify(uint32_t& event, uint32_t& waiting) noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (atomic(waiting).load(std::memory_order_relaxed) != 0)
+        {
+            atomic(event).fetch_add(1, std::memory_order_release);
+            futex_wake(event);
+        }
+    }
+
+    Header& header() const noexcept { return *reinterpret_cast<Header*>(mmap_data.mapped_ptr); }
+
+    Slot& slot_at(uint64_t pos) const noexcept
+    {
+        return *reinterpret_cast<Slot*>(mmap_data.mapped_ptr + sizeof(Header) +
+                                        (pos & (opts.slot_count - 1)) * stride);
+    }
+
+    static char* payload(Slot& slot) noexcept { return reinterpret_cast<char*>(&slot + 1); }
+
+    void init_or_check()
+    {
+        Header& h = header();
+        if (std::memcmp(h.magic, magic, sizeof(magic)) != 0)
+        {
+            h.slot_size = opts.slot_size;
+            h.slot_count = opts.slot_count;
+            for (uint64_t i = 0; i < opts.slot_count; ++i) { slot_at(i).sequence = i; }
+            // Written last, so an interrupted initialization is redone by the next open.
+            std::memcpy(h.magic, magic, sizeof(magic));
+            return;
+        }
+
+        if (h.slot_size != opts.slot_size || h.slot_count != opts.slot_count)
+        {
+            throw std::invalid_argument {"mmap_ring: the file holds a ring of a different size"};
+        }
+    }
+
+    [[nodiscard]]
+    bool published(uint64_t pos) const noexcept
+    {
+        return atomic(slot_at(pos).sequence).load(std::memory_order_acquire) == pos + 1;
+    }
+
+    [[nodiscard]]
+    bool claimable() const noexcept
+    {
+        const uint64_t pos = atomic(header().claim).load(std::memory_order_relaxed);
+        return atomic(slot_at(pos).sequence).load(std::memory_order_acquire) == pos;
+    }
+
+    void release(uint64_t pos) noexcept
+    {
+        atomic(slot_at(pos).sequence).store(pos + opts.slot_count, std::memory_order_release);
+        atomic(header().tail).store(pos + 1, std::memory_order_release);
+        notify(header().space_event, header().producers_waiting);
+    }
+
+public:
+    // Opens the ring in path, creating it if the file is empty. Throws std::invalid_argument if
+    // the options are invalid or the file holds a ring of a different geometry, and
+    // std::system_error if the file cannot be opened or mapped.
+    mmap_ring(std::string_view path, const options& opts_)
+        : opts {validated(opts_)},
+          stride {stride_of(opts.slot_size)},
+          file {path},
+          lock {file.fd},
+          mmap_data {file.fd, prepare_file(file, opts)}
+    {
+        init_or_check();
+        lock.reset();
+    }
+
+    explicit mmap_ring(std::string_view path) : mmap_ring {path, options {}} {}
+
+    [[nodiscard]]
+    size_t slot_size() const noexcept
+    {
+        return opts.slot_size;
+    }
+
+    [[nodiscard]]
+    size_t capacity() const noexcept
+    {
+        return opts.slot_count;
+    }
+
+    // Returns the number of claimed slots not yet consumed, including those still being written.
+    [[nodiscard]]
+    size_t size() const noexcept
+    {
+        const uint64_t tail = atomic(header().tail).load(std::memory_order_acquire);
+        const uint64_t claim = atomic(header().claim).load(std::memory_order_acquire);
+        return static_cast<size_t>(claim - std::min(tail, claim));
+    }
+
+    // Producer: claims the next free slot and returns its payload, to be filled and handed to
+    // commit(). Returns std::nullopt if the ring is full. An object has at most one reservation;
+    // concurrent producers each use their own mmap_ring object on the file.
+    [[nodiscard]]
+    std::optional<std::span<char>> try_reserve()
+    {
+        if (reservation.has_value())
+        {
+            throw std::logic_error {"mmap_ring: commit the previous reservation first"};
+        }
+
+        uint64_t& claim = header().claim;
+        uint64_t pos = atomic(claim).load(std::memory_order_relaxed);
+        for (;;)
+        {
+            const uint64_t sequence =
+                atomic(slot_at(pos).sequence).load(std::memory_order_acquire);
+            const auto diff = static_cast<int64_t>(sequence - pos);
+
+            if (diff < 0) { return std::nullopt; } // the consumer has not released it yet
+            if (diff > 0) { pos = atomic(claim).load(std::memory_order_relaxed); }
+            else if (!opts.multi_producer)
+            {
+                atomic(claim).store(pos + 1, std::memory_order_relaxed);
+                break;
+            }
+            else if (atomic(claim).compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+            {
+                break;
+            }
+        }
+
+        reservation = pos;
+        return std::span<char> {payload(slot_at(pos)), opts.slot_size};
+    }
+
+    // Producer: like try_reserve(), waiting up to timeout for a free slot.
+    [[nodiscard]]
+    std::optional<std::span<char>> reserve(std::chrono::milliseconds timeout)
+    {
+        for (;;)
+        {
+            if (auto slot = try_reserve()) { return slot; }
+            auto ready = [this] { return claimable(); };
+            if (!wait(header().space_event, header().producers_waiting, timeout, ready))
+            {
+                return std::nullopt;
+            }
+        }
+    }
+
+    // Producer: publishes the first size bytes of the reserved slot.
+    void commit(size_t size)
+    {
+        if (!reservation.has_value()) { throw std::logic_error {"mmap_ring: nothing reserved"}; }
+        if (size > opts.slot_size) { throw std::length_error {"mmap_ring: message too large"}; }
+
+        Slot& slot = slot_at(*reservation);
+        slot.size = size;
+        atomic(slot.sequence).store(*reservation + 1, std::memory_order_release);
+        reservation.reset();
+
+        notify(header().data_event, header().consumers_waiting);
+    }
+
+    // Producer: copies data into a slot. Returns false if the ring is full.
+    bool try_push(std::span<const char> data)
+    {
+        if (data.size() > opts.slot_size)
+        {
+            throw std::length_error {"mmap_ring: message too large"};
+        }
+
+        const auto slot = try_reserve();
+        if (!slot.has_value()) { return false; }
+
+        std::memcpy(slot->data(), data.data(), data.size());
+        commit(data.size());
+        return true;
+    }
+
+    // Producer: like try_push(), waiting up to timeout for a free slot.
+    bool push(std::span<const char> data, std::chrono::milliseconds timeout)
+    {
+        if (data.size() > opts.slot_size)
+        {
+            throw std::length_error {"mmap_ring: message too large"};
+        }
+
+        const auto slot = reserve(timeout);
+        if (!slot.has_value()) { return false; }
+
+        std::memcpy(slot->data(), data.data(), data.size());
+        commit(data.size());
+        return true;
+    }
+
+    // Consumer: returns the oldest published message in place, valid until pop(). Returns
+    // std::nullopt if there is none.
+    [[nodiscard]]
+    std::optional<std::span<const char>> try_front()
+    {
+        for (;;)
+        {
+            const uint64_t pos = atomic(header().tail).load(std::memory_order_relaxed);
+            if (!published(pos)) { return std::nullopt; }
+
+            Slot& slot = slot_at(pos);
+            if (slot.size != abandoned) { return std::span<const char> {payload(slot), slot.size}; }
+            release(pos);
+        }
+    }
+
+    // Consumer: like try_front(), waiting up to timeout for a message.
+    [[nodiscard]]
+    std::optional<std::span<const char>> front(std::chrono::milliseconds timeout)
+    {
+        for (;;)
+        {
+            if (auto message = try_front()) { return message; }
+            auto ready = [this]
+            { return published(atomic(header().tail).load(std::memory_order_relaxed)); };
+            if (!wait(header().data_event, header().consumers_waiting, timeout, ready))
+            {
+                return std::nullopt;
+            }
+        }
+    }
+
+    // Consumer: releases the message returned by front() to the producers.
+    void pop()
+    {
+        const uint64_t pos = atomic(header().tail).load(std::memory_order_relaxed);
+        if (!published(pos)) { throw std::logic_error {"mmap_ring: pop on an empty ring"}; }
+
+        release(pos);
+    }
+
+    // Marks slots claimed by producers that died before committing them as abandoned, so that
+    // the consumer skips them instead of waiting forever. Call it only while no producer runs,
+    // e.g. when restarting after a crash.
+    void recover() noexcept
+    {
+        const uint64_t claim = atomic(header().claim).load(std::memory_order_acquire);
+        uint64_t pos = atomic(header().tail).load(std::memory_order_acquire);
+        for (; pos < claim; ++pos)
+        {
+            Slot& slot = slot_at(pos);
+            if (atomic(slot.sequence).load(std::memory_order_acquire) == pos)
+            {
+                slot.size = abandoned;
+                atomic(slot.sequence).store(pos + 1, std::memory_order_release);
+            }
+        }
+        notify(header().data_event, header().consumers_waiting);
+    }
+
+    // Writes the ring to disk, so that its messages also survive a crash of the machine.
+    void flush()
+    {
+        if (::msync(mmap_data.mapped_ptr, mmap_data.map_size, MS_SYNC) == -1)
+        {
+            throw std::system_error {errno, std::system_category(), "mmap_ring: msync failed"};
+        }
+    }
+
+private:
+    options opts;
+    size_t stride; // bytes per slot, a multiple of the cache line size
+    File file;
+    std::optional<Lock> lock;
+    MmapData mmap_data;
+    std::optional<uint64_t> reservation; // position claimed by try_reserve()
+};
@@ -0,0 +1,838 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string_view>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MMAP_SIMD_X86 1
+#elif defined(__aarch64__) || defined(__ARM_NEON)
+#include <arm_neon.h>
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+#define MMAP_SIMD_NEON 1
+#endif
+
+// Vectorized scanning and copy kernels shared by mmap_reader and mmap_writer, selected at runtime.
+namespace mmap_simd
+{
+enum class isa : unsigned char
+{
+    scalar,
+    sse2,
+    avx2,
+    avx512,
+    neon
+};
+
+namespace detail
+{
+    using find_fn = const char* (*)(const char*, const char*, char) noexcept;
+    using find_any_fn = const char* (*)(const char*, const char*, const char*, size_t) noexcept;
+    using mask_fn = uint64_t (*)(const char*, const char*, size_t) noexcept;
+    using search_fn = const char* (*)(const char*, const char*, const char*, size_t) noexcept;
+    using copy_fn = void (*)(char*, const char*, size_t) noexcept;
+    using crc_fn = uint32_t (*)(uint32_t, const char*, size_t) noexcept;
+
+    // The find kernels take the byte as char, or as std::integral_constant<char, C> to be
+    // instantiated for a byte known at compile time.
+    template <typename Char>
+    inline const char* find_scalar(const char* first, const char* last, Char c) noexcept
+    {
+        for (; first != last; ++first)
+        {
+            if (*first == c) { return first; }
+        }
+        return last;
+    }
+
+    inline const char*
+    find_any_scalar(const char* first, const char* last, const char* set, size_t n) noexcept
+    {
+        for (; first != last; ++first)
+        {
+            if (std::find(set, set + n, *first) != set + n) { return first; }
+        }
+        return last;
+    }
+
+    inline uint64_t mask_any_scalar(const char* p, const char* set, size_t n) noexcept
+    {
+        uint64_t mask = 0;
+        for (size_t i = 0; i < 64; ++i)
+        {
+            if (std::find(set, set + n, p[i]) != set + n) { mask |= uint64_t {1} << i; }
+        }
+        return mask;
+    }
+
+    // Substring search for needles of n >= 2 bytes. Candidates must match the first and the last
+    // byte of the needle before the bytes in between are compared.
+    inline const char*
+    search_scalar(const char* first, const char* last, const char* needle, size_t n) noexcept
+    {
+        if (static_cast<size_t>(last - first) < n) { return last; }
+
+        for (const char* end = last - n + 1; first != end; ++first)
+        {
+            if (first[0] == needle[0] && first[n - 1] == needle[n - 1] &&
+                std::memcmp(first + 1, needle + 1, n - 2) == 0)
+            {
+                return first;
+            }
+        }
+        return last;
+    }
+
+#if defined(MMAP_SIMD_X86)
+    template <typename Char>
+    __attribute__((target("sse2"))) inline const char*
+    find_sse2(const char* first, const char* last, Char c) noexcept
+    {
+        const __m128i needle = _mm_set1_epi8(c);
+        for (; last - first >= 16; first += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+            const int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, needle));
+            if (mask != 0) { return first + __builtin_ctz(static_cast<unsigned>(mask)); }
+        }
+        return find_scalar(first, last, c);
+    }
+
+    template <typename Char>
+    __attribute__((target("avx2"))) inline const char*
+    find_avx2(const char* first, const char* last, Char c) noexcept
+    {
+        const __m256i needle = _mm256_set1_epi8(c);
+        for (; last - first >= 32; first += 32)
+        {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+            const int mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(chunk, needle));
+            if (mask != 0) { return first + __builtin_ctz(static_cast<unsigned>(mask)); }
+        }
+        return find_sse2(first, last, c);
+    }
+
+    template <typename Char>
+    __attribute__((target("avx512f,avx512bw"))) inline const char*
+    find_avx512(const char* first, const char* last, Char c) noexcept
+    {
+        const __m512i needle = _mm512_set1_epi8(c);
+        for (; last - first >= 64; first += 64)
+        {
+            const __m512i chunk = _mm512_loadu_si512(first);
+            const __mmask64 mask = _mm512_cmpeq_epi8_mask(chunk, needle);
+            if (mask != 0) { return first + __builtin_ctzll(mask); }
+        }
+        return find_avx2(first, last, c);
+    }
+
+    __attribute__((target("sse2"))) inline const char*
+    find_any_sse2(const char* first, const char* last, const char* set, size_t n) noexcept
+    {
+        for (; last - first >= 16; first += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+            __m128i eq = _mm_setzero_si128();
+            for (size_t i = 0; i < n; ++i)
+            {
+                eq = _mm_or_si128(eq, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(set[i])));
+            }
+            const int mask = _mm_movemask_epi8(eq);
+            if (mask != 0) { return first + __builtin_ctz(static_cast<unsigned>(mask)); }
+        }
+        return find_any_scalar(first, last, set, n);
+    }
+
+    __attribute__((target("avx2"))) inline const char*
+    find_any_avx2(const char* first, const char* last, const char* set, size_t n) noexcept
+    {
+        for (; last - first >= 32; first += 32)
+        {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+            __m256i eq = _mm256_setzero_si256();
+            for (size_t i = 0; i < n; ++i)
+            {
+                eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(set[i])));
+            }
+            const int mask = _mm256_movemask_epi8(eq);
+            if (mask != 0) { return first + __builtin_ctz(static_cast<unsigned>(mask)); }
+        }
+        return find_any_sse2(first, last, set, n);
+    }
+
+    __attribute__((target("avx512f,avx512bw"))) inline const char*
+    find_any_avx512(const char* first, const char* last, const char* set, size_t n) noexcept
+    {
+        for (; last - first >= 64; first += 64)
+        {
+            const __m512i chunk = _mm512_loadu_si512(first);
+            __mmask64 mask = 0;
+            for (size_t i = 0; i < n; ++i)
+            {
+                mask |= _mm512_cmpeq_epi8_mask(chunk, _mm512_set1_epi8(set[i]));
+            }
+            if (mask != 0) { return first + __builtin_ctzll(mask); }
+        }
+        return find_any_avx2(first, last, set, n);
+    }
+
+    __attribute__((target("sse2"))) inline uint64_t
+    mask_any_sse2(const char* p, const char* set, size_t n) noexcept
+    {
+        uint64_t mask = 0;
+        for (size_t offset = 0; offset < 64; offset += 16)
+        {
+            const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + offset));
+            __m128i eq = _mm_setzero_si128();
+            for (size_t i = 0; i < n; ++i)
+            {
+                eq = _mm_or_si128(eq, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(set[i])));
+            }
+            mask |= static_cast<uint64_t>(static_cast<unsigned>(_mm_movemask_epi8(eq))) << offset;
+        }
+        return mask;
+    }
+
+    __attribute__((target("avx2"))) inline uint64_t
+    mask_any_avx2(const char* p, const char* set, size_t n) noexcept
+    {
+        uint64_t mask = 0;
+        for (size_t offset = 0; offset < 64; offset += 32)
+        {
+            const __m256i chunk = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + offset));
+            __m256i eq = _mm256_setzero_si256();
+            for (size_t i = 0; i < n; ++i)
+            {
+                eq = _mm256_or_si256(eq, _mm256_cmpeq_epi8(chunk, _mm256_set1_epi8(set[i])));
+            }
+            const auto bits = static_cast<unsigned>(_mm256_movemask_epi8(eq));
+            mask |= static_cast<uint64_t>(bits) << offset;
+        }
+        return mask;
+    }
+
+    __attribute__((target("avx512f,avx512bw"))) inline uint64_t
+    mask_any_avx512(const char* p, const char* set, size_t n) noexcept
+    {
+        const __m512i chunk = _mm512_loadu_si512(p);
+        __mmask64 mask = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            mask |= _mm512_cmpeq_epi8_mask(chunk, _mm512_set1_epi8(set[i]));
+        }
+        return mask;
+    }
+
+    // The vector search kernels compare a block of candidate positions against the first byte of
+    // the needle and the block n - 1 bytes further against its last byte, and verify the positions
+    // where both match. A rare byte pair filters far better than the first byte alone.
+    __attribute__((target("sse2"))) inline const char*
+    search_sse2(const char* first, const char* last, const char* needle, size_t n) noexcept
+    {
+        const __m128i front = _mm_set1_epi8(needle[0]);
+        const __m128i back = _mm_set1_epi8(needle[n - 1]);
+        for (; static_cast<size_t>(last - first) >= n - 1 + 16; first += 16)
+        {
+            const __m128i head = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first));
+            const __m128i tail = _mm_loadu_si128(reinterpret_cast<const __m128i*>(first + n - 1));
+            auto mask = static_cast<unsigned>(_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(head, front), _mm_cmpeq_epi8(tail, back))));
+            for (; mask != 0; mask &= mask - 1)
+            {
+                const char* candidate = first + __builtin_ctz(mask);
+                if (std::memcmp(candidate + 1, needle + 1, n - 2) == 0) { return candidate; }
+            }
+        }
+        return search_scalar(first, last, needle, n);
+    }
+
+    __attribute__((target("avx2"))) inline const char*
+    search_avx2(const char* first, const char* last, const char* needle, size_t n) noexcept
+    {
+        const __m256i front = _mm256_set1_epi8(needle[0]);
+        const __m256i back = _mm256_set1_epi8(needle[n - 1]);
+        for (; static_cast<size_t>(last - first) >= n - 1 + 32; first += 32)
+        {
+            const __m256i head = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first));
+            const __m256i tail =
+                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(first + n - 1));
+            auto mask = static_cast<unsigned>(_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(head, front), _mm256_cmpeq_epi8(tail, back))));
+            for (; mask != 0; mask &= mask - 1)
+            {
+                const char* candidate = first + __builtin_ctz(mask);
+                if (std::memcmp(candidate + 1, needle + 1, n - 2) == 0) { return candidate; }
+            }
+        }
+        return search_sse2(first, last, needle, n);
+    }
+
+    __attribute__((target("avx512f,avx512bw"))) inline const char*
+    search_avx512(const char* first, const char* last, const char* needle, size_t n) noexcept
+    {
+        const __m512i front = _mm512_set1_epi8(needle[0]);
+        const __m512i back = _mm512_set1_epi8(needle[n - 1]);
+        for (; static_cast<size_t>(last - first) >= n - 1 + 64; first += 64)
+        {
+            __mmask64 mask = _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(first), front) &
+                             _mm512_cmpeq_epi8_mask(_mm512_loadu_si512(first + n - 1), back);
+            for (; mask != 0; mask &= mask - 1)
+            {
+                const char* candidate = first + __builtin_ctzll(mask);
+                if (std::memcmp(candidate + 1, needle + 1, n - 2) == 0) { return candidate; }
+            }
+        }
+        return search_avx2(first, last, needle, n);
+    }
+#endif
+
+    inline void copy_scalar(char* dst, const char* src, size_t n) noexcept
+    {
+        std::memcpy(dst, src, n);
+    }
+
+#if defined(MMAP_SIMD_X86)
+    // Streaming stores need an aligned destination, so the bytes before the first boundary are
+    // copied normally. Returns the number of bytes copied.
+    inline size_t copy_head(char* dst, const char* src, size_t n, size_t alignment) noexcept
+    {
+        const size_t misalignment = reinterpret_cast<uintptr_t>(dst) & (alignment - 1);
+        const size_t head = std::min(n, misalignment == 0 ? 0 : alignment - misalignment);
+        std::memcpy(dst, src, head);
+        return head;
+    }
+
+    __attribute__((target("sse2"))) inline void
+    copy_nt_sse2(char* dst, const char* src, size_t n) noexcept
+    {
+        const size_t head = copy_head(dst, src, n, 16);
+        dst += head;
+        src += head;
+        n -= head;
+
+        for (; n >= 16; dst += 16, src += 16, n -= 16)
+        {
+            _mm_stream_si128(reinterpret_cast<__m128i*>(dst),
+                             _mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+        }
+        _mm_sfence();
+        std::memcpy(dst, src, n);
+    }
+
+    __attribute__((target("avx2"))) inline void
+    copy_nt_avx2(char* dst, const char* src, size_t n) noexcept
+    {
+        const size_t head = copy_head(dst, src, n, 32);
+        dst += head;
+        src += head;
+        n -= head;
+
+        for (; n >= 32; dst += 32, src += 32, n -= 32)
+        {
+            _mm256_stream_si256(reinterpret_cast<__m256i*>(dst),
+                                _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+        }
+        _mm_sfence();
+        std::memcpy(dst, src, n);
+    }
+
+    __attribute__((target("avx512f"))) inline void
+    copy_nt_avx512(char* dst, const char* src, size_t n) noexcept
+    {
+        const size_t head = copy_head(dst, src, n, 64);
+        dst += head;
+        src += head;
+        n -= head;
+
+        for (; n >= 64; dst += 64, src += 64, n -= 64)
+        {
+            _mm512_stream_si512(reinterpret_cast<__m512i*>(dst), _mm512_loadu_si512(src));
+        }
+        _mm_sfence();
+        std::memcpy(dst, src, n);
+    }
+#endif
+
+#if defined(MMAP_SIMD_NEON)
+    template <typename Char>
+    inline const char* find_neon(const char* first, const char* last, Char c) noexcept
+    {
+        const uint8x16_t needle = vdupq_n_u8(static_cast<uint8_t>(c));
+        for (; last - first >= 16; first += 16)
+        {
+            const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(first));
+            const uint8x16_t eq = vceqq_u8(chunk, needle);
+            // Narrow each byte to a nibble so the whole compare result fits in 64 bits.
+            const uint64_t mask =
+                vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            if (mask != 0) { return first + (__builtin_ctzll(mask) >> 2); }
+        }
+        return find_scalar(first, last, c);
+    }
+
+    inline const char*
+    find_any_neon(const char* first, const char* last, const char* set, size_t n) noexcept
+    {
+        for (; last - first >= 16; first += 16)
+        {
+            const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(first));
+            uint8x16_t eq = vdupq_n_u8(0);
+            for (size_t i = 0; i < n; ++i)
+            {
+                eq = vorrq_u8(eq, vceqq_u8(chunk, vdupq_n_u8(static_cast<uint8_t>(set[i]))));
+            }
+            const uint64_t mask =
+                vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            if (mask != 0) { return first + (__builtin_ctzll(mask) >> 2); }
+        }
+        return find_any_scalar(first, last, set, n);
+    }
+
+    inline const char*
+    search_neon(const char* first, const char* last, const char* needle, size_t n) noexcept
+    {
+        const uint8x16_t front = vdupq_n_u8(static_cast<uint8_t>(needle[0]));
+        const uint8x16_t back = vdupq_n_u8(static_cast<uint8_t>(needle[n - 1]));
+        for (; static_cast<size_t>(last - first) >= n - 1 + 16; first += 16)
+        {
+            const uint8x16_t head = vld1q_u8(reinterpret_cast<const uint8_t*>(first));
+            const uint8x16_t tail = vld1q_u8(reinterpret_cast<const uint8_t*>(first + n - 1));
+            const uint8x16_t eq = vandq_u8(vceqq_u8(head, front), vceqq_u8(tail, back));
+            // One nibble per byte lane, as in find_neon.
+            uint64_t mask =
+                vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(eq), 4)), 0);
+            for (; mask != 0; mask &= ~(uint64_t {0xf} << (__builtin_ctzll(mask) & ~3)))
+            {
+                const char* candidate = first + (__builtin_ctzll(mask) >> 2);
+                if (std::memcmp(candidate + 1, needle + 1, n - 2) == 0) { return candidate; }
+            }
+        }
+        return search_scalar(first, last, needle, n);
+    }
+
+#if defined(__aarch64__)
+    inline uint64_t mask_any_neon(const char* p, const char* set, size_t n) noexcept
+    {
+        // Keep one distinct bit per byte lane, then add neighbouring lanes together until every
+        // group of eight lanes has become one byte of the mask.
+        static constexpr uint8_t lane_bits[16] {
+            1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128};
+        const uint8x16_t bits = vld1q_u8(lane_bits);
+
+        uint64_t mask = 0;
+        for (size_t offset = 0; offset < 64; offset += 16)
+        {
+            const uint8x16_t chunk = vld1q_u8(reinterpret_cast<const uint8_t*>(p + offset));
+            uint8x16_t eq = vdupq_n_u8(0);
+            for (size_t i = 0; i < n; ++i)
+            {
+                eq = vorrq_u8(eq, vceqq_u8(chunk, vdupq_n_u8(static_cast<uint8_t>(set[i]))));
+            }
+            uint8x16_t sum = vandq_u8(eq, bits);
+            sum = vpaddq_u8(sum, sum);
+            sum = vpaddq_u8(sum, sum);
+            sum = vpaddq_u8(sum, sum);
+            mask |= static_cast<uint64_t>(vgetq_lane_u16(vreinterpretq_u16_u8(sum), 0)) << offset;
+        }
+        return mask;
+    }
+#endif
+#endif
+
+    // CRC-32C (Castagnoli, reflected polynomial 0x82F63B78), one table lookup per byte.
+    inline constexpr auto crc32c_table = []
+    {
+        std::array<uint32_t, 256> table {};
+        for (uint32_t i = 0; i < 256; ++i)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; ++bit)
+            {
+                crc = (crc >> 1) ^ ((crc & 1) != 0 ? 0x82F63B78 : 0);
+            }
+            table[i] = crc;
+        }
+        return table;
+    }();
+
+    inline uint32_t crc32c_scalar(uint32_t crc, const char* p, size_t n) noexcept
+    {
+        for (size_t i = 0; i < n; ++i)
+        {
+            crc = (crc >> 8) ^ crc32c_table[(crc ^ static_cast<unsigned char>(p[i])) & 0xff];
+        }
+        return crc;
+    }
+
+#if defined(MMAP_SIMD_X86)
+    __attribute__((target("sse4.2"))) inline uint32_t
+    crc32c_sse42(uint32_t crc, const char* p, size_t n) noexcept
+    {
+        uint64_t crc64 = crc;
+        for (; n >= 8; p += 8, n -= 8)
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, p, sizeof(word));
+            crc64 = _mm_crc32_u64(crc64, word);
+        }
+        crc = static_cast<uint32_t>(crc64);
+        for (; n > 0; ++p, --n) { crc = _mm_crc32_u8(crc, static_cast<unsigned char>(*p)); }
+        return crc;
+    }
+#endif
+
+#if defined(MMAP_SIMD_NEON) && defined(__ARM_FEATURE_CRC32)
+    inline uint32_t crc32c_arm(uint32_t crc, const char* p, size_t n) noexcept
+    {
+        for (; n >= 8; p += 8, n -= 8)
+        {
+            uint64_t word = 0;
+            std::memcpy(&word, p, sizeof(word));
+            crc = __crc32cd(crc, word);
+        }
+        for (; n > 0; ++p, --n) { crc = __crc32cb(crc, static_cast<uint8_t>(*p)); }
+        return crc;
+    }
+#endif
+
+    inline bool supported(isa target) noexcept
+    {
+#if defined(MMAP_SIMD_X86)
+        __builtin_cpu_init();
+#endif
+        switch (target)
+        {
+        case isa::scalar:
+            return true;
+#if defined(MMAP_SIMD_X86)
+        case isa::sse2:
+            return __builtin_cpu_supports("sse2") != 0;
+        case isa::avx2:
+            return __builtin_cpu_supports("avx2") != 0;
+        case isa::avx512:
+            return __builtin_cpu_supports("avx512bw") != 0;
+#endif
+#if defined(MMAP_SIMD_NEON)
+        case isa::neon:
+            return true;
+#endif
+        default:
+            return false;
+        }
+    }
+
+    inline find_fn find_for(isa target) noexcept
+    {
+        switch (target)
+        {
+#if defined(MMAP_SIMD_X86)
+        case isa::sse2:
+            return find_sse2<char>;
+        case isa::avx2:
+            return find_avx2<char>;
+        case isa::avx512:
+            return find_avx512<char>;
+#endif
+#if defined(MMAP_SIMD_NEON)
+        case isa::neon:
+            return find_neon<char>;
+#endif
+        default:
+            return find_scalar<char>;
+        }
+    }
+
+    inline find_any_fn find_any_for(isa target) noexcept
+    {
+        switch (target)
+        {
+#if defined(MMAP_SIMD_X86)
+        case isa::sse2:
+            return find_any_sse2;
+        case isa::avx2:
+            return find_any_avx2;
+        case isa::avx512:
+            return find_any_avx512;
+#endif
+#if defined(MMAP_SIMD_NEON)
+        case isa::neon:
+            return find_any_neon;
+#endif
+        default:
+            return find_any_scalar;
+        }
+    }
+
+    inline mask_fn mask_any_for(isa target) noexcept
+    {
+        switch (target)
+        {
+#if defined(MMAP_SIMD_X86)
+        case isa::sse2:
+            return mask_any_sse2;
+        case isa::avx2:
+            return mask_any_avx2;
+        case isa::avx512:
+            return mask_any_avx512;
+#endif
+#if defined(MMAP_SIMD_NEON) && defined(__aarch64__)
+        case isa::neon:
+            return mask_any_neon;
+#endif
+        default:
+            return mask_any_scalar;
+        }
+    }
+
+    inline search_fn search_for(isa target) noexcept
+    {
+        switch (target)
+        {
+#if defined(MMAP_SIMD_X86)
+        case isa::sse2:
+            return search_sse2;
+        case isa::avx2:
+            return search_avx2;
+        case isa::avx512:
+            return search_avx512;
+#endif
+#if defined(MMAP_SIMD_NEON)
+        case isa::neon:
+            return search_neon;
+#endif
+        default:
+            return search_scalar;
+        }
+    }
+
+    // The CRC instructions are not tied to the vector extensions, so they are checked separately.
+    inline crc_fn crc32c_for(isa target) noexcept
+    {
+        switch (target)
+        {
+#if defined(MMAP_SIMD_X86)
+        case isa::sse2:
+        case isa::avx2:
+        case isa::avx512:
+            return __builtin_cpu_supports("sse4.2") != 0 ? crc32c_sse42 : crc32c_scalar;
+#endif
+#if defined(MMAP_SIMD_NEON) && defined(__ARM_FEATURE_CRC32)
+        case isa::neon:
+            return crc32c_arm;
+#endif
+        default:
+            return crc32c_scalar;
+        }
+    }
+
+    // NEON has no streaming store hint worth using from intrinsics, so it keeps memcpy.
+    inline copy_fn copy_for(isa target) noexcept
+    {
+        switch (target)
+        {
+#if defined(MMAP_SIMD_X86)
+        case isa::sse2:
+            return copy_nt_sse2;
+        case isa::avx2:
+            return copy_nt_avx2;
+        case isa::avx512:
+            return copy_nt_avx512;
+#endif
+        default:
+            return copy_scalar;
+        }
+    }
+
+    inline isa best() noexcept
+    {
+        for (isa target : {isa::avx512, isa::avx2, isa::sse2, isa::neon})
+        {
+            if (supported(target)) { return target; }
+        }
+        return isa::scalar;
+    }
+
+    struct dispatch
+    {
+        std::atomic<isa> active {best()};
+        std::atomic<find_fn> find {find_for(best())};
+        std::atomic<find_any_fn> find_any {find_any_for(best())};
+        std::atomic<mask_fn> mask_any {mask_any_for(best())};
+        std::atomic<search_fn> search {search_for(best())};
+        std::atomic<copy_fn> copy_nontemporal {copy_for(best())};
+        std::atomic<crc_fn> crc32c {crc32c_for(best())};
+    };
+
+    inline dispatch& state() noexcept
+    {
+        static dispatch instance;
+        return instance;
+    }
+} // namespace detail
+
+[[nodiscard]]
+inline bool supported(isa target) noexcept
+{
+    return detail::supported(target);
+}
+
+[[nodiscard]]
+inline isa active_isa() noexcept
+{
+    return detail::state().active.load(std::memory_order_relaxed);
+}
+
+// Overrides the automatically selected kernels, mainly for benchmarking and testing.
+inline void set_isa(isa target)
+{
+    if (!supported(target))
+    {
+        throw std::invalid_argument {"mmap_simd: instruction set not supported on this CPU"};
+    }
+
+    detail::state().active.store(target, std::memory_order_relaxed);
+    detail::state().find.store(detail::find_for(target), std::memory_order_relaxed);
+    detail::state().find_any.store(detail::find_any_for(target), std::memory_order_relaxed);
+    detail::state().mask_any.store(detail::mask_any_for(target), std::memory_order_relaxed);
+    detail::state().search.store(detail::search_for(target), std::memory_order_relaxed);
+    detail::state().copy_nontemporal.store(detail::copy_for(target), std::memory_order_relaxed);
+    detail::state().crc32c.store(detail::crc32c_for(target), std::memory_order_relaxed);
+}
+
+[[nodiscard]]
+inline const char* isa_name(isa target) noexcept
+{
+    switch (target)
+    {
+    case isa::scalar:
+        return "scalar";
+    case isa::sse2:
+        return "sse2";
+    case isa::avx2:
+        return "avx2";
+    case isa::avx512:
+        return "avx512";
+    case isa::neon:
+        return "neon";
+    default:
+        return "unknown";
+    }
+}
+
+// Returns a pointer to the first occurrence of c in [first, last), or last if there is none.
+[[nodiscard]]
+inline const char* find(const char* first, const char* last, char c) noexcept
+{
+    return detail::state().find.load(std::memory_order_relaxed)(first, last, c);
+}
+
+// Same as find(first, last, C), with the kernels instantiated for C so that it is an immediate
+// operand. The active kernel is picked by a switch on active_isa() instead of an indirect call.
+template <char C>
+[[nodiscard]]
+inline const char* find(const char* first, const char* last) noexcept
+{
+    constexpr std::integral_constant<char, C> c {};
+    switch (active_isa())
+    {
+#if defined(MMAP_SIMD_X86)
+    case isa::sse2:
+        return detail::find_sse2(first, last, c);
+    case isa::avx2:
+        return detail::find_avx2(first, last, c);
+    case isa::avx512:
+        return detail::find_avx512(first, last, c);
+#endif
+#if defined(MMAP_SIMD_NEON)
+    case isa::neon:
+        return detail::find_neon(first, last, c);
+#endif
+    default:
+        return detail::find_scalar(first, last, c);
+    }
+}
+
+// Returns a pointer to the first byte in [first, last) that is in set, or last if there is none.
+// Every byte of set costs one compare per block, so it is meant for a handful of delimiters.
+[[nodiscard]]
+inline const char* find_any(const char* first, const char* last, std::string_view set) noexcept
+{
+    return detail::state().find_any.load(std::memory_order_relaxed)(first,
+                                                                     last,
+                                                                     set.data(),
+                                                                     set.size());
+}
+
+// Returns a mask with bit i set if p[i] is in set, for the 64 bytes starting at p. Walking the set
+// bits of one call is much cheaper than a find_any call per match when matches are dense.
+[[nodiscard]]
+inline uint64_t mask_any(const char* p, std::string_view set) noexcept
+{
+    return detail::state().mask_any.load(std::memory_order_relaxed)(p, set.data(), set.size());
+}
+
+// Returns a pointer to the first occurrence of needle in [first, last), or last if there is none.
+[[nodiscard]]
+inline const char* search(const char* first, const char* last, std::string_view needle) noexcept
+{
+    if (needle.empty()) { return first; }
+    if (needle.size() == 1) { return find(first, last, needle.front()); }
+    return detail::state().search.load(std::memory_order_relaxed)(
+        first, last, needle.data(), needle.size());
+}
+
+// Returns true if the eight bytes at p are all ASCII digits.
+[[nodiscard]]
+inline bool is_eight_digits(const char* p) noexcept
+{
+    uint64_t v = 0;
+    std::memcpy(&v, p, sizeof(v));
+    // Digits are 0x30..0x39: the high nibble is 3, and adding 6 must not carry into it.
+    return ((v & 0xF0F0F0F0F0F0F0F0) | (((v + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) ==
+           0x3333333333333333;
+}
+
+// Returns the value of eight ASCII digits at p, combining neighbouring digits pairwise in a
+// 64-bit register instead of one multiply-add per digit.
+[[nodiscard]]
+inline uint32_t parse_eight_digits(const char* p) noexcept
+{
+    if constexpr (std::endian::native != std::endian::little)
+    {
+        uint32_t value = 0;
+        for (size_t i = 0; i < 8; ++i) { value = value * 10 + static_cast<uint32_t>(p[i] - '0'); }
+        return value;
+    }
+
+    uint64_t v = 0;
+    std::memcpy(&v, p, sizeof(v));
+    v = (v & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+    v = (v & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+    return static_cast<uint32_t>((v & 0x0000FFFF0000FFFF) * 42949672960001 >> 32);
+}
+
+// Copies n bytes like memcpy but with streaming stores that bypass the cache, followed by a
+// store fence. Meant for large copies whose destination will not be read again soon.
+inline void copy_nontemporal(char* dst, const char* src, size_t n) noexcept
+{
+    detail::state().copy_nontemporal.load(std::memory_order_relaxed)(dst, src, n);
+}
+
+// Returns the CRC-32C of [p, p + n), continuing from the CRC of preceding data if given. Uses the
+// SSE4.2 or ARMv8 CRC instructions when available.
+[[nodiscard]]
+inline uint32_t crc32c(const char* p, size_t n, uint32_t previous = 0) noexcept
+{
+    return ~detail::state().crc32c.load(std::memory_order_relaxed)(~previous, p, n);
+}
+} // namespace mmap_simd
@@ -0,0 +1,269 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <sys/resource.h> // getrusage
+
+// Optional instrumentation of mmap_reader and mmap_writer. With counters enabled, both classes
+// count their system calls, the time spent in them, the bytes and lines they hand out and the page
+// faults taken while scanning. Disabled counters are empty classes, every hook is an inline no-op
+// and stats() returns zeros. They are enabled by the stats member of the traits of
+// basic_mmap_reader and basic_mmap_writer, which defaults to building with MMAP_STATS defined to a
+// nonzero value.
+namespace mmap_stats
+{
+#if defined(MMAP_STATS) && MMAP_STATS
+inline constexpr bool enabled {true};
+#else
+inline constexpr bool enabled {false};
+#endif
+
+// Number of calls and their cumulative latency.
+struct call_stats
+{
+    uint64_t calls {0};
+    uint64_t nanoseconds {0};
+};
+
+struct reader_stats
+{
+    call_stats mmap;
+    call_stats munmap;
+    call_stats mremap;
+    call_stats madvise; // madvise and mlock
+    uint64_t bytes_read {0};   // copied out by read(), pread() and str()
+    uint64_t lines {0};        // returned by getline() and lines()
+    uint64_t minor_faults {0}; // taken by lines(), chars() and parallel_lines()
+    uint64_t major_faults {0};
+};
+
+struct writer_stats
+{
+    call_stats mmap;
+    call_stats munmap;
+    call_stats mremap;
+    call_stats madvise;
+    call_stats ftruncate;
+    call_stats fallocate;
+    call_stats msync; // msync and sync_file_range of flush() and flush_range()
+    uint64_t expansions {0};
+    uint64_t bytes_written {0};
+};
+
+enum class call : unsigned char
+{
+    mmap,
+    munmap,
+    mremap,
+    madvise,
+    ftruncate,
+    fallocate,
+    msync
+};
+
+namespace detail
+{
+    inline constexpr size_t call_count {7};
+
+    struct faults
+    {
+        uint64_t minor {0};
+        uint64_t major {0};
+    };
+
+    inline faults thread_faults() noexcept
+    {
+        rusage usage {};
+        ::getrusage(RUSAGE_THREAD, &usage);
+        return {static_cast<uint64_t>(usage.ru_minflt), static_cast<uint64_t>(usage.ru_majflt)};
+    }
+} // namespace detail
+
+template <bool Enabled>
+class counters;
+
+template <bool Enabled>
+class fault_scope;
+
+// The counters are updated with relaxed atomics, since mmap_writer::append() and the parallel
+// scans of mmap_reader update them from several threads.
+template <>
+class counters<true>
+{
+private:
+    using counter = std::atomic<uint64_t>;
+
+    std::array<counter, detail::call_count> calls {};
+    std::array<counter, detail::call_count> nanoseconds {};
+    counter bytes {0};
+    counter lines {0};
+    counter expansions {0};
+    counter minor_faults {0};
+    counter major_faults {0};
+
+    static uint64_t load(const counter& value) noexcept
+    {
+        return value.load(std::memory_order_relaxed);
+    }
+
+    static void add(counter& value, uint64_t n) noexcept
+    {
+        value.fetch_add(n, std::memory_order_relaxed);
+    }
+
+    [[nodiscard]]
+    call_stats get(call c) const noexcept
+    {
+        const auto index = static_cast<size_t>(c);
+        return {load(calls[index]), load(nanoseconds[index])};
+    }
+
+public:
+    counters() = default;
+
+    // Lets the owning reader or writer move.
+    counters(const counters& that) noexcept { *this = that; }
+
+    counters& operator=(const counters& that) noexcept
+    {
+        for (size_t i = 0; i < detail::call_count; ++i)
+        {
+            calls[i].store(load(that.calls[i]), std::memory_order_relaxed);
+            nanoseconds[i].store(load(that.nanoseconds[i]), std::memory_order_relaxed);
+        }
+        bytes.store(load(that.bytes), std::memory_order_relaxed);
+        lines.store(load(that.lines), std::memory_order_relaxed);
+        expansions.store(load(that.expansions), std::memory_order_relaxed);
+        minor_faults.store(load(that.minor_faults), std::memory_order_relaxed);
+        major_faults.store(load(that.major_faults), std::memory_order_relaxed);
+        return *this;
+    }
+
+    // Returns f(args...) for the system call f and records its latency, keeping the errno f set.
+    template <typename F, typename... Args>
+    auto timed(call c, F f, Args... args)
+    {
+        const auto start = std::chrono::steady_clock::now();
+        auto result = f(args...);
+        const int saved_errno = errno;
+
+        const auto elapsed = std::chrono::steady_clock::now() - start;
+        const auto index = static_cast<size_t>(c);
+        add(calls[index], 1);
+        add(nanoseconds[index],
+            static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+
+        errno = saved_errno;
+        return result;
+    }
+
+    void add_bytes(size_t n) noexcept { add(bytes, n); }
+    void add_line() noexcept { add(lines, 1); }
+    void add_expansion() noexcept { add(expansions, 1); }
+
+    void add_faults(detail::faults since) noexcept
+    {
+        const detail::faults now = detail::thread_faults();
+        add(minor_faults, now.minor - since.minor);
+        add(major_faults, now.major - since.major);
+    }
+
+    void reset() noexcept
+    {
+        for (counter& value : calls) { value.store(0, std::memory_order_relaxed); }
+        for (counter& value : nanoseconds) { value.store(0, std::memory_order_relaxed); }
+        for (counter* value : {&bytes, &lines, &expansions, &minor_faults, &major_faults})
+        {
+            value->store(0, std::memory_order_relaxed);
+        }
+    }
+
+    [[nodiscard]]
+    reader_stats reader() const noexcept
+    {
+        return {.mmap = get(call::mmap),
+                .munmap = get(call::munmap),
+                .mremap = get(call::mremap),
+                .madvise = get(call::madvise),
+                .bytes_read = load(bytes),
+                .lines = load(lines),
+                .minor_faults = load(minor_faults),
+                .major_faults = load(major_faults)};
+    }
+
+    [[nodiscard]]
+    writer_stats writer() const noexcept
+    {
+        return {.mmap = get(call::mmap),
+                .munmap = get(call::munmap),
+                .mremap = get(call::mremap),
+                .madvise = get(call::madvise),
+                .ftruncate = get(call::ftruncate),
+                .fallocate = get(call::fallocate),
+                .msync = get(call::msync),
+                .expansions = load(expansions),
+                .bytes_written = load(bytes)};
+    }
+};
+
+// Adds the page faults that the current thread takes during its lifetime to the counters. A copy
+// would count the same faults twice, so it can only be moved; the moved-from scope adds nothing.
+template <>
+class fault_scope<true>
+{
+private:
+    counters<true>* stats;
+    detail::faults start;
+
+public:
+    explicit fault_scope(counters<true>& stats_) noexcept
+        : stats {&stats_}, start {detail::thread_faults()}
+    {}
+
+    fault_scope(fault_scope&& that) noexcept
+        : stats {std::exchange(that.stats, nullptr)}, start {that.start}
+    {}
+
+    fault_scope(const fault_scope&) = delete;
+    fault_scope& operator=(const fault_scope&) = delete;
+    fault_scope& operator=(fault_scope&&) = delete;
+
+    ~fault_scope()
+    {
+        if (stats != nullptr) { stats->add_faults(start); }
+    }
+};
+
+template <>
+class counters<false>
+{
+public:
+    template <typename F, typename... Args>
+    auto timed(call /*unused*/, F f, Args... args)
+    {
+        return f(args...);
+    }
+
+    void add_bytes(size_t /*unused*/) noexcept {}
+    void add_line() noexcept {}
+    void add_expansion() noexcept {}
+    void reset() noexcept {}
+
+    [[nodiscard]] reader_stats reader() const noexcept { return {}; }
+    [[nodiscard]] writer_stats writer() const noexcept { return {}; }
+};
+
+// Keeps the ranges that hold a scope copyable when the counters are disabled.
+template <>
+class fault_scope<false>
+{
+public:
+    explicit fault_scope(counters<false>& /*unused*/) noexcept {}
+};
+} // namespace mmap_stats
@@ -1,18 +1,132 @@
 #pragma once
 
+#include "mmap_frame.hpp"
+#include "mmap_simd.hpp"
+#include "mmap_stats.hpp"
+
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <cstdio>
 #include <fcntl.h>
+#include <iterator>
 #include <format>
+#include <memory>
+#include <mutex>
 #include <span>
+#include <stdexcept>
 #include <string_view>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
 #include <unistd.h>
+#include <vector>
+
+// Compile-time configuration of basic_mmap_writer. Derive from it and redeclare the members to
+// change them.
+struct mmap_writer_traits
+{
+    static constexpr bool checked {true}; // throw on bad commits and record views
+    static constexpr bool stats {mmap_stats::enabled}; // count calls, see mmap_stats.hpp
+};
 
-class mmap_writer
+template <typename Traits = mmap_writer_traits>
+class basic_mmap_writer
 {
+public:
+    enum class access_pattern : unsigned char
+    {
+        normal,
+        sequential,
+        random,
+        willneed,
+        dontneed,
+        hugepage
+    };
+
+    // Decides the new file size when a write does not fit into the current capacity.
+    struct growth_policy
+    {
+        enum class kind : unsigned char
+        {
+            fixed,             // grow in multiples of step
+            geometric,         // multiply the capacity by factor
+            capped_geometric,  // multiply the capacity by factor, growing by at most step bytes
+            huge_page_aligned, // multiply the capacity by factor, rounded up to 2 MiB
+        };
+
+        kind type {kind::fixed};
+        size_t step {8192};
+        double factor {2.0};
+
+        static growth_policy fixed(size_t step = 8192) { return {kind::fixed, step, 1.0}; }
+
+        static growth_policy geometric(double factor = 2.0)
+        {
+            return {kind::geometric, 0, factor};
+        }
+
+        static growth_policy capped_geometric(double factor, size_t max_step)
+        {
+            return {kind::capped_geometric, max_step, factor};
+        }
+
+        static growth_policy huge_page_aligned(double factor = 2.0)
+        {
+            return {kind::huge_page_aligned, 2 * 1024 * 1024, factor};
+        }
+
+        // Checked once when the policy is set, so that expansions skip it.
+        void validate() const
+        {
+            if ((type == kind::fixed || type == kind::capped_geometric) && step == 0)
+            {
+                throw std::invalid_argument {"mmap_writer: growth step must be greater than 0"};
+            }
+            if (type != kind::fixed && !(factor > 1.0))
+            {
+                throw std::invalid_argument {"mmap_writer: growth factor must be greater than 1"};
+            }
+        }
+
+        [[nodiscard]]
+        size_t next_capacity(size_t capacity, size_t required) const noexcept
+        {
+            const auto scaled = static_cast<size_t>(static_cast<double>(capacity) * factor);
+
+            switch (type)
+            {
+            case kind::fixed:
+                return capacity + (required - capacity + step - 1) / step * step;
+            case kind::geometric:
+                return std::max(required, scaled);
+            case kind::capped_geometric:
+                return std::max(required, std::min(scaled, capacity + step));
+            case kind::huge_page_aligned:
+                return (std::max(required, scaled) + step - 1) / step * step;
+            default:
+                return required;
+            }
+        }
+    };
+
+    struct options
+    {
+        access_pattern advice {access_pattern::normal};
+        growth_policy growth {};
+        bool preallocate {false}; // allocate blocks with fallocate instead of growing a sparse file
+        size_t max_capacity {0};  // reserve address space for in-place growth, required by append()
+        std::chrono::milliseconds flush_interval {0}; // background writeback period, 0 disables it
+        size_t flush_bytes {0}; // also start background writeback after this many written bytes
+        size_t window_size {0}; // map a sliding window of this size, 0 maps the whole file
+        size_t nontemporal_threshold {0}; // bypass the cache for writes this large, 0 disables it
+    };
+
 private:
     struct File
     {
@@ -34,29 +148,54 @@ private:
         }
 
     public:
-        mmap_writer* writer;
+        basic_mmap_writer* writer;
         int fd;
         bool should_close;
 
-        File(mmap_writer* writer_, std::string_view filename, bool truncate)
+        File(basic_mmap_writer* writer_, std::string_view filename, bool truncate)
             : writer {writer_}, fd {open(filename, truncate)}, should_close {true}
         {}
 
-        File(mmap_writer* writer_, int fd_) : writer {writer_}, fd {fd_}, should_close {false}
+        File(basic_mmap_writer* writer_, int fd_) : writer {writer_}, fd {fd_}, should_close {false}
         {
             if (fd < 0) { throw std::invalid_argument {"mmap_writer: invalid file descriptor"}; }
         }
 
+        File(basic_mmap_writer* writer_, File&& that) noexcept
+            : writer {writer_},
+              fd {std::exchange(that.fd, -1)},
+              should_close {std::exchange(that.should_close, false)}
+        {}
+
         File(const File&) = delete;
         File& operator=(const File&) = delete;
         File(File&& that) noexcept = delete;
-        File& operator=(File&& that) noexcept = delete;
 
-        ~File()
+        // Closes this file like the destructor, keeping writer.
+        File& operator=(File&& that) noexcept
+        {
+            if (this != &that)
+            {
+                close();
+                fd = std::exchange(that.fd, -1);
+                should_close = std::exchange(that.should_close, false);
+            }
+            return *this;
+        }
+
+        ~File() { close(); }
+
+        // Truncates the file to the written size and closes it if owned.
+        void close() noexcept
         {
-            if (writer->max_write_pos < writer->file_size)
+            if (fd < 0) { return; } // moved from
+
+            if (writer->end_pos() < writer->file_size)
             {
-                if (ftruncate(fd, static_cast<off_t>(writer->max_write_pos)) == -1)
+                if (writer->counters.timed(mmap_stats::call::ftruncate,
+                                           ::ftruncate,
+                                           fd,
+                                           static_cast<off_t>(writer->end_pos())) == -1)
                 {
                     perror("mmap_writer: ftruncate failed");
                 }
@@ -82,41 +221,156 @@ private:
 
         void resize(size_t new_size)
         {
-            if (ftruncate(fd, static_cast<off_t>(new_size)) == -1)
+            if (writer->counters.timed(mmap_stats::call::ftruncate,
+                                       ::ftruncate,
+                                       fd,
+                                       static_cast<off_t>(new_size)) == -1)
             {
                 throw std::system_error {errno,
                                          std::system_category(),
                                          "mmap_writer: ftruncate failed"};
             }
         }
+
+        // Allocates blocks for [offset, offset + len), extending the file if needed.
+        // Returns false if the file system does not support fallocate.
+        bool allocate(size_t offset, size_t len)
+        {
+            int result = 0;
+            do
+            {
+                result = writer->counters.timed(mmap_stats::call::fallocate,
+                                                ::fallocate,
+                                                fd,
+                                                0,
+                                                static_cast<off_t>(offset),
+                                                static_cast<off_t>(len));
+            } while (result == -1 && errno == EINTR);
+
+            if (result == 0) { return true; }
+            if (errno == EOPNOTSUPP || errno == ENOSYS) { return false; }
+
+            throw std::system_error {errno,
+                                     std::system_category(),
+                                     "mmap_writer: fallocate failed"};
+        }
     };
 
     struct MmapData
     {
+    private:
+        static size_t page_size() noexcept
+        {
+            static const auto size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+            return size;
+        }
+
+        static int to_madvise(access_pattern pattern) noexcept
+        {
+            switch (pattern)
+            {
+            case access_pattern::sequential:
+                return MADV_SEQUENTIAL;
+            case access_pattern::random:
+                return MADV_RANDOM;
+            case access_pattern::willneed:
+                return MADV_WILLNEED;
+            case access_pattern::dontneed:
+                return MADV_DONTNEED;
+            case access_pattern::hugepage:
+                return MADV_HUGEPAGE;
+            default:
+                return MADV_NORMAL;
+            }
+        }
+
+        // Sequential, random and hugepage advice belong to the mapping and must survive a remap.
+        void reapply_advice()
+        {
+            const access_pattern advice = writer->opts.advice;
+            if (advice == access_pattern::sequential || advice == access_pattern::random ||
+                advice == access_pattern::hugepage)
+            {
+                advise(advice, map_offset, map_size);
+            }
+        }
+
+        void unmap() noexcept
+        {
+            const size_t len = reserved() ? writer->opts.max_capacity : map_size;
+            if (mapped_ptr != nullptr &&
+                writer->counters.timed(mmap_stats::call::munmap, ::munmap, mapped_ptr, len) == -1)
+            {
+                perror("mmap_writer: munmap failed");
+            }
+
+            mapped_ptr = nullptr;
+            map_size = 0;
+        }
+
     public:
-        mmap_writer* writer;
+        basic_mmap_writer* writer;
 
         char* mapped_ptr {};
+        size_t map_offset {0}; // file offset of mapped_ptr
+        size_t map_size {0};   // length of the mapping
 
-        explicit MmapData(mmap_writer* writer_) : writer {writer_} {}
+        explicit MmapData(basic_mmap_writer* writer_) : writer {writer_} {}
+
+        MmapData(basic_mmap_writer* writer_, MmapData&& that) noexcept
+            : writer {writer_},
+              mapped_ptr {std::exchange(that.mapped_ptr, nullptr)},
+              map_offset {std::exchange(that.map_offset, 0)},
+              map_size {std::exchange(that.map_size, 0)}
+        {}
 
         MmapData(const MmapData&) = delete;
         MmapData& operator=(const MmapData&) = delete;
         MmapData(MmapData&& that) noexcept = delete;
-        MmapData& operator=(MmapData&& that) noexcept = delete;
 
-        ~MmapData()
+        // Unmaps this mapping, keeping writer.
+        MmapData& operator=(MmapData&& that) noexcept
         {
-            if (mapped_ptr != nullptr && ::munmap(mapped_ptr, writer->file_size) == -1)
+            if (this != &that)
             {
-                perror("mmap_writer: munmap failed");
+                unmap();
+                mapped_ptr = std::exchange(that.mapped_ptr, nullptr);
+                map_offset = std::exchange(that.map_offset, 0);
+                map_size = std::exchange(that.map_size, 0);
             }
+            return *this;
         }
 
-        void memory_map()
+        ~MmapData() { unmap(); }
+
+        [[nodiscard]]
+        bool windowed() const noexcept
         {
-            void* addr =
-                ::mmap(nullptr, writer->file_size, PROT_WRITE, MAP_SHARED, writer->file.fd, 0);
+            return writer->opts.window_size != 0;
+        }
+
+        [[nodiscard]]
+        bool reserved() const noexcept
+        {
+            return writer->opts.max_capacity != 0;
+        }
+
+        [[nodiscard]]
+        static size_t align_to_page(size_t size) noexcept
+        {
+            return (size + page_size() - 1) & ~(page_size() - 1);
+        }
+
+        void memory_map(size_t offset, size_t len)
+        {
+            void* addr = writer->counters.timed(mmap_stats::call::mmap,
+                                                ::mmap,
+                                                nullptr,
+                                                len,
+                                                PROT_READ | PROT_WRITE,
+                                                MAP_SHARED,
+                                                writer->file.fd,
+                                                static_cast<off_t>(offset));
             if (addr == MAP_FAILED)
             {
                 throw std::system_error {
@@ -126,11 +380,86 @@ private:
             }
 
             mapped_ptr = static_cast<char*>(addr);
+            map_offset = offset;
+            map_size = len;
+
+            if (writer->opts.advice != access_pattern::normal)
+            {
+                advise(writer->opts.advice, map_offset, map_size);
+            }
+        }
+
+        // Reserves max_capacity bytes of address space and maps the file at its start, so the
+        // mapping can grow in place and never moves while other threads write through it.
+        void map_reserved(size_t len)
+        {
+            void* area = writer->counters.timed(mmap_stats::call::mmap,
+                                                ::mmap,
+                                                nullptr,
+                                                writer->opts.max_capacity,
+                                                PROT_NONE,
+                                                MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                                                -1,
+                                                0);
+            if (area == MAP_FAILED)
+            {
+                throw std::system_error {errno,
+                                         std::system_category(),
+                                         "mmap_writer: cannot reserve address space"};
+            }
+
+            mapped_ptr = static_cast<char*>(area);
+            map_offset = 0;
+            map_size = 0;
+            map_in_place(len);
+        }
+
+        // Maps the pages between the current end of the reserved mapping and new_size.
+        void map_in_place(size_t new_size)
+        {
+            const size_t begin = align_to_page(map_size);
+            const size_t end = align_to_page(new_size);
+            if (begin < end &&
+                writer->counters.timed(mmap_stats::call::mmap,
+                                       ::mmap,
+                                       mapped_ptr + begin,
+                                       end - begin,
+                                       PROT_READ | PROT_WRITE,
+                                       MAP_SHARED | MAP_FIXED,
+                                       writer->file.fd,
+                                       static_cast<off_t>(begin)) == MAP_FAILED)
+            {
+                throw std::system_error {
+                    errno,
+                    std::system_category(),
+                    std::format("mmap_writer: mmap failed with fd = {}", writer->file.fd)};
+            }
+
+            map_size = new_size;
+            reapply_advice();
+        }
+
+        // Maps a window starting at the page containing pos that covers at least len bytes.
+        void slide(size_t pos, size_t len)
+        {
+            const size_t begin = pos & ~(page_size() - 1);
+
+            writer->retire_spans();
+            unmap();
+            memory_map(begin, std::max(writer->opts.window_size, pos + len - begin));
         }
 
         void remap(size_t new_size)
         {
-            void* new_ptr = mremap(mapped_ptr, writer->file_size, new_size, MREMAP_MAYMOVE);
+            if (reserved())
+            {
+                map_in_place(new_size);
+                return;
+            }
+
+            writer->retire_spans();
+            void* new_ptr = writer->counters.timed(
+                mmap_stats::call::mremap, ::mremap, mapped_ptr, map_size, new_size, MREMAP_MAYMOVE);
             if (new_ptr == MAP_FAILED)
             {
                 throw std::system_error {errno,
@@ -139,21 +468,166 @@ private:
             }
 
             mapped_ptr = static_cast<char*>(new_ptr);
+            map_size = new_size;
+            reapply_advice();
         }
 
-        void sync(bool async)
+        // Returns the address of file offset pos, with [pos, pos + len) mapped.
+        // The file must already be at least pos + len bytes long.
+        char* at(size_t pos, size_t len)
         {
-            if (msync(mapped_ptr, writer->max_write_pos, async ? MS_ASYNC : MS_SYNC) == -1)
+            if (pos < map_offset || pos + len > map_offset + map_size) { slide(pos, len); }
+
+            return mapped_ptr + (pos - map_offset);
+        }
+
+        void advise(access_pattern pattern, size_t offset, size_t len) const
+        {
+            // Only the mapped part of [offset, offset + len) within the file can be advised.
+            const size_t map_end = std::min(map_offset + map_size, writer->file_size);
+            if (offset >= map_end) { return; }
+
+            const size_t begin = std::max(offset, map_offset);
+            const size_t end = (len >= map_end - offset) ? map_end : offset + len;
+            if (begin >= end) { return; }
+
+            // madvise requires a page-aligned start address.
+            const size_t aligned_begin = (begin - map_offset) & ~(page_size() - 1);
+
+            if (writer->counters.timed(mmap_stats::call::madvise,
+                                       ::madvise,
+                                       mapped_ptr + aligned_begin,
+                                       end - map_offset - aligned_begin,
+                                       to_madvise(pattern)) == -1)
             {
                 throw std::system_error {errno,
                                          std::system_category(),
-                                         "mmap_writer: msync failed"};
+                                         "mmap_writer: madvise failed"};
             }
         }
+
+        // Synchronizes the mapped part of [offset, offset + len). Returns whether part of the range
+        // lies outside the window and has to be synchronized through the file with sync_file().
+        bool sync_mapped(size_t offset, size_t len, bool async)
+        {
+            const size_t map_end = map_offset + map_size;
+            const size_t begin = std::max(offset, map_offset);
+            const size_t end = std::min(offset + len, map_end);
+
+            if (begin < end)
+            {
+                // msync requires a page-aligned start address.
+                const size_t aligned_begin = (begin - map_offset) & ~(page_size() - 1);
+                if (writer->counters.timed(mmap_stats::call::msync,
+                                           ::msync,
+                                           mapped_ptr + aligned_begin,
+                                           end - map_offset - aligned_begin,
+                                           async ? MS_ASYNC : MS_SYNC) == -1)
+                {
+                    throw std::system_error {errno,
+                                             std::system_category(),
+                                             "mmap_writer: msync failed"};
+                }
+            }
+
+            return windowed() && (offset < map_offset || offset + len > map_end);
+        }
+
+        // Pages of earlier windows are already unmapped and only live in the page cache.
+        // sync_file_range neither flushes the disk cache nor the metadata needed to read the data
+        // back, so a synchronous flush uses fdatasync to stay as durable as msync(MS_SYNC).
+        void sync_file(size_t offset, size_t len, bool async)
+        {
+            if (async)
+            {
+                if (writer->counters.timed(mmap_stats::call::msync,
+                                           ::sync_file_range,
+                                           writer->file.fd,
+                                           static_cast<off_t>(offset),
+                                           static_cast<off_t>(len),
+                                           SYNC_FILE_RANGE_WRITE) == -1)
+                {
+                    throw std::system_error {errno,
+                                             std::system_category(),
+                                             "mmap_writer: sync_file_range failed"};
+                }
+            }
+            else if (writer->counters.timed(mmap_stats::call::msync,
+                                            ::fdatasync,
+                                            writer->file.fd) == -1)
+            {
+                throw std::system_error {errno,
+                                         std::system_category(),
+                                         "mmap_writer: fdatasync failed"};
+            }
+        }
+
+        void sync(size_t offset, size_t len, bool async)
+        {
+            if (sync_mapped(offset, len, async)) { sync_file(offset, len, async); }
+        }
     };
 
-    size_t file_size;
-    size_t write_pos;
+    // Background thread that periodically starts writeback of dirty pages.
+    struct Flusher
+    {
+    private:
+        int fd;
+        std::chrono::milliseconds interval;
+
+        std::mutex mutex;
+        std::condition_variable_any wakeup;
+        bool kicked {false};
+
+        std::jthread thread;
+
+        void run(const std::stop_token& stop)
+        {
+            std::unique_lock lock {mutex};
+            while (!stop.stop_requested())
+            {
+                if (interval.count() > 0)
+                {
+                    wakeup.wait_for(lock, stop, interval, [this] { return kicked; });
+                }
+                else { wakeup.wait(lock, stop, [this] { return kicked; }); }
+
+                if (stop.stop_requested()) { break; }
+                kicked = false;
+
+                lock.unlock();
+                // Only starts writeback; the kernel skips pages that are already clean.
+                if (::sync_file_range(fd, 0, 0, SYNC_FILE_RANGE_WRITE) == -1)
+                {
+                    perror("mmap_writer: sync_file_range failed");
+                }
+                lock.lock();
+            }
+        }
+
+    public:
+        Flusher(int fd_, std::chrono::milliseconds interval_)
+            : fd {fd_}, interval {interval_}, thread {[this](std::stop_token stop) { run(stop); }}
+        {}
+
+        Flusher(const Flusher&) = delete;
+        Flusher& operator=(const Flusher&) = delete;
+        Flusher(Flusher&& that) noexcept = delete;
+        Flusher& operator=(Flusher&& that) noexcept = delete;
+
+        void kick()
+        {
+            {
+                const std::scoped_lock lock {mutex};
+                kicked = true;
+            }
+            wakeup.notify_one();
+        }
+    };
+
+    // file_size and write_pos are accessed through std::atomic_ref by append().
+    alignas(std::atomic_ref<size_t>::required_alignment) size_t file_size;
+    alignas(std::atomic_ref<size_t>::required_alignment) size_t write_pos;
     size_t max_write_pos;
 
     enum class seekdir : unsigned char
@@ -163,24 +637,175 @@ private:
         end
     };
 
-    size_t expand_size {8192};
+    options opts;
+    // Declared before file, whose destructor counts its ftruncate.
+    [[no_unique_address]] mutable mmap_stats::counters<Traits::stats> counters;
 
     File file;
     MmapData mmap_data;
 
+    std::mutex expand_mutex;
+
+    struct DirtyRange
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    // Beyond this many separate dirty ranges, the two closest ones are merged and flush() also
+    // syncs the clean bytes between them.
+    static constexpr size_t max_dirty_ranges {64};
+
+    // Sorted, disjoint ranges of modified bytes not yet flushed. Bytes in
+    // [append_base, write_pos) were written by append() and are folded in by the next serial
+    // operation.
+    std::vector<DirtyRange> dirty;
+    // Ranges handed out by as_span(), which stay dirty while the spans are valid since they may be
+    // written through at any time.
+    std::vector<DirtyRange> spans;
+    size_t append_base {0};
+    size_t unflushed_bytes {0};
+
+    size_t reserved_len {0};
+
+    std::unique_ptr<Flusher> flusher;
+
+    // Both lists have room for max_dirty_ranges + 1 ranges, so this never allocates.
+    static void add_range(std::vector<DirtyRange>& ranges, size_t begin, size_t end) noexcept
+    {
+        if (begin >= end) { return; }
+
+        // Sequential writes extend the last range.
+        if (!ranges.empty() && begin >= ranges.back().begin && begin <= ranges.back().end)
+        {
+            ranges.back().end = std::max(ranges.back().end, end);
+            return;
+        }
+
+        // Merges with every range that overlaps or touches [begin, end).
+        auto first = std::ranges::lower_bound(ranges, begin, {}, &DirtyRange::end);
+        auto last = std::ranges::upper_bound(first, ranges.end(), end, {}, &DirtyRange::begin);
+        if (first != last)
+        {
+            begin = std::min(begin, first->begin);
+            end = std::max(end, std::prev(last)->end);
+            first = ranges.erase(first, last);
+        }
+        ranges.insert(first, DirtyRange {begin, end});
+
+        if (ranges.size() > max_dirty_ranges)
+        {
+            auto closest = ranges.begin();
+            for (auto it = ranges.begin(); it + 1 != ranges.end(); ++it)
+            {
+                if (it[1].begin - it->end < closest[1].begin - closest->end) { closest = it; }
+            }
+            closest->end = closest[1].end;
+            ranges.erase(closest + 1);
+        }
+    }
+
+    void mark_dirty(size_t begin, size_t end) noexcept { add_range(dirty, begin, end); }
+
+    // Called before the mapping moves, which invalidates every span of as_span().
+    void retire_spans() noexcept
+    {
+        for (const DirtyRange& range : spans) { mark_dirty(range.begin, range.end); }
+        spans.clear();
+    }
+
+    void merge_appended() noexcept
+    {
+        if (write_pos > append_base) { mark_dirty(append_base, write_pos); }
+        append_base = write_pos;
+    }
+
+    void count_unflushed(size_t bytes)
+    {
+        if (flusher == nullptr || opts.flush_bytes == 0) { return; }
+
+        unflushed_bytes += bytes;
+        if (unflushed_bytes >= opts.flush_bytes)
+        {
+            unflushed_bytes = 0;
+            flusher->kick();
+        }
+    }
+
+    // Returns writable space at pos for output_iterator, pos being at or past write_pos. The first
+    // call uses the space that is already mapped, so that short output neither expands the file
+    // nor moves the window; later calls reserve as much as was written so far.
+    std::span<char> reserve_output(size_t pos)
+    {
+        if (pos < write_pos)
+        {
+            throw std::logic_error {"mmap_writer: output_iterator used after a later copy"};
+        }
+
+        const size_t window_end = mmap_data.map_offset + mmap_data.map_size;
+        const size_t mapped = window_end > pos ? std::min(window_end, file_size) - pos : 0;
+        const size_t n =
+            std::max(std::max<size_t>(std::min<size_t>(mapped, 4096), 256), pos - write_pos);
+
+        if (pos + n > file_size) { expand(pos + n); }
+        return {mmap_data.at(pos, n), n};
+    }
+
+    // Makes the n bytes already stored at the write position part of the file.
+    void advance(size_t n)
+    {
+        merge_appended();
+        mark_dirty(write_pos, write_pos + n);
+        count_unflushed(n);
+        counters.add_bytes(n);
+
+        write_pos += n;
+        append_base = write_pos;
+        max_write_pos = std::max(max_write_pos, write_pos);
+    }
+
+    // append() moves write_pos without updating max_write_pos.
+    [[nodiscard]]
+    size_t end_pos() const noexcept
+    {
+        return std::max(max_write_pos, write_pos);
+    }
+
     void expand(size_t required_size)
     {
-        if (expand_size == 0)
+        counters.add_expansion();
+        size_t new_file_size = opts.growth.next_capacity(file_size, required_size);
+        if (mmap_data.reserved())
         {
-            throw std::logic_error {"mmap_writer: expand_size must be greater than 0"};
+            if (required_size > opts.max_capacity)
+            {
+                throw std::length_error {"mmap_writer: max_capacity exceeded"};
+            }
+            new_file_size = std::min(new_file_size, opts.max_capacity);
         }
 
-        size_t new_file_size = file_size;
-        while (new_file_size < required_size) { new_file_size += expand_size; }
+        grow_file(file_size, new_file_size);
+        if (!mmap_data.windowed()) { mmap_data.remap(new_file_size); }
+        // Publishes the grown mapping to concurrent append() calls.
+        std::atomic_ref<size_t> {file_size}.store(new_file_size, std::memory_order_release);
+    }
 
-        file.resize(new_file_size);
-        mmap_data.remap(new_file_size);
-        file_size = new_file_size;
+    void grow_file(size_t old_size, size_t new_size)
+    {
+        // Allocating up front keeps block allocation out of the page faults of later writes.
+        if (opts.preallocate && new_size > old_size && file.allocate(old_size, new_size - old_size))
+        {
+            return;
+        }
+
+        file.resize(new_size);
+    }
+
+    // Runs before the file is opened, so that invalid options leave it untouched.
+    static const options& validated(const options& opts)
+    {
+        opts.growth.validate();
+        return opts;
     }
 
     void init(bool truncate, size_t reserved_size)
@@ -189,9 +814,6 @@ private:
         if (old_file_size == 0) { file_size = (reserved_size > 0 ? reserved_size : 8192); }
         else { file_size = old_file_size + reserved_size; }
 
-        file.resize(file_size);
-        mmap_data.memory_map();
-
         if (!truncate)
         {
             write_pos = old_file_size;
@@ -202,36 +824,192 @@ private:
             write_pos = 0;
             max_write_pos = 0;
         }
+
+        grow_file(old_file_size, file_size);
+
+        if (mmap_data.windowed() && mmap_data.reserved())
+        {
+            throw std::logic_error {"mmap_writer: window_size and max_capacity are exclusive"};
+        }
+
+        if (mmap_data.windowed())
+        {
+            opts.window_size = MmapData::align_to_page(opts.window_size);
+            mmap_data.slide(write_pos, 0);
+        }
+        else if (mmap_data.reserved())
+        {
+            opts.max_capacity = MmapData::align_to_page(opts.max_capacity);
+            if (file_size > opts.max_capacity)
+            {
+                throw std::length_error {"mmap_writer: max_capacity exceeded"};
+            }
+            mmap_data.map_reserved(file_size);
+        }
+        else { mmap_data.memory_map(0, file_size); }
+
+        append_base = write_pos;
+        dirty.reserve(max_dirty_ranges + 1);
+        spans.reserve(max_dirty_ranges + 1);
+
+        if (opts.flush_interval.count() > 0 || opts.flush_bytes > 0)
+        {
+            flusher = std::make_unique<Flusher>(file.fd, opts.flush_interval);
+        }
+    }
+
+    // Makes [offset, offset + len) writable and records it as modified.
+    void prepare(size_t offset, size_t len)
+    {
+        if (offset + len > file_size) { expand(offset + len); }
+
+        mark_dirty(offset, offset + len);
+        count_unflushed(len);
+    }
+
+    // Copies data to offset, which must have been prepared, moving the window as needed.
+    void store(size_t offset, std::span<const char> data)
+    {
+        const bool nontemporal =
+            opts.nontemporal_threshold != 0 && data.size() >= opts.nontemporal_threshold;
+        auto copy = [nontemporal](std::span<const char> src, char* dst)
+        {
+            if (nontemporal) { mmap_simd::copy_nontemporal(dst, src.data(), src.size()); }
+            else { std::ranges::copy(src, dst); }
+        };
+
+        if (!mmap_data.windowed())
+        {
+            copy(data, mmap_data.mapped_ptr + offset);
+            return;
+        }
+
+        while (!data.empty())
+        {
+            const size_t window_end = mmap_data.map_offset + mmap_data.map_size;
+            const size_t n = (offset >= mmap_data.map_offset && offset < window_end)
+                                 ? std::min(data.size(), window_end - offset)
+                                 : std::min(data.size(), opts.window_size);
+
+            copy(data.first(n), mmap_data.at(offset, n));
+            offset += n;
+            data = data.subspan(n);
+        }
+    }
+
+    void copy_in(size_t offset, std::span<const char> data)
+    {
+        prepare(offset, data.size());
+        store(offset, data);
+        counters.add_bytes(data.size());
+    }
+
+    // Size checks, expansion and bookkeeping happen once for all pieces.
+    size_t copy_in(size_t offset, std::span<const std::span<const char>> pieces)
+    {
+        size_t total = 0;
+        for (std::span<const char> piece : pieces) { total += piece.size(); }
+
+        prepare(offset, total);
+        for (std::span<const char> piece : pieces)
+        {
+            store(offset, piece);
+            offset += piece.size();
+        }
+
+        counters.add_bytes(total);
+        return total;
     }
 
 public:
-    mmap_writer(std::string_view filename, bool truncate, size_t reserved_size = 0)
-        : file {this, filename, truncate}, mmap_data {this}
+    basic_mmap_writer(std::string_view filename, bool truncate, size_t reserved_size = 0)
+        : basic_mmap_writer {filename, truncate, reserved_size, options {}}
+    {}
+
+    basic_mmap_writer(int fd, bool truncate, size_t reserved_size = 0)
+        : basic_mmap_writer {fd, truncate, reserved_size, options {}}
+    {}
+
+    basic_mmap_writer(std::string_view filename,
+                      bool truncate,
+                      size_t reserved_size,
+                      const options& opts_)
+        : opts {validated(opts_)}, file {this, filename, truncate}, mmap_data {this}
     {
         init(truncate, reserved_size);
     }
 
-    mmap_writer(int fd, bool truncate, size_t reserved_size = 0) : file {this, fd}, mmap_data {this}
+    basic_mmap_writer(int fd, bool truncate, size_t reserved_size, const options& opts_)
+        : opts {validated(opts_)}, file {this, fd}, mmap_data {this}
     {
         init(truncate, reserved_size);
     }
 
+    // Must not run concurrently with append(). A moved-from writer is empty and may only be
+    // destroyed or assigned to.
+    basic_mmap_writer(basic_mmap_writer&& that) noexcept
+        : file_size {std::exchange(that.file_size, 0)},
+          write_pos {std::exchange(that.write_pos, 0)},
+          max_write_pos {std::exchange(that.max_write_pos, 0)},
+          opts {that.opts},
+          counters {that.counters},
+          file {this, std::move(that.file)},
+          mmap_data {this, std::move(that.mmap_data)},
+          dirty {std::move(that.dirty)},
+          spans {std::move(that.spans)},
+          append_base {std::exchange(that.append_base, 0)},
+          unflushed_bytes {std::exchange(that.unflushed_bytes, 0)},
+          reserved_len {std::exchange(that.reserved_len, 0)},
+          flusher {std::move(that.flusher)}
+    {}
 
-    [[nodiscard]] size_t size() const noexcept { return max_write_pos; }
+    // Finishes this writer like its destructor, then takes over that. The mapping and the file are
+    // released while opts, write_pos and file_size still describe them.
+    basic_mmap_writer& operator=(basic_mmap_writer&& that) noexcept
+    {
+        if (this != &that)
+        {
+            flusher.reset();
+            mmap_data = std::move(that.mmap_data);
+            file = std::move(that.file);
+
+            file_size = std::exchange(that.file_size, 0);
+            write_pos = std::exchange(that.write_pos, 0);
+            max_write_pos = std::exchange(that.max_write_pos, 0);
+            opts = that.opts;
+            counters = that.counters;
+            dirty = std::move(that.dirty);
+            spans = std::move(that.spans);
+            append_base = std::exchange(that.append_base, 0);
+            unflushed_bytes = std::exchange(that.unflushed_bytes, 0);
+            reserved_len = std::exchange(that.reserved_len, 0);
+            flusher = std::move(that.flusher);
+        }
+        return *this;
+    }
+
+    [[nodiscard]] size_t size() const noexcept { return end_pos(); }
 
     [[nodiscard]] size_t capacity() const noexcept { return file_size; }
 
+    // Counters of this writer since it was opened or reset_stats() was called. All zero unless
+    // built with MMAP_STATS (see mmap_stats.hpp). The background flusher is not counted.
+    [[nodiscard]] mmap_stats::writer_stats stats() const noexcept { return counters.writer(); }
+
+    void reset_stats() const noexcept { counters.reset(); }
+
     void set_expand_size(size_t new_expand_size)
     {
-        expand_size = new_expand_size > 0 ? new_expand_size : 8192;
+        opts.growth = growth_policy::fixed(new_expand_size > 0 ? new_expand_size : 8192);
     }
 
     void shrink_to_fit()
     {
+        max_write_pos = end_pos();
         if (max_write_pos < file_size)
         {
             file.resize(max_write_pos);
-            mmap_data.remap(max_write_pos);
+            if (!mmap_data.windowed()) { mmap_data.remap(max_write_pos); }
             file_size = max_write_pos;
         }
     }
@@ -242,6 +1020,16 @@ public:
         return write_pos;
     }
 
+    void advise(access_pattern pattern) const
+    {
+        mmap_data.advise(pattern, mmap_data.map_offset, mmap_data.map_size);
+    }
+
+    void advise(access_pattern pattern, size_t offset, size_t len) const
+    {
+        mmap_data.advise(pattern, offset, len);
+    }
+
     static const seekdir beg {seekdir::beg};
     static const seekdir cur {seekdir::cur};
     static const seekdir end {seekdir::end};
@@ -250,7 +1038,9 @@ public:
     {
         if (pos > file_size) { expand(pos); }
 
+        merge_appended();
         write_pos = pos;
+        append_base = pos;
         max_write_pos = std::max(max_write_pos, write_pos);
     }
 
@@ -277,11 +1067,11 @@ public:
         case seekdir::end:
             if (off < 0)
             {
-                new_pos = (static_cast<size_t>(-off) > max_write_pos)
+                new_pos = (static_cast<size_t>(-off) > end_pos())
                               ? 0
-                              : max_write_pos - static_cast<size_t>(-off);
+                              : end_pos() - static_cast<size_t>(-off);
             }
-            else { new_pos = max_write_pos + static_cast<size_t>(off); }
+            else { new_pos = end_pos() + static_cast<size_t>(off); }
             break;
         default:
             break;
@@ -292,18 +1082,282 @@ public:
 
     void write(std::span<const char> data)
     {
-        if (write_pos + data.size() > file_size) { expand(write_pos + data.size()); }
-        std::ranges::copy(data, mmap_data.mapped_ptr + write_pos);
+        merge_appended();
+        copy_in(write_pos, data);
         write_pos += data.size();
+        append_base = write_pos;
         max_write_pos = std::max(max_write_pos, write_pos);
     }
 
     void pwrite(std::span<const char> data, size_t offset)
     {
-        if (offset + data.size() > file_size) { expand(offset + data.size()); }
-        std::ranges::copy(data, mmap_data.mapped_ptr + offset);
+        copy_in(offset, data);
         max_write_pos = std::max(max_write_pos, offset + data.size());
     }
 
-    void flush(bool async = false) { mmap_data.sync(async); }
+    // Writes all pieces back to back at the current position.
+    void writev(std::span<const std::span<const char>> pieces)
+    {
+        merge_appended();
+        write_pos += copy_in(write_pos, pieces);
+        append_base = write_pos;
+        max_write_pos = std::max(max_write_pos, write_pos);
+    }
+
+    void pwritev(std::span<const std::span<const char>> pieces, size_t offset)
+    {
+        const size_t total = copy_in(offset, pieces);
+        max_write_pos = std::max(max_write_pos, offset + total);
+    }
+
+    // Views count records of type T at offset for in-place reads and updates, growing the file
+    // to cover them. Valid until the mapping moves: the next expansion without max_capacity, or
+    // the next window move in windowed mode. Call it again after writing elsewhere. Until then,
+    // every flush() syncs the records, so stores made after a flush are synced by the next one.
+    template <typename T>
+    [[nodiscard]]
+    std::span<T> as_span(size_t offset, size_t count)
+    {
+        static_assert(std::is_trivially_copyable_v<T>, "mmap_writer: T must be trivially copyable");
+        static_assert(4096 % alignof(T) == 0, "mmap_writer: T must not be over-aligned");
+
+        if constexpr (Traits::checked)
+        {
+            if (offset % alignof(T) != 0)
+            {
+                throw std::invalid_argument {
+                    "mmap_writer: offset is not aligned for the record type"};
+            }
+            if (count > (SIZE_MAX - offset) / sizeof(T))
+            {
+                throw std::length_error {"mmap_writer: records exceed the address space"};
+            }
+        }
+
+        const size_t len = count * sizeof(T);
+        prepare(offset, len);
+        max_write_pos = std::max(max_write_pos, offset + len);
+
+        T* records = reinterpret_cast<T*>(mmap_data.at(offset, len));
+        // Added after at(), whose window move retires the spans handed out before.
+        add_range(spans, offset, offset + len);
+        return {records, count};
+    }
+
+    // Returns n writable bytes at the current position, valid until the next non-const call.
+    // The bytes become part of the file only when they are committed.
+    [[nodiscard]]
+    std::span<char> reserve(size_t n)
+    {
+        if (write_pos + n > file_size) { expand(write_pos + n); }
+
+        reserved_len = n;
+        return {mmap_data.at(write_pos, n), n};
+    }
+
+    // Advances the write position over the first n_used bytes of the last reserve().
+    void commit(size_t n_used)
+    {
+        if (Traits::checked && n_used > reserved_len)
+        {
+            throw std::invalid_argument {"mmap_writer: commit exceeds the reserved size"};
+        }
+
+        advance(n_used);
+        reserved_len = 0;
+    }
+
+    // Output iterator that formats straight into the mapping at the current position, for use with
+    // std::format_to. Space is reserved as needed, and the bytes are committed at once when the
+    // iterator and its copies go away, i.e. once per format call. No other member may be called
+    // meanwhile.
+    class output_iterator
+    {
+    private:
+        basic_mmap_writer* writer;
+        // [next, end) is reserved space in the mapping, end being at file offset end_pos. They
+        // are mutable since std::indirectly_writable assigns through a const iterator.
+        mutable char* next {nullptr};
+        mutable char* end {nullptr};
+        mutable size_t end_pos;
+
+        [[nodiscard]]
+        size_t pos() const noexcept
+        {
+            return end_pos - static_cast<size_t>(end - next);
+        }
+
+    public:
+        using iterator_category = std::output_iterator_tag;
+        using value_type = void;
+        using difference_type = ptrdiff_t;
+        using pointer = void;
+        using reference = void;
+
+        explicit output_iterator(basic_mmap_writer& writer_) noexcept
+            : writer {&writer_}, end_pos {writer_.write_pos}
+        {}
+
+        output_iterator(const output_iterator&) noexcept = default;
+        output_iterator& operator=(const output_iterator&) noexcept = default;
+
+        // Copies made before the last write are behind the write position and commit nothing.
+        ~output_iterator()
+        {
+            if (pos() > writer->write_pos) { writer->advance(pos() - writer->write_pos); }
+        }
+
+        const output_iterator& operator=(char c) const
+        {
+            if (next == end)
+            {
+                const std::span<char> buf = writer->reserve_output(end_pos);
+                next = buf.data();
+                end = buf.data() + buf.size();
+                end_pos += buf.size();
+            }
+            *next++ = c;
+            return *this;
+        }
+
+        output_iterator& operator*() noexcept { return *this; }
+        output_iterator& operator++() noexcept { return *this; }
+        output_iterator& operator++(int) noexcept { return *this; }
+    };
+
+    [[nodiscard]]
+    output_iterator output() noexcept
+    {
+        return output_iterator {*this};
+    }
+
+    // Formats straight into the mapping at the current position, in a single pass.
+    template <typename... Args>
+    void print(std::format_string<Args...> fmt, Args&&... args)
+    {
+        std::format_to(output(), fmt, std::forward<Args>(args)...);
+    }
+
+    // Appends data at the shared write position and returns its offset. Unlike the other
+    // members, append() may be called from several threads at once; it requires
+    // options::max_capacity so that growing the file never moves the mapping.
+    size_t append(std::span<const char> data)
+    {
+        if (!mmap_data.reserved())
+        {
+            throw std::logic_error {"mmap_writer: append requires options::max_capacity"};
+        }
+
+        // Claims the space only if it fits, so that exceeding max_capacity leaves no hole.
+        const std::atomic_ref<size_t> pos {write_pos};
+        size_t offset = pos.load(std::memory_order_relaxed);
+        size_t end = 0;
+        do
+        {
+            if (offset > opts.max_capacity || data.size() > opts.max_capacity - offset)
+            {
+                throw std::length_error {"mmap_writer: max_capacity exceeded"};
+            }
+            end = offset + data.size();
+        } while (!pos.compare_exchange_weak(offset, end, std::memory_order_relaxed));
+
+        if (end > std::atomic_ref<size_t> {file_size}.load(std::memory_order_acquire))
+        {
+            try
+            {
+                const std::scoped_lock lock {expand_mutex};
+                if (end > std::atomic_ref<size_t> {file_size}.load(std::memory_order_relaxed))
+                {
+                    expand(end);
+                }
+            }
+            catch (...)
+            {
+                // Gives the space back unless a later append() has claimed space behind it.
+                size_t claimed = end;
+                pos.compare_exchange_strong(claimed, offset, std::memory_order_relaxed);
+                throw;
+            }
+        }
+
+        std::ranges::copy(data, mmap_data.mapped_ptr + offset);
+        counters.add_bytes(data.size());
+
+        // Kick the background flusher whenever the cursor crosses a flush_bytes boundary.
+        if (flusher != nullptr && opts.flush_bytes > 0 &&
+            offset / opts.flush_bytes != end / opts.flush_bytes)
+        {
+            flusher->kick();
+        }
+
+        return offset;
+    }
+
+    // Writes payload as one framed record (see mmap_frame.hpp) at the current position and returns
+    // the offset of the frame. Like write(), it is not thread-safe.
+    size_t append_record(std::span<const char> payload, bool checksum = true)
+    {
+        char header[mmap_frame::max_header_size];
+        const size_t header_size =
+            mmap_frame::encode_header(header, {payload.data(), payload.size()}, checksum);
+
+        const size_t offset = write_pos;
+        const std::span<const char> pieces[] {{header, header_size}, payload};
+        writev(pieces);
+        return offset;
+    }
+
+    // Scans the framed records from the start of the file and stops at the first incomplete or
+    // corrupt one, such as a record torn by a crash. The current position and the end of the file
+    // move there, so the next record overwrites the damage and closing cuts off the rest.
+    // Returns the number of bytes covered by valid records.
+    size_t recover_records()
+    {
+        merge_appended();
+
+        const size_t size = end_pos();
+        auto at = [this](size_t pos, size_t len) -> const char* { return mmap_data.at(pos, len); };
+
+        size_t pos = 0;
+        std::string_view payload;
+        while (mmap_frame::read_frame(at, pos, size, payload, pos))
+        {}
+
+        write_pos = pos;
+        append_base = pos;
+        max_write_pos = pos;
+        return pos;
+    }
+
+    // Synchronizes the bytes modified since the last flush with the file.
+    void flush(bool async = false)
+    {
+        merge_appended();
+        for (const DirtyRange& range : spans) { mark_dirty(range.begin, range.end); }
+
+        // In windowed mode, the ranges outside the window share one sync_file() call.
+        size_t unmapped_begin {SIZE_MAX};
+        size_t unmapped_end {0};
+        for (const DirtyRange& range : dirty)
+        {
+            if (mmap_data.sync_mapped(range.begin, range.end - range.begin, async))
+            {
+                unmapped_begin = std::min(unmapped_begin, range.begin);
+                unmapped_end = range.end;
+            }
+        }
+        if (unmapped_begin < unmapped_end)
+        {
+            mmap_data.sync_file(unmapped_begin, unmapped_end - unmapped_begin, async);
+        }
+        dirty.clear();
+    }
+
+    void flush_range(size_t offset, size_t len, bool async = false)
+    {
+        if (offset >= file_size) { return; }
+        mmap_data.sync(offset, std::min(len, file_size - offset), async);
+    }
 };
+
+using mmap_writer = basic_mmap_writer<>;
@@ -1,8 +1,23 @@
 #include "../mmap_reader.hpp"
+#include "../mmap_writer.hpp"
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <fcntl.h>
 #include <filesystem>
+#include <format>
 #include <fstream>
 #include <iostream>
+#include <limits>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 void test_data_and_size()
@@ -194,6 +209,1170 @@ void test_view_and_str()
     std::filesystem::remove(test_file);
 }
 
+void test_lines_all_isas()
+{
+    std::string test_data;
+    for (size_t i = 0; i < 300; ++i) { test_data += std::string(i % 97, 'x') + '\n'; }
+    test_data += "no trailing delimiter";
+
+    const std::filesystem::path test_file = "test_file.txt";
+    std::ofstream ofs(test_file);
+    ofs << test_data;
+    ofs.close();
+
+    {
+        mmap_reader reader(test_file.string());
+        const mmap_simd::isa default_isa = mmap_simd::active_isa();
+
+        for (mmap_simd::isa target : {mmap_simd::isa::scalar,
+                                      mmap_simd::isa::sse2,
+                                      mmap_simd::isa::avx2,
+                                      mmap_simd::isa::avx512,
+                                      mmap_simd::isa::neon})
+        {
+            if (!mmap_simd::supported(target)) { continue; }
+            mmap_simd::set_isa(target);
+
+            reader.seek(0);
+            size_t count = 0;
+            for (std::string_view line : reader.lines())
+            {
+                if (count < 300) { assert(line == std::string(count % 97, 'x')); }
+                else { assert(line == "no trailing delimiter"); }
+                ++count;
+            }
+            assert(count == 301);
+
+            // The kernels instantiated for a fixed byte agree with the dispatched ones.
+            const char* first = test_data.data();
+            const char* last = first + test_data.size();
+            for (const char* p = first; p != last; ++p)
+            {
+                assert(mmap_simd::find<'\n'>(p, last) == mmap_simd::find(p, last, '\n'));
+                assert(mmap_simd::find<'r'>(p, last) == mmap_simd::find(p, last, 'r'));
+            }
+        }
+
+        mmap_simd::set_isa(default_isa);
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_split_and_parallel_lines()
+{
+    std::string test_data;
+    for (size_t i = 0; i < 1000; ++i) { test_data += "line " + std::to_string(i) + '\n'; }
+
+    const std::filesystem::path test_file = "test_file.txt";
+    std::ofstream ofs(test_file);
+    ofs << test_data;
+    ofs.close();
+
+    {
+        mmap_reader reader(test_file.string());
+
+        auto chunks = reader.split(7);
+        assert(!chunks.empty() && chunks.size() <= 7);
+        std::string joined;
+        for (std::string_view chunk : chunks)
+        {
+            assert(!chunk.empty() && chunk.back() == '\n');
+            joined += chunk;
+        }
+        assert(joined == test_data);
+
+        std::vector<size_t> per_chunk(4, 0);
+        std::vector<std::vector<std::string_view>> seen(4);
+        reader.parallel_lines(4,
+                              [&](size_t index, std::string_view line)
+                              {
+                                  ++per_chunk[index];
+                                  seen[index].push_back(line);
+                              });
+
+        size_t total = 0;
+        for (size_t count : per_chunk) { total += count; }
+        assert(total == 1000);
+
+        size_t expected = 0;
+        for (const auto& lines : seen)
+        {
+            for (std::string_view line : lines)
+            {
+                assert(line == "line " + std::to_string(expected++));
+            }
+        }
+        assert(reader.tell() == 0);
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_search()
+{
+    std::string test_data;
+    for (size_t i = 0; i < 2000; ++i)
+    {
+        test_data += "entry " + std::to_string(i) + (i % 7 == 0 ? " ERROR disk full" : " ok");
+        test_data += i % 13 == 0 ? " aaaa\n" : "\n";
+    }
+    test_data += "ERROR at the end";
+
+    const std::filesystem::path test_file = "test_file.txt";
+    std::ofstream ofs(test_file);
+    ofs << test_data;
+    ofs.close();
+
+    auto offsets_of = [&](std::string_view pattern)
+    {
+        std::vector<size_t> offsets;
+        for (size_t pos = test_data.find(pattern); pos != std::string::npos;
+             pos = test_data.find(pattern, pos + 1))
+        {
+            offsets.push_back(pos);
+        }
+        return offsets;
+    };
+
+    auto lines_with = [&](std::string_view pattern)
+    {
+        std::vector<std::string_view> lines;
+        std::string_view rest = test_data;
+        while (!rest.empty())
+        {
+            const std::string_view line = rest.substr(0, rest.find('\n'));
+            if (line.find(pattern) != std::string_view::npos) { lines.push_back(line); }
+            rest.remove_prefix(std::min(rest.size(), line.size() + 1));
+        }
+        return lines;
+    };
+
+    {
+        mmap_reader reader(test_file.string());
+        const mmap_simd::isa default_isa = mmap_simd::active_isa();
+
+        for (mmap_simd::isa target : {mmap_simd::isa::scalar,
+                                      mmap_simd::isa::sse2,
+                                      mmap_simd::isa::avx2,
+                                      mmap_simd::isa::avx512,
+                                      mmap_simd::isa::neon})
+        {
+            if (!mmap_simd::supported(target)) { continue; }
+            mmap_simd::set_isa(target);
+
+            for (std::string_view pattern :
+                 {"E", "aa", "ERROR", "the end", "1999 ok", "ERROR disk full aaaa", "missing"})
+            {
+                for (size_t n_threads : {1, 3, 16})
+                {
+                    const std::vector<size_t> expected = offsets_of(pattern);
+                    assert(reader.find_all(pattern, n_threads) == expected);
+                    assert(reader.count(pattern, n_threads) == expected.size());
+
+                    assert(reader.lines_matching(pattern, n_threads) == lines_with(pattern));
+                }
+            }
+        }
+        mmap_simd::set_isa(default_isa);
+
+        // Overlapping matches count separately; a line with several matches is returned once.
+        assert(reader.count("aa") == 3 * reader.count("aaaa"));
+        assert(reader.lines_matching("aaaa").size() == reader.count("aaaa"));
+        assert(reader.lines_matching("\nentry").empty());
+
+        try
+        {
+            (void)reader.count("");
+            assert(false);
+        }
+        catch (const std::invalid_argument&)
+        {}
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_advise()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    std::ofstream ofs(test_file);
+    ofs << "Hello, mmap_reader!\nThis is a test file.\n";
+    ofs.close();
+
+    {
+        mmap_reader reader(test_file.string(),
+                           mmap_reader::options {.advice = mmap_reader::access_pattern::sequential});
+        assert(reader.getline().value() == "Hello, mmap_reader!");
+
+        reader.advise(mmap_reader::access_pattern::random);
+        reader.advise(mmap_reader::access_pattern::willneed, 7, 5);
+        reader.advise(mmap_reader::access_pattern::normal, 1024, 5);
+        assert(reader.view(7, 5) == "mmap_");
+
+        reader.advise(mmap_reader::access_pattern::dontneed);
+        assert(reader.view(7, 5) == "mmap_");
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_mapping_options()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    std::ofstream ofs(test_file);
+    ofs << "Hello, mmap_reader!\nThis is a test file.\n";
+    ofs.close();
+
+    for (const mmap_reader::options& opts : {mmap_reader::options {.populate = true},
+                                             mmap_reader::options {.huge_pages = true},
+                                             mmap_reader::options {.lock = true}})
+    {
+        try
+        {
+            mmap_reader reader(test_file.string(), opts);
+            assert(reader.view() == "Hello, mmap_reader!\nThis is a test file.\n");
+            assert(reader.getline().value() == "Hello, mmap_reader!");
+        }
+        catch (const std::system_error&)
+        {
+            // mlock and huge pages depend on RLIMIT_MEMLOCK and kernel configuration.
+            assert(opts.lock || opts.huge_pages);
+        }
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_windowed_mapping()
+{
+    std::string test_data;
+    for (size_t i = 0; i < 2000; ++i) { test_data += std::string(i % 131, 'a' + i % 26) + '\n'; }
+    test_data += std::string(10000, 'L') + '\n';
+    test_data += "last line";
+
+    const std::filesystem::path test_file = "test_file.txt";
+    std::ofstream ofs(test_file);
+    ofs << test_data;
+    ofs.close();
+
+    {
+        mmap_reader reader(test_file.string(), mmap_reader::options {.window_size = 4096});
+        assert(reader.size() == test_data.size());
+
+        std::string joined;
+        for (std::string_view line : reader.lines())
+        {
+            joined += line;
+            joined += '\n';
+        }
+        assert(joined == test_data + '\n');
+
+        reader.seek(0);
+        size_t char_count = 0;
+        for (char c : reader.chars()) { char_count += (c == test_data[char_count]) ? 1 : 0; }
+        assert(char_count == test_data.size());
+
+        std::string buffer(9000, '\0');
+        reader.seek(1000);
+        assert(reader.read(buffer).size() == buffer.size());
+        assert(buffer == test_data.substr(1000, 9000));
+        assert(reader.pread(buffer, 50000) == buffer.size());
+        assert(buffer == test_data.substr(50000, 9000));
+
+        assert(reader.view(70000, 12000) == test_data.substr(70000, 12000));
+        assert(reader.str() == test_data);
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_prefetch()
+{
+    std::string test_data;
+    for (size_t i = 0; i < 20000; ++i) { test_data += std::to_string(i) + '\n'; }
+
+    const std::filesystem::path test_file = "test_file.txt";
+    std::ofstream ofs(test_file);
+    ofs << test_data;
+    ofs.close();
+
+    for (const mmap_reader::options& opts :
+         {mmap_reader::options {.prefetch_distance = 8192},
+          mmap_reader::options {.window_size = 4096, .prefetch_distance = 16384}})
+    {
+        mmap_reader reader(test_file.string(), opts);
+
+        size_t count = 0;
+        for (std::string_view line : reader.lines()) { assert(line == std::to_string(count++)); }
+        assert(count == 20000);
+
+        // Backward and forward seeks restart the prefetch window.
+        reader.seek(0);
+        assert(reader.getline() == "0");
+        reader.seek(test_data.size() - 6);
+        assert(reader.getline() == "19999");
+
+        reader.seek(0);
+        size_t char_count = 0;
+        for (char c : reader.chars()) { char_count += (c == test_data[char_count]) ? 1 : 0; }
+        assert(char_count == test_data.size());
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_line_index()
+{
+    std::vector<std::string> expected;
+    std::string test_data;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        expected.push_back(std::string((i * 37) % 300, 'a' + i % 26));
+        test_data += expected.back() + '\n';
+    }
+    expected.emplace_back("no trailing delimiter");
+    test_data += expected.back();
+
+    const std::filesystem::path test_file = "test_file.txt";
+    const std::filesystem::path sidecar = "test_file.txt.idx";
+    std::ofstream ofs(test_file);
+    ofs << test_data;
+    ofs.close();
+
+    using indexed_range = decltype(std::declval<const mmap_reader&>().indexed_lines());
+    static_assert(std::ranges::random_access_range<indexed_range>);
+
+    {
+        mmap_reader reader(test_file.string());
+        assert(!reader.has_line_index());
+        try
+        {
+            static_cast<void>(reader.line(0));
+            assert(false);
+        }
+        catch (const std::logic_error&)
+        {}
+
+        for (size_t n_threads : {1, 3, 8})
+        {
+            reader.build_line_index(n_threads);
+            assert(reader.has_line_index());
+            assert(reader.line_count() == expected.size());
+            for (size_t i = 0; i < expected.size(); ++i) { assert(reader.line(i) == expected[i]); }
+        }
+
+        auto lines = reader.indexed_lines();
+        assert(std::ranges::equal(lines, expected));
+        assert(lines[500] == expected[500]);
+        assert(*(lines.end() - 1) == expected.back());
+
+        reader.seek_line(777);
+        assert(reader.getline() == expected[777]);
+        assert(reader.getline() == expected[778]);
+
+        try
+        {
+            static_cast<void>(reader.line(expected.size()));
+            assert(false);
+        }
+        catch (const std::out_of_range&)
+        {}
+
+        reader.save_line_index(sidecar.string());
+    }
+
+    {
+        mmap_reader reader(test_file.string());
+        assert(reader.load_line_index(sidecar.string()));
+        assert(reader.line_count() == expected.size());
+        assert(reader.line(999) == expected[999]);
+        assert(!reader.load_line_index("missing.idx"));
+    }
+
+    // A truncated sidecar is rejected.
+    std::filesystem::resize_file(sidecar, std::filesystem::file_size(sidecar) - 1);
+    {
+        mmap_reader reader(test_file.string());
+        assert(!reader.load_line_index(sidecar.string()));
+        assert(!reader.has_line_index());
+    }
+
+    // As is one written for an older version of the file.
+    {
+        mmap_reader reader(test_file.string());
+        reader.build_line_index();
+        reader.save_line_index(sidecar.string());
+    }
+    ofs.open(test_file, std::ios::app);
+    ofs << "more";
+    ofs.close();
+    {
+        mmap_reader reader(test_file.string());
+        assert(!reader.load_line_index(sidecar.string()));
+    }
+
+    // Empty lines and a trailing delimiter split the same way as lines().
+    ofs.open(test_file);
+    ofs << "\n\nx\n";
+    ofs.close();
+    {
+        mmap_reader reader(test_file.string());
+        reader.build_line_index(2);
+        assert(reader.line_count() == 3);
+        assert(reader.line(0).empty() && reader.line(1).empty() && reader.line(2) == "x");
+    }
+
+    std::filesystem::remove(test_file);
+    std::filesystem::remove(sidecar);
+}
+
+void test_delimiters()
+{
+    std::vector<std::string> fields;
+    for (size_t i = 0; i < 3000; ++i) { fields.push_back(std::string(i % 53, 'a' + i % 26)); }
+
+    auto write_file = [](const std::string& data)
+    {
+        std::ofstream ofs("test_file.txt", std::ios::binary);
+        ofs << data;
+    };
+
+    auto check = [&](std::string_view data, auto delimiter, const std::vector<std::string>& lines)
+    {
+        write_file(std::string {data});
+        for (const mmap_reader::options& opts :
+             {mmap_reader::options {}, mmap_reader::options {.window_size = 4096}})
+        {
+            mmap_reader reader("test_file.txt", opts);
+            size_t count = 0;
+            for (std::string_view line : reader.lines(delimiter))
+            {
+                assert(line == lines[count++]);
+            }
+            assert(count == lines.size());
+
+            reader.seek(0);
+            count = 0;
+            while (auto line = reader.getline(delimiter)) { assert(*line == lines[count++]); }
+            assert(count == lines.size());
+        }
+    };
+
+    const mmap_simd::isa default_isa = mmap_simd::active_isa();
+    for (mmap_simd::isa target : {mmap_simd::isa::scalar,
+                                  mmap_simd::isa::sse2,
+                                  mmap_simd::isa::avx2,
+                                  mmap_simd::isa::avx512,
+                                  mmap_simd::isa::neon})
+    {
+        if (!mmap_simd::supported(target)) { continue; }
+        mmap_simd::set_isa(target);
+
+        // Record separators made of two bytes, some of them straddling a window boundary.
+        std::string records;
+        for (const std::string& field : fields) { records += field + "\x1e\n"; }
+        check(records, std::string_view {"\x1e\n"}, fields);
+
+        // CRLF line endings; a lone '\r' inside a line is kept.
+        std::string crlf;
+        std::vector<std::string> crlf_lines = fields;
+        crlf_lines.back() = "bare\rcr";
+        for (const std::string& line : crlf_lines) { crlf += line + "\r\n"; }
+        check(crlf, mmap_reader::crlf, crlf_lines);
+
+        // Any of several single-byte delimiters, without a trailing one.
+        std::string mixed;
+        for (size_t i = 0; i < fields.size(); ++i) { mixed += fields[i] + ",;|"[i % 3]; }
+        mixed.pop_back();
+        check(mixed, mmap_reader::any_of {",;|"}, fields);
+    }
+    mmap_simd::set_isa(default_isa);
+
+    {
+        mmap_reader reader("test_file.txt");
+        try
+        {
+            static_cast<void>(reader.lines(std::string_view {}));
+            assert(false);
+        }
+        catch (const std::invalid_argument&)
+        {}
+    }
+
+    std::filesystem::remove("test_file.txt");
+}
+
+void test_fields()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    auto rows_of = [](mmap_reader& reader, auto&&... format)
+    {
+        std::vector<std::vector<std::string>> rows;
+        for (std::span<const std::string_view> row : reader.fields(format...))
+        {
+            rows.emplace_back(row.begin(), row.end());
+        }
+        return rows;
+    };
+
+    {
+        std::ofstream ofs(test_file);
+        ofs << "id,name,note\n"
+               "1,plain,\n"
+               "2,\"with, comma\",\"say \"\"hi\"\"\"\n"
+               "3,\"multi\nline\",x\n"
+               "\n"
+               "4,,\"\"\n"
+               << std::string(100, 'u') << ",\"" << std::string(150, 'q') << "\"\""
+               << std::string(80, ',') << "\"\n"
+               "5,last,no newline";
+    }
+
+    {
+        mmap_reader reader(test_file.string());
+        const std::vector<std::vector<std::string>> expected {
+            {"id", "name", "note"},
+            {"1", "plain", ""},
+            {"2", "with, comma", "say \"\"hi\"\""},
+            {"3", "multi\nline", "x"},
+            {""},
+            {"4", "", ""},
+            {std::string(100, 'u'), std::string(150, 'q') + "\"\"" + std::string(80, ',')},
+            {"5", "last", "no newline"},
+        };
+        assert(rows_of(reader) == expected);
+        assert(mmap_reader::unescape(expected[2][2]) == "say \"hi\"");
+    }
+
+    // Tab separated, single quote, and rows straddling window boundaries.
+    std::vector<std::vector<std::string>> expected;
+    {
+        std::ofstream ofs(test_file);
+        for (size_t i = 0; i < 2000; ++i)
+        {
+            const std::string text(i % 29, 'a' + i % 26);
+            expected.push_back({std::to_string(i), text, "q\t" + text});
+            ofs << i << '\t' << text << "\t'q\t" << text << "'\n";
+        }
+    }
+
+    for (const mmap_reader::options& opts :
+         {mmap_reader::options {}, mmap_reader::options {.window_size = 4096}})
+    {
+        mmap_reader reader(test_file.string(), opts);
+        assert(rows_of(reader, '\n', '\t', '\'') == expected);
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_read_numbers()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        std::ofstream ofs(test_file);
+        ofs << "  42\t-17\n"
+               "18446744073709551615 -9223372036854775808 1234567890123456789\n"
+               "12345678901234567890123 ff 300\n"
+               "3.25 -1e-3 inf word 7,8";
+    }
+
+    {
+        mmap_reader reader(test_file.string());
+        assert(reader.read_int<int>() == 42);
+        assert(reader.read_int<int>() == -17);
+        assert(reader.read_int<uint64_t>() == std::numeric_limits<uint64_t>::max());
+        assert(reader.read_int<int64_t>() == std::numeric_limits<int64_t>::min());
+        assert(reader.read_int<int64_t>() == 1234567890123456789);
+
+        // Out of range: nothing is consumed and the token can still be read as text.
+        assert(!reader.read_int<uint64_t>());
+        assert(reader.read_token() == "12345678901234567890123");
+        assert(reader.read_int<int>(16) == 255);
+        assert(!reader.read_int<uint8_t>());
+        assert(reader.read_int<uint16_t>() == 300);
+
+        assert(reader.read_float<double>() == 3.25);
+        assert(reader.read_float<float>() == -1e-3f);
+        assert(reader.read_float<double>() == std::numeric_limits<double>::infinity());
+        assert(!reader.read_float<double>());
+        assert(reader.read_token() == "word");
+
+        // Only the parsed characters are consumed.
+        assert(reader.read_int<int>() == 7);
+        assert(reader.getchar() == ',');
+        assert(reader.read_int<int>() == 8);
+        assert(!reader.read_int<int>());
+        assert(!reader.read_token());
+    }
+
+    // Every digit count through the eight-at-a-time path, with tokens straddling window boundaries.
+    std::vector<int64_t> expected;
+    {
+        std::ofstream ofs(test_file);
+        int64_t value = 1;
+        for (size_t i = 0; i < 3000; ++i)
+        {
+            expected.push_back((i % 2 == 0 ? 1 : -1) * (value + static_cast<int64_t>(i)));
+            ofs << expected.back() << (i % 7 == 0 ? "\n" : " ");
+            value = value >= 100000000000000000 ? 1 : value * 10;
+        }
+    }
+
+    for (const mmap_reader::options& opts :
+         {mmap_reader::options {}, mmap_reader::options {.window_size = 4096}})
+    {
+        mmap_reader reader(test_file.string(), opts);
+        for (int64_t value : expected) { assert(reader.read_int<int64_t>() == value); }
+        assert(!reader.read_int<int64_t>());
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_as_span_and_records()
+{
+    struct record
+    {
+        uint32_t id;
+        float value;
+        uint64_t timestamp;
+    };
+
+    std::vector<record> expected;
+    for (uint32_t i = 0; i < 1000; ++i) { expected.push_back({i, i * 0.5f, 1000000ULL + i}); }
+
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        std::ofstream ofs(test_file, std::ios::binary);
+        ofs.write(reinterpret_cast<const char*>(expected.data()),
+                  static_cast<std::streamsize>(expected.size() * sizeof(record)));
+        ofs << "tail"; // a partial record
+    }
+
+    auto same = [](const record& a, const record& b)
+    { return a.id == b.id && a.value == b.value && a.timestamp == b.timestamp; };
+
+    {
+        mmap_reader reader(test_file.string());
+
+        const std::span<const record> all = reader.records<record>();
+        assert(all.size() == expected.size());
+        assert(std::ranges::equal(all, expected, same));
+        assert(static_cast<const void*>(all.data()) == reader.data());
+
+        const std::span<const record> some = reader.as_span<record>(10 * sizeof(record), 5);
+        assert(some.size() == 5 && same(some[0], expected[10]) && same(some[4], expected[14]));
+
+        const std::span<const uint32_t> words = reader.as_span<uint32_t>(sizeof(record), 1);
+        assert(words[0] == 1);
+
+        try
+        {
+            static_cast<void>(reader.as_span<record>(4, 1));
+            assert(false);
+        }
+        catch (const std::invalid_argument&)
+        {}
+        try
+        {
+            static_cast<void>(reader.as_span<record>(0, expected.size() + 1));
+            assert(false);
+        }
+        catch (const std::out_of_range&)
+        {}
+    }
+
+    {
+        mmap_reader reader(test_file.string(), mmap_reader::options {.window_size = 4096});
+        const std::span<const record> far = reader.as_span<record>(900 * sizeof(record), 100);
+        assert(std::ranges::equal(far, std::span {expected}.subspan(900), same));
+    }
+
+    // An empty span at the end of the file, also when that end falls on a page boundary.
+    std::filesystem::resize_file(test_file, 8192);
+    for (const mmap_reader::options& opts :
+         {mmap_reader::options {}, mmap_reader::options {.window_size = 4096}})
+    {
+        mmap_reader reader(test_file.string(), opts);
+        assert(reader.as_span<char>(reader.size(), 0).empty());
+        assert(reader.as_span<char>(4096, 0).empty());
+        assert(reader.as_span<char>(8191, 1).size() == 1);
+        assert(reader.as_span<char>(reader.size(), 0).empty());
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_framed_records()
+{
+    auto frame = [](std::string_view payload, bool checksum)
+    {
+        char header[mmap_frame::max_header_size];
+        const size_t size = mmap_frame::encode_header(header, payload, checksum);
+        return std::string(header, size) + std::string(payload);
+    };
+
+    std::vector<std::string> expected;
+    std::string content;
+    for (int i = 0; i < 2000; ++i)
+    {
+        expected.emplace_back(static_cast<size_t>(i % 300), static_cast<char>('a' + i % 26));
+        content += frame(expected.back(), i % 2 == 0);
+    }
+    const size_t valid_size = content.size();
+
+    const std::filesystem::path test_file = "test_file.txt";
+    auto read_all = [&](const mmap_reader::options& opts)
+    {
+        mmap_reader reader(test_file.string(), opts);
+        std::vector<std::string> records;
+        for (std::string_view payload : reader.framed_records()) { records.emplace_back(payload); }
+        return std::pair {records, reader.framed_size()};
+    };
+
+    // A torn record and the zero fill left by a crash are not records.
+    for (const std::string& tail : {std::string {}, frame("torn record", true).substr(0, 8),
+                                    std::string(100, '\0')})
+    {
+        {
+            std::ofstream ofs(test_file, std::ios::binary);
+            ofs << content << tail;
+        }
+        for (const mmap_reader::options& opts :
+             {mmap_reader::options {}, mmap_reader::options {.window_size = 4096}})
+        {
+            const auto [records, size] = read_all(opts);
+            assert(records == expected);
+            assert(size == valid_size);
+        }
+    }
+
+    // Iteration stops at the first record that fails its checksum.
+    {
+        std::string corrupt = content;
+        const size_t offset = frame(expected[0], true).size() + frame(expected[1], false).size();
+        corrupt[offset + frame(expected[2], true).size() - 1] ^= 1;
+        std::ofstream ofs(test_file, std::ios::binary);
+        ofs << corrupt;
+    }
+    {
+        const auto [records, size] = read_all({});
+        assert(records.size() == 2 && records[1] == expected[1]);
+        assert(size == frame(expected[0], true).size() + frame(expected[1], false).size());
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_move_and_cached_mapping()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        std::ofstream ofs(test_file);
+        ofs << "first\nsecond\nthird\n";
+    }
+
+    {
+        // Readers can be returned from factories and stored in containers.
+        auto open = [&](const mmap_reader::options& opts)
+        { return mmap_reader {test_file.string(), opts}; };
+        std::vector<mmap_reader> readers;
+        readers.push_back(open({}));
+        readers.push_back(open({.prefetch_distance = 4096}));
+        readers.push_back(open({.window_size = 4096}));
+        for (int i = 0; i < 10; ++i) { readers.push_back(open({})); } // reallocates
+
+        for (mmap_reader& reader : readers)
+        {
+            assert(reader.getline() == "first");
+            mmap_reader moved {std::move(reader)};
+            assert(!reader && reader.size() == 0);
+            assert(moved.getline() == "second");
+            reader = std::move(moved);
+            assert(reader.getline() == "third");
+        }
+
+        // Assigning over an open reader releases its file and mapping.
+        for (mmap_reader& reader : readers)
+        {
+            reader = open({.window_size = 4096, .prefetch_distance = 4096});
+            assert(reader.getline() == "first");
+            reader = open({});
+            assert(reader.getline() == "first");
+        }
+    }
+
+    {
+        mmap_reader a = mmap_reader::open_cached(test_file.string());
+        mmap_reader b = mmap_reader::open_cached(test_file.string(), {.prefetch_distance = 4096});
+        assert(a.data() == b.data());
+        assert(a.getline() == "first" && b.getline() == "first" && a.getline() == "second");
+
+        // Readers keep their mapping alive when it leaves the cache.
+        mmap_reader::clear_cache();
+        mmap_reader c = mmap_reader::open_cached(test_file.string());
+        assert(c.data() != a.data() && a.getline() == "third");
+
+        // A modified file is a new version with its own mapping.
+        {
+            std::ofstream ofs(test_file, std::ios::app);
+            ofs << "fourth\n";
+        }
+        mmap_reader d = mmap_reader::open_cached(test_file.string());
+        assert(d.size() == c.size() + 7 && d.view().ends_with("fourth\n"));
+
+        try
+        {
+            static_cast<void>(mmap_reader::open_cached(test_file.string(), {.window_size = 4096}));
+            assert(false);
+        }
+        catch (const std::invalid_argument&)
+        {}
+        try
+        {
+            static_cast<void>(mmap_reader::open_cached("non_existent_file.txt"));
+            assert(false);
+        }
+        catch (const std::system_error&)
+        {}
+
+        mmap_reader::set_cache_capacity(0);
+        assert(mmap_reader::open_cached(test_file.string()).data() !=
+               mmap_reader::open_cached(test_file.string()).data());
+        mmap_reader::set_cache_capacity(64);
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_follow()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    auto append = [&](std::string_view text)
+    {
+        std::ofstream ofs(test_file, std::ios::binary | std::ios::app);
+        ofs << text;
+    };
+    auto drain = [](mmap_reader& reader)
+    {
+        std::vector<std::string> lines;
+        for (std::string_view line : reader.lines()) { lines.emplace_back(line); }
+        return lines;
+    };
+
+    for (const mmap_reader::options& opts :
+         {mmap_reader::options {.follow = true},
+          mmap_reader::options {.window_size = 4096, .follow = true},
+          mmap_reader::options {.prefetch_distance = 4096, .follow = true}})
+    {
+        std::ofstream {test_file}.close();
+        mmap_reader reader(test_file.string(), opts);
+        assert(reader.size() == 0 && drain(reader).empty());
+
+        // The incomplete last line is held back until its newline arrives.
+        append("first\nsec");
+        assert(reader.refresh() == 6);
+        assert(drain(reader) == std::vector<std::string> {"first"});
+        assert(!reader.wait_for_data(std::chrono::milliseconds {0}));
+
+        append("ond\n" + std::string(10000, 'x') + "\nthird\n");
+        reader.refresh();
+        assert(reader.tell() == 6);
+        const std::vector<std::string> lines = drain(reader);
+        assert(lines.size() == 3 && lines[0] == "second" && lines[1].size() == 10000);
+
+        // wait_for_data() blocks until another thread appends.
+        std::jthread appender {[&]
+                               {
+                                   std::this_thread::sleep_for(std::chrono::milliseconds {20});
+                                   append("fourth\n");
+                               }};
+        assert(reader.wait_for_data(std::chrono::seconds {10}));
+        assert(reader.getline() == "fourth");
+        appender.join();
+
+        // Truncation restarts at the beginning.
+        std::filesystem::resize_file(test_file, 0);
+        append("new\n");
+        reader.refresh();
+        assert(reader.tell() == 0 && drain(reader) == std::vector<std::string> {"new"});
+    }
+
+    // Truncating while the prefetcher is still faulting in a large followed file.
+    for (int round = 0; round < 5; ++round)
+    {
+        std::filesystem::remove(test_file);
+        append("first\n" + std::string(32 * 1024 * 1024, 'x') + "\nend\n");
+
+        mmap_reader reader(test_file.string(),
+                           {.prefetch_distance = 32 * 1024 * 1024, .follow = true});
+        assert(reader.getline() == "first");
+
+        std::filesystem::resize_file(test_file, 0);
+        append("new\n");
+        for (int i = 0; i < 5; ++i)
+        {
+            static_cast<void>(reader.wait_for_data(std::chrono::milliseconds {1}));
+        }
+        assert(reader.refresh() == 4 && reader.tell() == 0 && reader.getline() == "new");
+    }
+
+    // Tailing a file that mmap_writer grows ahead of its data and fills through its mapping.
+    {
+        std::filesystem::remove(test_file);
+        std::optional<mmap_writer> writer {std::in_place, test_file.string(), true};
+        writer->write(std::string_view {"hello\n"});
+
+        mmap_reader reader(test_file.string(), {.follow = true});
+        assert(reader.size() == 6 && reader.getline() == "hello");
+
+        // Written past the 8192 bytes the writer grows the file by at a time.
+        for (int i = 0; i < 1000; ++i)
+        {
+            writer->write(std::format("line {}\n", i));
+            assert(reader.wait_for_data(std::chrono::seconds {10}));
+            assert(reader.getline() == std::format("line {}", i));
+        }
+
+        writer.reset(); // truncates the preallocated tail
+        assert(reader.refresh() == std::filesystem::file_size(test_file));
+        assert(!reader);
+    }
+
+    try
+    {
+        mmap_reader reader(test_file.string());
+        reader.refresh();
+        assert(false);
+    }
+    catch (const std::logic_error&)
+    {}
+
+    std::filesystem::remove(test_file);
+}
+
+struct semicolon_traits : mmap_reader_traits
+{
+    static constexpr char delimiter {';'};
+    static constexpr bool checked {false};
+    static constexpr bool stats {true};
+};
+
+void test_stats()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        std::ofstream ofs(test_file);
+        for (int i = 0; i < 1000; ++i) { ofs << "line " << i << '\n'; }
+    }
+
+    mmap_reader reader(test_file.string(), {.window_size = 4096});
+    size_t n_lines = 0;
+    for (std::string_view line : reader.lines()) { n_lines += line.empty() ? 0 : 1; }
+    std::string buf(100, '\0');
+    const size_t n_read = reader.pread(buf, 10);
+    const std::string content = reader.str();
+
+    const mmap_stats::reader_stats stats = mmap_reader {std::move(reader)}.stats();
+    if constexpr (mmap_stats::enabled)
+    {
+        assert(n_lines == 1000 && stats.lines == 1000);
+        assert(stats.bytes_read == n_read + content.size());
+        assert(stats.mmap.calls > 1 && stats.munmap.calls == stats.mmap.calls - 1);
+        assert(stats.mmap.nanoseconds > 0);
+        assert(stats.minor_faults + stats.major_faults > 0);
+    }
+    else { assert(stats.lines == 0 && stats.bytes_read == 0 && stats.mmap.calls == 0); }
+
+    // The ranges count their faults once: copyable without counters, movable with them.
+    using line_range = decltype(std::declval<mmap_reader&>().lines());
+    using char_range = decltype(std::declval<mmap_reader&>().chars());
+    static_assert(std::is_copy_constructible_v<line_range> == !mmap_stats::enabled);
+    static_assert(std::is_copy_constructible_v<char_range> == !mmap_stats::enabled);
+    static_assert(std::is_move_constructible_v<line_range>);
+    static_assert(std::is_move_constructible_v<char_range>);
+    static_assert(!std::is_copy_constructible_v<
+                  decltype(std::declval<basic_mmap_reader<semicolon_traits>&>().lines())>);
+
+    mmap_reader other(test_file.string());
+    other.parallel_lines(4, [](std::string_view /*line*/) {});
+    assert(other.stats().lines == 0); // parallel scans do not move the read position
+    other.reset_stats();
+    assert(other.stats().mmap.calls == 0);
+
+    {
+        auto lines = other.lines();
+        auto moved = std::move(lines);
+        size_t count = 0;
+        for (std::string_view line : moved) { count += line.empty() ? 0 : 1; }
+        assert(count == 1000);
+    }
+    if constexpr (mmap_stats::enabled) { assert(other.stats().lines == 1000); }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_traits()
+{
+    static_assert(std::is_same_v<mmap_reader, basic_mmap_reader<mmap_reader_traits>>);
+
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        std::ofstream ofs(test_file);
+        ofs << "a;bb;ccc\nd;";
+    }
+
+    basic_mmap_reader<semicolon_traits> reader(test_file.string());
+    std::vector<std::string_view> lines;
+    for (std::string_view line : reader.lines()) { lines.push_back(line); }
+    assert((lines == std::vector<std::string_view> {"a", "bb", "ccc\nd"}));
+
+    // The stats policy of the traits enables the counters without MMAP_STATS.
+    assert(reader.stats().lines == 3 && reader.stats().mmap.calls == 1);
+
+    reader.build_line_index();
+    assert(reader.line_count() == 3 && reader.line(1) == "bb");
+
+    std::filesystem::remove(test_file);
+}
+
+// Minimal event loop for test_async_lines(): coroutines are resumed from a queue on the thread
+// that runs it.
+class event_loop
+{
+private:
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::coroutine_handle<>> handles;
+
+public:
+    // Notifies under the lock, since the loop may be destroyed as soon as it is released.
+    void post(std::coroutine_handle<> handle)
+    {
+        const std::scoped_lock lock {mutex};
+        handles.push_back(handle);
+        ready.notify_one();
+    }
+
+    // Resumes posted coroutines until done is set, returning how many there were.
+    size_t run_until(const std::atomic<bool>& done)
+    {
+        size_t resumed = 0;
+        while (!done)
+        {
+            std::unique_lock lock {mutex};
+            ready.wait(lock, [this] { return !handles.empty(); });
+            const std::coroutine_handle<> handle = handles.front();
+            handles.pop_front();
+            lock.unlock();
+
+            handle.resume();
+            ++resumed;
+        }
+        return resumed;
+    }
+};
+
+// Coroutine that starts right away and frees itself when it finishes.
+struct detached_task
+{
+    struct promise_type
+    {
+        detached_task get_return_object() noexcept { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() noexcept {}
+        void unhandled_exception() noexcept { std::terminate(); }
+    };
+};
+
+// Collects the lines of reader, resuming on loop.
+detached_task collect_async_lines(const mmap_reader& reader,
+                                  event_loop& loop,
+                                  std::vector<std::string_view>& lines,
+                                  std::thread::id& thread,
+                                  std::atomic<bool>& done)
+{
+    auto batches =
+        reader.async_lines([&loop](std::coroutine_handle<> handle) { loop.post(handle); });
+    for (;;)
+    {
+        const std::span<const std::string_view> batch = co_await batches.next();
+        if (batch.empty()) { break; }
+
+        lines.insert(lines.end(), batch.begin(), batch.end());
+        thread = std::this_thread::get_id();
+    }
+    done = true;
+}
+
+void test_async_lines()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        std::ofstream ofs(test_file);
+        for (int i = 0; i < 100000; ++i) { ofs << "line " << i << '\n'; }
+        ofs << std::string(3 * 1024 * 1024, 'x') << "\n\nlast";
+    }
+
+    // Drop the file from the page cache where the file system allows it, so that batches suspend.
+    {
+        const int fd = ::open(test_file.c_str(), O_RDONLY);
+        ::fdatasync(fd);
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+    }
+
+    const mmap_reader reader(test_file.string());
+    std::vector<std::string_view> lines;
+    std::thread::id thread;
+    std::atomic<bool> done {false};
+    event_loop loop;
+    collect_async_lines(reader, loop, lines, thread, done);
+    const size_t resumed = loop.run_until(done);
+    assert(resumed == 0 || thread == std::this_thread::get_id());
+
+    std::vector<std::string_view> expected;
+    mmap_reader sync_reader(test_file.string());
+    for (std::string_view line : sync_reader.lines()) { expected.push_back(line); }
+    assert(lines == expected);
+
+    // Destroying the source joins its worker, even while a batch is being faulted in.
+    for (int i = 0; i < 10; ++i)
+    {
+        const int fd = ::open(test_file.c_str(), O_RDONLY);
+        ::posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        ::close(fd);
+
+        auto batches = reader.async_lines([](std::coroutine_handle<> /*unused*/) {});
+        auto next = batches.next();
+        if (!next.await_ready()) { next.await_suspend(std::noop_coroutine()); }
+    }
+
+    auto schedule = [&loop](std::coroutine_handle<> handle) { loop.post(handle); };
+    try
+    {
+        mmap_reader windowed(test_file.string(), {.window_size = 4096});
+        static_cast<void>(windowed.async_lines(schedule));
+        assert(false);
+    }
+    catch (const std::logic_error&)
+    {}
+
+    try
+    {
+        static_cast<void>(reader.async_lines(nullptr));
+        assert(false);
+    }
+    catch (const std::invalid_argument&)
+    {}
+
+    std::filesystem::remove(test_file);
+}
+
 int main()
 {
     test_data_and_size();
@@ -202,6 +1381,24 @@ int main()
     test_getline_and_getchar();
     test_lines_and_chars();
     test_view_and_str();
+    test_lines_all_isas();
+    test_split_and_parallel_lines();
+    test_search();
+    test_advise();
+    test_mapping_options();
+    test_windowed_mapping();
+    test_prefetch();
+    test_line_index();
+    test_delimiters();
+    test_fields();
+    test_read_numbers();
+    test_as_span_and_records();
+    test_framed_records();
+    test_move_and_cached_mapping();
+    test_follow();
+    test_stats();
+    test_traits();
+    test_async_lines();
 
     std::cout << "All tests passed!" << '\n';
 
@@ -0,0 +1,210 @@
+#include "../mmap_ring.hpp"
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/wait.h>
+
+std::string_view text(std::span<const char> message)
+{
+    return {message.data(), message.size()};
+}
+
+void test_push_and_pop()
+{
+    const std::filesystem::path test_file = "test_ring.bin";
+    std::filesystem::remove(test_file);
+
+    {
+        mmap_ring ring(test_file.string(), {.slot_size = 16, .slot_count = 4});
+        assert(ring.capacity() == 4 && ring.slot_size() == 16 && ring.size() == 0);
+        assert(!ring.try_front().has_value());
+
+        for (int i = 0; i < 4; ++i) { assert(ring.try_push(std::format("message {}", i))); }
+        assert(!ring.try_push(std::string_view {"full"}));
+        assert(ring.size() == 4);
+
+        // Zero-copy access on both sides.
+        const auto message = ring.try_front();
+        assert(message.has_value() && text(*message) == "message 0");
+        ring.pop();
+
+        const auto slot = ring.try_reserve();
+        assert(slot.has_value() && slot->size() == 16);
+        std::memcpy(slot->data(), "zero-copy", 9);
+        ring.commit(9);
+
+        for (const char* expected : {"message 1", "message 2", "message 3", "zero-copy"})
+        {
+            const auto front = ring.front(std::chrono::milliseconds {0});
+            assert(front.has_value() && text(*front) == expected);
+            ring.pop();
+        }
+        assert(!ring.front(std::chrono::milliseconds {10}).has_value());
+
+        try
+        {
+            ring.try_push(std::string(17, 'x'));
+            assert(false);
+        }
+        catch (const std::length_error&)
+        {}
+        try
+        {
+            ring.pop();
+            assert(false);
+        }
+        catch (const std::logic_error&)
+        {}
+    }
+
+    // Unconsumed messages survive reopening the file.
+    {
+        mmap_ring ring(test_file.string(), {.slot_size = 16, .slot_count = 4});
+        assert(ring.try_push(std::string_view {"persisted"}));
+    }
+    {
+        mmap_ring ring(test_file.string(), {.slot_size = 16, .slot_count = 4});
+        const auto message = ring.try_front();
+        assert(message.has_value() && text(*message) == "persisted");
+
+        try
+        {
+            mmap_ring other(test_file.string(), {.slot_size = 32, .slot_count = 4});
+            assert(false);
+        }
+        catch (const std::invalid_argument&)
+        {}
+    }
+
+    try
+    {
+        mmap_ring ring(test_file.string(), {.slot_size = 16, .slot_count = 3});
+        assert(false);
+    }
+    catch (const std::invalid_argument&)
+    {}
+
+    std::filesystem::remove(test_file);
+}
+
+void test_recover()
+{
+    const std::filesystem::path test_file = "test_ring.bin";
+    std::filesystem::remove(test_file);
+
+    {
+        // A producer that dies between reserving and committing.
+        mmap_ring ring(test_file.string(), {.slot_size = 16, .slot_count = 8});
+        assert(ring.try_reserve().has_value());
+    }
+    {
+        mmap_ring producer(test_file.string(), {.slot_size = 16, .slot_count = 8});
+        assert(producer.try_push(std::string_view {"after crash"}));
+
+        mmap_ring consumer(test_file.string(), {.slot_size = 16, .slot_count = 8});
+        assert(!consumer.try_front().has_value()); // stuck behind the abandoned slot
+        consumer.recover();
+        const auto message = consumer.try_front();
+        assert(message.has_value() && text(*message) == "after crash");
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_threads(bool multi_producer)
+{
+    const std::filesystem::path test_file = "test_ring.bin";
+    std::filesystem::remove(test_file);
+
+    const mmap_ring::options opts {
+        .slot_size = 32, .slot_count = 64, .multi_producer = multi_producer};
+    const int producers = multi_producer ? 4 : 1;
+    const int per_producer = 20000;
+
+    mmap_ring consumer(test_file.string(), opts);
+    {
+        std::vector<std::jthread> threads;
+        for (int p = 0; p < producers; ++p)
+        {
+            threads.emplace_back(
+                [&, p]
+                {
+                    mmap_ring producer(test_file.string(), opts);
+                    for (int i = 0; i < per_producer; ++i)
+                    {
+                        const std::string message = std::format("{} {}", p, i);
+                        assert(producer.push(message, std::chrono::seconds {10}));
+                    }
+                });
+        }
+
+        // Messages of each producer arrive in order.
+        std::vector<int> next(producers, 0);
+        for (int n = 0; n < producers * per_producer; ++n)
+        {
+            const auto message = consumer.front(std::chrono::seconds {10});
+            assert(message.has_value());
+
+            int p = 0;
+            int i = 0;
+            std::sscanf(std::string(text(*message)).c_str(), "%d %d", &p, &i);
+            assert(i == next[p]++);
+            consumer.pop();
+        }
+    }
+    assert(consumer.size() == 0);
+
+    std::filesystem::remove(test_file);
+}
+
+void test_processes()
+{
+    const std::filesystem::path test_file = "test_ring.bin";
+    std::filesystem::remove(test_file);
+
+    const mmap_ring::options opts {.slot_size = 64, .slot_count = 16};
+    mmap_ring consumer(test_file.string(), opts);
+
+    const pid_t child = ::fork();
+    if (child == 0)
+    {
+        mmap_ring producer(test_file.string(), opts);
+        for (int i = 0; i < 1000; ++i)
+        {
+            const std::string message = std::format("message {}", i);
+            if (!producer.push(message, std::chrono::seconds {10})) { _exit(1); }
+        }
+        _exit(0);
+    }
+
+    for (int i = 0; i < 1000; ++i)
+    {
+        const auto message = consumer.front(std::chrono::seconds {10});
+        assert(message.has_value());
+        assert(text(*message) == std::format("message {}", i));
+        consumer.pop();
+    }
+
+    int status = 0;
+    ::waitpid(child, &status, 0);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+
+    std::filesystem::remove(test_file);
+}
+
+int main()
+{
+    test_push_and_pop();
+    test_recover();
+    test_threads(false);
+    test_threads(true);
+    test_processes();
+
+    std::cout << "All tests passed!" << '\n';
+}
@@ -0,0 +1,189 @@
+#include "../uring_reader.hpp"
+#include <cassert>
+#include <fcntl.h>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Builds a file whose lines straddle the 4096 byte buffers used below, with a final line that
+// has no trailing newline.
+std::string make_content()
+{
+    std::string content;
+    for (int i = 0; i < 5000; ++i)
+    {
+        content += std::format("line {} ", i) + std::string(static_cast<size_t>(i % 97), 'x') + '\n';
+    }
+    content += std::string(10000, 'y'); // longer than a buffer
+    content += "\nlast";
+    return content;
+}
+
+std::vector<std::string> split_lines(const std::string& content)
+{
+    std::vector<std::string> lines;
+    size_t pos = 0;
+    while (pos < content.size())
+    {
+        const size_t end = std::min(content.find('\n', pos), content.size());
+        lines.push_back(content.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return lines;
+}
+
+const uring_reader::options small_buffers {.buffer_size = 4096, .queue_depth = 2};
+
+void test_lines_and_getline()
+{
+    const std::string content = make_content();
+    const std::vector<std::string> expected = split_lines(content);
+
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        std::ofstream ofs(test_file, std::ios::binary);
+        ofs << content;
+    }
+
+    for (const uring_reader::options& opts :
+         {uring_reader::options {}, small_buffers, uring_reader::options {.queue_depth = 8}})
+    {
+        uring_reader reader(test_file.string(), opts);
+        assert(reader.size() == content.size());
+
+        std::vector<std::string> lines;
+        for (std::string_view line : reader.lines()) { lines.emplace_back(line); }
+        assert(lines == expected);
+        assert(reader.tell() == content.size());
+        assert(!reader);
+        assert(!reader.getline().has_value());
+    }
+
+    {
+        uring_reader reader(test_file.string(), small_buffers);
+        size_t n = 0;
+        while (auto line = reader.getline()) { assert(*line == expected[n++]); }
+        assert(n == expected.size());
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_read_and_chars()
+{
+    const std::string content = make_content();
+
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        std::ofstream ofs(test_file, std::ios::binary);
+        ofs << content;
+    }
+
+    {
+        uring_reader reader(test_file.string(), small_buffers);
+
+        std::string header(5, '\0');
+        assert(std::string_view(reader.read(header).data(), 5) == "line ");
+        assert(reader.getchar() == '0');
+
+        // A read spanning several buffers.
+        std::string middle(10000, '\0');
+        assert(reader.read(middle).size() == middle.size());
+        assert(middle == content.substr(6, 10000));
+
+        std::string rest;
+        for (char c : reader.chars()) { rest += c; }
+        assert(rest == content.substr(10006));
+
+        std::string more(10, '\0');
+        assert(reader.read(more).empty());
+        assert(!reader.getchar().has_value());
+    }
+
+    {
+        const int fd = ::open(test_file.c_str(), O_RDONLY);
+        {
+            uring_reader reader(fd);
+            std::string all(content.size() + 1, '\0');
+            assert(reader.read(all).size() == content.size());
+            assert(all.starts_with(content));
+        }
+        ::close(fd);
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_empty_file_and_errors()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    std::ofstream {test_file}.close();
+
+    {
+        uring_reader reader(test_file.string());
+        assert(reader.size() == 0 && !reader);
+        assert(!reader.getline().has_value());
+        for (std::string_view line : reader.lines()) { assert(false && line.empty()); }
+    }
+
+    try
+    {
+        uring_reader reader("non_existent_file.txt");
+        assert(false);
+    }
+    catch (const std::system_error&)
+    {}
+
+    std::filesystem::remove(test_file);
+}
+
+void test_direct()
+{
+    const std::string content = make_content();
+
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        std::ofstream ofs(test_file, std::ios::binary);
+        ofs << content;
+    }
+
+    try
+    {
+        uring_reader reader(test_file.string(), {.direct = true, .buffer_size = 64 * 1024});
+        std::string all;
+        for (std::string_view line : reader.lines()) { (all += line) += '\n'; }
+        assert(all == content + '\n');
+    }
+    catch (const std::system_error& e)
+    {
+        // Some file systems, e.g. tmpfs, do not support O_DIRECT.
+        if (e.code().value() != EINVAL) { throw; }
+        std::cout << "O_DIRECT not supported here, skipped" << '\n';
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+int main()
+{
+    try
+    {
+        uring_reader probe("/proc/self/exe");
+    }
+    catch (const std::system_error& e)
+    {
+        if (e.code().value() != ENOSYS && e.code().value() != EPERM) { throw; }
+        std::cout << "io_uring not available, skipped" << '\n';
+        return 0;
+    }
+
+    test_lines_and_getline();
+    test_read_and_chars();
+    test_empty_file_and_errors();
+    test_direct();
+
+    std::cout << "All tests passed!" << '\n';
+}
@@ -1,10 +1,20 @@
 #include "../mmap_writer.hpp"
 #include <cassert>
+#include <charconv>
+#include <chrono>
+#include <cstring>
 #include <fcntl.h>
 #include <filesystem>
+#include <format>
 #include <fstream>
 #include <iostream>
+#include <iterator>
 #include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+#include <sys/stat.h>
+#include <unistd.h>
 
 void test_write_and_pwrite()
 {
@@ -143,12 +153,773 @@ void test_flush()
     std::filesystem::remove(test_file);
 }
 
+void test_advise()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    {
+        mmap_writer writer(test_file.string(),
+                           true,
+                           16,
+                           mmap_writer::options {.advice = mmap_writer::access_pattern::sequential});
+
+        std::string data = "Hello, mmap_writer!";
+        writer.write(data);
+        writer.advise(mmap_writer::access_pattern::random);
+        writer.advise(mmap_writer::access_pattern::willneed, 7, 5);
+        writer.write(data);
+    }
+
+    std::ifstream ifs(test_file);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    assert(content == "Hello, mmap_writer!Hello, mmap_writer!");
+
+    std::filesystem::remove(test_file);
+}
+
+void test_windowed_mapping()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    std::string expected;
+    {
+        mmap_writer writer(test_file.string(), true, 0, mmap_writer::options {.window_size = 4096});
+
+        for (size_t i = 0; i < 3000; ++i)
+        {
+            std::string line = std::to_string(i) + std::string(i % 50, '.') + '\n';
+            writer.write(line);
+            expected += line;
+        }
+
+        std::string big(20000, 'B');
+        writer.write(big);
+        expected += big;
+
+        writer.pwrite(std::string("HEAD"), 0);
+        expected.replace(0, 4, "HEAD");
+        writer.flush();
+        assert(writer.size() == expected.size());
+    }
+
+    {
+        mmap_writer writer(test_file.string(), false, 0, mmap_writer::options {.window_size = 4096});
+        writer.write(std::string("tail"));
+        expected += "tail";
+    }
+
+    std::ifstream ifs(test_file);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    assert(content == expected);
+
+    std::filesystem::remove(test_file);
+}
+
+void test_growth_policy()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    const std::string data(300, 'g');
+
+    {
+        mmap_writer writer(test_file.string(),
+                           true,
+                           100,
+                           mmap_writer::options {.growth = mmap_writer::growth_policy::fixed(64)});
+        writer.write(data);
+        assert(writer.capacity() == 100 + 4 * 64);
+    }
+
+    {
+        mmap_writer writer(test_file.string(),
+                           true,
+                           100,
+                           mmap_writer::options {.growth = mmap_writer::growth_policy::geometric()});
+        writer.write(data.substr(0, 150));
+        assert(writer.capacity() == 200);
+        writer.write(data);
+        assert(writer.capacity() == 450);
+    }
+
+    {
+        mmap_writer writer(
+            test_file.string(),
+            true,
+            100,
+            mmap_writer::options {.growth = mmap_writer::growth_policy::capped_geometric(4.0, 50)});
+        writer.write(data.substr(0, 120));
+        assert(writer.capacity() == 150);
+    }
+
+    {
+        mmap_writer writer(
+            test_file.string(),
+            true,
+            100,
+            mmap_writer::options {.growth = mmap_writer::growth_policy::huge_page_aligned()});
+        writer.write(data);
+        assert(writer.capacity() == 2 * 1024 * 1024);
+        assert(writer.size() == data.size());
+    }
+
+    {
+        mmap_writer writer(test_file.string(), true, 100);
+        writer.set_expand_size(1000);
+        writer.write(data);
+        assert(writer.capacity() == 1100);
+    }
+
+    std::ifstream ifs(test_file);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    assert(content == data);
+
+    // Invalid policies are rejected before the file is opened.
+    for (const mmap_writer::growth_policy& growth :
+         {mmap_writer::growth_policy::fixed(0),
+          mmap_writer::growth_policy::geometric(1.0),
+          mmap_writer::growth_policy::capped_geometric(2.0, 0)})
+    {
+        try
+        {
+            mmap_writer writer(test_file.string(), true, 0, mmap_writer::options {.growth = growth});
+            assert(false);
+        }
+        catch (const std::invalid_argument&)
+        {}
+        assert(std::filesystem::file_size(test_file) == data.size());
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_preallocate()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    {
+        mmap_writer writer(test_file.string(),
+                           true,
+                           64 * 1024,
+                           mmap_writer::options {.preallocate = true});
+
+        struct stat state_buf {};
+        assert(::stat(test_file.string().c_str(), &state_buf) == 0);
+        assert(static_cast<size_t>(state_buf.st_size) == writer.capacity());
+        assert(static_cast<size_t>(state_buf.st_blocks) * 512 >= writer.capacity());
+
+        std::string data(100 * 1024, 'p');
+        writer.write(data);
+        assert(writer.capacity() >= data.size());
+    }
+
+    assert(std::filesystem::file_size(test_file) == 100 * 1024);
+
+    std::filesystem::remove(test_file);
+}
+
+void test_concurrent_append()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    const size_t n_threads = 4;
+    const size_t n_records = 5000;
+
+    {
+        mmap_writer writer(test_file.string(),
+                           true,
+                           0,
+                           mmap_writer::options {.growth = mmap_writer::growth_policy::fixed(4096),
+                                                 .max_capacity = size_t {1} << 30});
+        std::vector<std::thread> producers;
+        for (size_t t = 0; t < n_threads; ++t)
+        {
+            producers.emplace_back(
+                [&writer, t]
+                {
+                    for (size_t i = 0; i < n_records; ++i)
+                    {
+                        const std::string record = std::format("{}:{}\n", t, i);
+                        writer.append(record);
+                    }
+                });
+        }
+        for (auto& producer : producers) { producer.join(); }
+    }
+
+    std::ifstream ifs(test_file);
+    std::vector<size_t> next(n_threads, 0);
+    std::string line;
+    size_t total = 0;
+    while (std::getline(ifs, line))
+    {
+        const size_t colon = line.find(':');
+        const size_t t = std::stoul(line.substr(0, colon));
+        assert(std::stoul(line.substr(colon + 1)) == next[t]);
+        ++next[t];
+        ++total;
+    }
+    assert(total == n_threads * n_records);
+
+    std::filesystem::remove(test_file);
+}
+
+void test_append_past_capacity()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    {
+        mmap_writer writer(test_file.string(),
+                           true,
+                           0,
+                           mmap_writer::options {.max_capacity = 64 * 1024});
+        assert(writer.append(std::string(1000, 'a')) == 0);
+
+        // A rejected append claims nothing, so the next one follows the previous one.
+        try
+        {
+            static_cast<void>(writer.append(std::string(64 * 1024, 'b')));
+            assert(false);
+        }
+        catch (const std::length_error&)
+        {}
+        assert(writer.append(std::string_view {"end"}) == 1000);
+        assert(writer.size() == 1003);
+
+        // Filling the capacity exactly still works.
+        assert(writer.append(std::string(64 * 1024 - 1003, 'c')) == 1003);
+        assert(writer.size() == 64 * 1024);
+    }
+
+    std::ifstream ifs(test_file);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    assert(content == std::string(1000, 'a') + "end" + std::string(64 * 1024 - 1003, 'c'));
+
+    std::filesystem::remove(test_file);
+}
+
+void test_scattered_flush()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    const size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    std::string expected(200 * page, '\0');
+    size_t size = 0;
+
+    {
+        mmap_writer writer(test_file.string(), true, expected.size());
+        auto put = [&](size_t offset, const std::string& data)
+        {
+            writer.pwrite(data, offset);
+            expected.replace(offset, data.size(), data);
+            size = std::max(size, offset + data.size());
+        };
+
+        // Out of order, overlapping and touching writes, far apart.
+        put(50 * page, "middle");
+        put(10 * page, "low");
+        put(190 * page, "high");
+        put(10 * page + 2, "wer");
+        put(50 * page + 6, "-tail");
+
+        writer.reset_stats();
+        writer.flush();
+        if constexpr (mmap_stats::enabled) { assert(writer.stats().msync.calls == 3); }
+        writer.flush();
+        if constexpr (mmap_stats::enabled) { assert(writer.stats().msync.calls == 3); }
+
+        // More ranges than are tracked separately.
+        for (size_t i = 0; i < 100; ++i) { put(i * 2 * page + 1, std::to_string(i)); }
+        writer.reset_stats();
+        writer.flush();
+        if constexpr (mmap_stats::enabled) { assert(writer.stats().msync.calls == 64); }
+    }
+    expected.resize(size);
+    {
+        // Data of earlier windows is synchronized through the file.
+        mmap_writer writer(test_file.string(),
+                           false,
+                           0,
+                           mmap_writer::options {.window_size = 4 * page});
+        writer.pwrite(std::string("windowed"), page);
+        writer.pwrite(std::string("moved"), 100 * page);
+        expected.replace(page, 8, "windowed");
+        expected.replace(100 * page, 5, "moved");
+        writer.flush();
+        writer.flush(true);
+    }
+
+    std::ifstream ifs(test_file);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    assert(content == expected);
+
+    std::filesystem::remove(test_file);
+}
+
+void test_range_and_background_flush()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    {
+        mmap_writer writer(test_file.string(),
+                           true,
+                           1024 * 1024,
+                           mmap_writer::options {.flush_interval = std::chrono::milliseconds {5},
+                                                 .flush_bytes = 64 * 1024});
+
+        std::string data(300 * 1024, 'f');
+        writer.write(data);
+        writer.flush();
+        writer.flush();
+
+        writer.pwrite(std::string("dirty"), 100);
+        writer.flush_range(100, 5);
+        writer.flush(true);
+        writer.flush_range(10 * 1024 * 1024, 5);
+
+        std::this_thread::sleep_for(std::chrono::milliseconds {20});
+        writer.write(data);
+    }
+
+    std::ifstream ifs(test_file);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    std::string expected(600 * 1024, 'f');
+    expected.replace(100, 5, "dirty");
+    assert(content == expected);
+
+    std::filesystem::remove(test_file);
+}
+
+void test_reserve_and_commit()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    for (const mmap_writer::options& opts :
+         {mmap_writer::options {}, mmap_writer::options {.window_size = 4096}})
+    {
+        {
+            mmap_writer writer(test_file.string(), true, 16, opts);
+
+            std::span<char> buf = writer.reserve(64);
+            assert(buf.size() == 64);
+            auto [ptr, ec] = std::to_chars(buf.data(), buf.data() + buf.size(), 1234567);
+            assert(ec == std::errc {});
+            writer.commit(static_cast<size_t>(ptr - buf.data()));
+            assert(writer.size() == 7);
+
+            buf = writer.reserve(10000);
+            std::fill(buf.begin(), buf.end(), 'r');
+            writer.commit(9000);
+
+            bool thrown = false;
+            try
+            {
+                writer.commit(1);
+            }
+            catch (const std::invalid_argument&)
+            {
+                thrown = true;
+            }
+            assert(thrown);
+            assert(writer.tell() == 9007);
+        }
+
+        std::ifstream ifs(test_file);
+        std::string content((std::istreambuf_iterator<char>(ifs)),
+                            std::istreambuf_iterator<char>());
+        assert(content == "1234567" + std::string(9000, 'r'));
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_print_and_output_iterator()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    std::string expected;
+    {
+        mmap_writer writer(test_file.string(), true, 16);
+
+        for (int i = 0; i < 100; ++i)
+        {
+            writer.print("line {}\n", i);
+            expected += std::format("line {}\n", i);
+        }
+
+        const std::string long_text(10000, 'x');
+        writer.print("{}|{}\n", long_text, 42);
+        expected += long_text + "|42\n";
+
+        static_assert(std::output_iterator<mmap_writer::output_iterator, char>);
+        std::format_to(writer.output(), "{}-{}", "iterator", 7);
+        expected += "iterator-7";
+        assert(writer.size() == expected.size());
+
+        // Output longer than the first reservation, through copies of one iterator.
+        {
+            auto out = writer.output();
+            auto copy = out;
+            out = std::format_to(copy, "{}", std::string(20000, 'y'));
+            *out++ = '!';
+        }
+        expected += std::string(20000, 'y') + '!';
+        assert(writer.size() == expected.size());
+        writer.write(std::string_view {"after"});
+        expected += "after";
+    }
+
+    std::ifstream ifs(test_file);
+    std::string content((std::istreambuf_iterator<char>(ifs)), std::istreambuf_iterator<char>());
+    assert(content == expected);
+
+    std::filesystem::remove(test_file);
+}
+
+void test_writev_and_pwritev()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    for (const mmap_writer::options& opts :
+         {mmap_writer::options {}, mmap_writer::options {.window_size = 4096}})
+    {
+        std::string expected;
+        {
+            mmap_writer writer(test_file.string(), true, 0, opts);
+
+            const std::string header = "[hdr]";
+            const std::string payload(6000, 'p');
+            const std::string trailer = "[end]\n";
+            const std::span<const char> record[] = {header, payload, trailer};
+
+            writer.writev(record);
+            writer.writev(record);
+            expected = header + payload + trailer + header + payload + trailer;
+            assert(writer.tell() == expected.size());
+
+            const std::string a = "AB";
+            const std::string b = "CD";
+            const std::span<const char> patch[] = {a, b};
+            writer.pwritev(patch, 4000);
+            expected.replace(4000, 4, "ABCD");
+
+            writer.pwritev(patch, expected.size() + 10);
+            expected += std::string(10, '\0') + "ABCD";
+            assert(writer.size() == expected.size());
+        }
+
+        std::ifstream ifs(test_file);
+        std::string content((std::istreambuf_iterator<char>(ifs)),
+                            std::istreambuf_iterator<char>());
+        assert(content == expected);
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_nontemporal_writes()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+    const mmap_simd::isa default_isa = mmap_simd::active_isa();
+
+    std::string block;
+    for (size_t i = 0; i < 10000; ++i) { block += static_cast<char>('a' + i % 26); }
+
+    for (mmap_simd::isa target :
+         {mmap_simd::isa::scalar, mmap_simd::isa::sse2, mmap_simd::isa::avx2, mmap_simd::isa::avx512})
+    {
+        if (!mmap_simd::supported(target)) { continue; }
+        mmap_simd::set_isa(target);
+
+        for (const mmap_writer::options& opts :
+             {mmap_writer::options {.nontemporal_threshold = 64},
+              mmap_writer::options {.window_size = 4096, .nontemporal_threshold = 64}})
+        {
+            std::string expected;
+            {
+                mmap_writer writer(test_file.string(), true, 0, opts);
+
+                // Odd offsets exercise the unaligned head and tail of the streaming copy.
+                writer.write(std::string_view {"x"});
+                writer.write(block);
+                writer.write(std::string_view {block}.substr(3, 77));
+                writer.write(std::string_view {"small"});
+                expected = "x" + block + block.substr(3, 77) + "small";
+
+                writer.pwrite(std::string_view {block}.substr(0, 4099), 13);
+                expected.replace(13, 4099, block.substr(0, 4099));
+            }
+
+            std::ifstream ifs(test_file);
+            std::string content((std::istreambuf_iterator<char>(ifs)),
+                                std::istreambuf_iterator<char>());
+            assert(content == expected);
+        }
+    }
+
+    mmap_simd::set_isa(default_isa);
+    std::filesystem::remove(test_file);
+}
+
+void test_as_span()
+{
+    struct record
+    {
+        uint32_t id;
+        uint32_t count;
+    };
+
+    const std::filesystem::path test_file = "test_file.txt";
+
+    for (const mmap_writer::options& opts :
+         {mmap_writer::options {}, mmap_writer::options {.window_size = 4096}})
+    {
+        {
+            mmap_writer writer(test_file.string(), true, 0, opts);
+            writer.write(std::string_view {"header.."});
+
+            // Growing the file to cover the records.
+            std::span<record> records = writer.as_span<record>(8, 1000);
+            for (uint32_t i = 0; i < records.size(); ++i) { records[i] = {i, 0}; }
+            assert(writer.size() == 8 + 1000 * sizeof(record));
+
+            // Updating in place through a fresh view.
+            for (record& r : writer.as_span<record>(8 + 500 * sizeof(record), 10)) { r.count = 7; }
+            assert(writer.as_span<record>(8 + 505 * sizeof(record), 1)[0].count == 7);
+
+            try
+            {
+                static_cast<void>(writer.as_span<record>(2, 1));
+                assert(false);
+            }
+            catch (const std::invalid_argument&)
+            {}
+        }
+
+        {
+            // Stores after a flush are synced by the next one.
+            mmap_writer writer(test_file.string(), false, 0, opts);
+            std::span<record> records = writer.as_span<record>(8, 1000);
+            records[999].count = 1;
+            writer.flush();
+            records[999].count = 0;
+            writer.reset_stats();
+            writer.flush();
+            if constexpr (mmap_stats::enabled) { assert(writer.stats().msync.calls == 1); }
+            writer.flush();
+            if constexpr (mmap_stats::enabled) { assert(writer.stats().msync.calls == 2); }
+        }
+
+        std::ifstream ifs(test_file, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(ifs)),
+                            std::istreambuf_iterator<char>());
+        assert(content.size() == 8 + 1000 * sizeof(record));
+        assert(content.starts_with("header.."));
+        for (uint32_t i = 0; i < 1000; ++i)
+        {
+            record r {};
+            std::memcpy(&r, content.data() + 8 + i * sizeof(record), sizeof(r));
+            assert(r.id == i && r.count == (i >= 500 && i < 510 ? 7 : 0));
+        }
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_append_record_and_recover()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    auto read_records = [&]
+    {
+        std::ifstream ifs(test_file, std::ios::binary);
+        const std::string content((std::istreambuf_iterator<char>(ifs)),
+                                  std::istreambuf_iterator<char>());
+        auto at = [&](size_t pos, size_t /*len*/) { return content.data() + pos; };
+
+        std::vector<std::string> records;
+        size_t pos = 0;
+        std::string_view payload;
+        while (mmap_frame::read_frame(at, pos, content.size(), payload, pos))
+        {
+            records.emplace_back(payload);
+        }
+        assert(pos == content.size());
+        return records;
+    };
+
+    for (const mmap_writer::options& opts :
+         {mmap_writer::options {}, mmap_writer::options {.window_size = 4096}})
+    {
+        std::vector<std::string> expected;
+        {
+            mmap_writer writer(test_file.string(), true, 0, opts);
+            size_t offset = 0;
+            for (int i = 0; i < 500; ++i)
+            {
+                expected.push_back(std::format("record {}", i) + std::string(i % 50, 'x'));
+                assert(writer.append_record(expected.back(), i % 3 != 0) == offset);
+                offset = writer.tell();
+            }
+
+            // A record torn by a crash, followed by the zero fill of the grown file.
+            writer.write(std::string_view {"\xff\x01garbage"});
+            writer.write(std::string(3000, '\0'));
+        }
+
+        {
+            mmap_writer writer(test_file.string(), false, 0, opts);
+            const size_t valid_size = writer.recover_records();
+            assert(writer.tell() == valid_size);
+            writer.append_record(std::string_view {"after recovery"});
+            expected.emplace_back("after recovery");
+        }
+
+        assert(read_records() == expected);
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_move()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    for (const mmap_writer::options& opts :
+         {mmap_writer::options {},
+          mmap_writer::options {.window_size = 4096},
+          mmap_writer::options {.max_capacity = 1 << 20},
+          mmap_writer::options {.flush_bytes = 1024}})
+    {
+        {
+            auto open = [&] { return mmap_writer {test_file.string(), true, 0, opts}; };
+            std::vector<mmap_writer> writers;
+            writers.push_back(open());
+            writers.front().write(std::string_view {"first\n"});
+
+            writers.push_back(std::move(writers.front())); // reallocates
+            writers.back().write(std::string(10000, 'x'));
+
+            mmap_writer writer {std::move(writers.back())};
+            assert(writers.back().size() == 0);
+            writer.write(std::string_view {"\nlast\n"});
+            assert(writer.size() == 10012);
+        }
+
+        std::ifstream ifs(test_file, std::ios::binary);
+        std::string content((std::istreambuf_iterator<char>(ifs)),
+                            std::istreambuf_iterator<char>());
+        assert(content == "first\n" + std::string(10000, 'x') + "\nlast\n");
+    }
+
+    // Assigning closes the file of the target like its destructor.
+    const std::filesystem::path other_file = "other_file.txt";
+    for (const mmap_writer::options& opts :
+         {mmap_writer::options {},
+          mmap_writer::options {.window_size = 4096},
+          mmap_writer::options {.max_capacity = 1 << 20, .flush_bytes = 1024}})
+    {
+        {
+            mmap_writer writer(test_file.string(), true, 0, opts);
+            writer.write(std::string_view {"test"});
+            mmap_writer other(other_file.string(), true);
+            other.write(std::string_view {"other"});
+            writer = std::move(other);
+            writer.write(std::string_view {"!"});
+        }
+        assert(std::filesystem::file_size(test_file) == 4);
+        assert(std::filesystem::file_size(other_file) == 6);
+    }
+
+    std::filesystem::remove(test_file);
+    std::filesystem::remove(other_file);
+}
+
+void test_stats()
+{
+    const std::filesystem::path test_file = "test_file.txt";
+
+    for (const mmap_writer::options& opts :
+         {mmap_writer::options {}, mmap_writer::options {.window_size = 4096}})
+    {
+        mmap_writer writer(test_file.string(), true, 0, opts);
+        writer.write(std::string(20000, 'x'));
+        writer.pwrite(std::string_view {"abc"}, 5);
+        writer.flush();
+
+        const mmap_stats::writer_stats stats = mmap_writer {std::move(writer)}.stats();
+        if constexpr (mmap_stats::enabled)
+        {
+            assert(stats.bytes_written == 20003);
+            assert(stats.expansions > 0 && stats.ftruncate.calls > stats.expansions);
+            assert(stats.mmap.calls > 0 && stats.msync.calls > 0);
+            if (opts.window_size == 0) { assert(stats.mremap.calls == stats.expansions); }
+            else { assert(stats.munmap.calls > 0 && stats.mremap.calls == 0); }
+        }
+        else { assert(stats.bytes_written == 0 && stats.expansions == 0); }
+    }
+
+    {
+        mmap_writer writer(test_file.string(), true, 0, {.max_capacity = 1 << 20});
+        std::vector<std::jthread> threads;
+        for (int t = 0; t < 4; ++t)
+        {
+            threads.emplace_back(
+                [&]
+                {
+                    for (int i = 0; i < 1000; ++i) { writer.append(std::string_view {"record\n"}); }
+                });
+        }
+        threads.clear();
+
+        if constexpr (mmap_stats::enabled) { assert(writer.stats().bytes_written == 4 * 7000); }
+        writer.reset_stats();
+        assert(writer.stats().bytes_written == 0 && writer.stats().mmap.calls == 0);
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+struct counting_traits : mmap_writer_traits
+{
+    static constexpr bool stats {true};
+};
+
+void test_traits()
+{
+    static_assert(std::is_same_v<mmap_writer, basic_mmap_writer<mmap_writer_traits>>);
+
+    const std::filesystem::path test_file = "test_file.txt";
+    {
+        basic_mmap_writer<counting_traits> writer(test_file.string(), true);
+        writer.write(std::string(10000, 'x'));
+        writer.print("{}\n", 42);
+        assert(writer.stats().bytes_written == 10003 && writer.stats().expansions == 1);
+    }
+    assert(std::filesystem::file_size(test_file) == 10003);
+
+    std::filesystem::remove(test_file);
+}
+
 int main()
 {
     test_write_and_pwrite();
     test_seek_and_tell();
     test_expand_and_shrink();
     test_flush();
+    test_advise();
+    test_windowed_mapping();
+    test_growth_policy();
+    test_preallocate();
+    test_concurrent_append();
+    test_append_past_capacity();
+    test_scattered_flush();
+    test_range_and_background_flush();
+    test_reserve_and_commit();
+    test_print_and_output_iterator();
+    test_writev_and_pwritev();
+    test_nontemporal_writes();
+    test_as_span();
+    test_append_record_and_recover();
+    test_move();
+    test_stats();
+    test_traits();
 
     std::cout << "All tests passed!" << '\n';
 }
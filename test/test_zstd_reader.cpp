@@ -0,0 +1,206 @@
+#include "../zstd_reader.hpp"
+#include <algorithm>
+#include <cassert>
+#include <filesystem>
+#include <format>
+#include <fstream>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Builds lines of varying length, a few of them longer than the frames used below.
+std::string make_content()
+{
+    std::string content;
+    for (int i = 0; i < 3000; ++i)
+    {
+        const size_t length = i % 500 == 0 ? 5000 : static_cast<size_t>(i % 61);
+        content += std::format("line {} ", i) + std::string(length, 'x') + '\n';
+    }
+    content += "last";
+    return content;
+}
+
+std::vector<std::string> split_lines(const std::string& content)
+{
+    std::vector<std::string> lines;
+    size_t pos = 0;
+    while (pos < content.size())
+    {
+        const size_t end = std::min(content.find('\n', pos), content.size());
+        lines.push_back(content.substr(pos, end - pos));
+        pos = end + 1;
+    }
+    return lines;
+}
+
+void put_le32(std::string& out, uint32_t value)
+{
+    for (int i = 0; i < 4; ++i) { out += static_cast<char>(value >> (8 * i)); }
+}
+
+// Compresses content in frames of frame_size bytes, followed by a seek table if seekable.
+std::string compress(const std::string& content, size_t frame_size, bool seekable)
+{
+    std::string out;
+    std::string entries;
+    for (size_t pos = 0; pos < content.size(); pos += frame_size)
+    {
+        const size_t n = std::min(frame_size, content.size() - pos);
+        std::string frame(ZSTD_compressBound(n), '\0');
+        const size_t size = ZSTD_compress(frame.data(), frame.size(), content.data() + pos, n, 3);
+        assert(!ZSTD_isError(size));
+        out.append(frame.data(), size);
+
+        put_le32(entries, static_cast<uint32_t>(size));
+        put_le32(entries, static_cast<uint32_t>(n));
+    }
+
+    if (seekable)
+    {
+        const auto count = static_cast<uint32_t>(entries.size() / 8);
+        put_le32(out, 0x184D2A5E);
+        put_le32(out, static_cast<uint32_t>(entries.size() + 9));
+        out += entries;
+        put_le32(out, count);
+        out += '\0';
+        put_le32(out, 0x8F92EAB1);
+    }
+    return out;
+}
+
+void write_file(const std::filesystem::path& path, const std::string& data)
+{
+    std::ofstream ofs(path, std::ios::binary);
+    ofs << data;
+}
+
+void test_lines_and_views()
+{
+    const std::string content = make_content();
+    const std::vector<std::string> expected = split_lines(content);
+    const std::filesystem::path test_file = "test_file.zst";
+
+    for (bool seekable : {true, false})
+    {
+        // The frames must really be compressed, so that decoding them is exercised.
+        const std::string compressed = compress(content, 1000, seekable);
+        assert(compressed.size() < content.size() / 2);
+        write_file(test_file, compressed);
+
+        for (size_t cache_blocks : {1, 8})
+        {
+            zstd_reader reader(test_file.string(), {.cache_blocks = cache_blocks});
+            assert(reader.size() == content.size());
+            assert(reader.frame_count() == (content.size() + 999) / 1000);
+
+            std::vector<std::string> lines;
+            for (std::string_view line : reader.lines()) { lines.emplace_back(line); }
+            assert(lines == expected);
+            assert(reader.tell() == content.size() && !reader);
+
+            // Views within one frame and across several, and reads at arbitrary offsets.
+            assert(reader.view(10, 20) == content.substr(10, 20));
+            assert(reader.view(990, 2500) == content.substr(990, 2500));
+            assert(reader.view(content.size() - 3, 100) == "ast");
+            assert(reader.view(content.size(), 1).empty());
+
+            std::string buf(3000, '\0');
+            assert(reader.pread(buf, 1500) == 3000 && buf == content.substr(1500, 3000));
+
+            reader.seek(content.size() - 10);
+            std::string rest;
+            for (char c : reader.chars()) { rest += c; }
+            assert(rest == content.substr(content.size() - 10));
+
+            reader.seek(0);
+            assert(reader.getline() == expected[0]);
+            std::string header(5, '\0');
+            assert(std::string_view(reader.read(header).data(), 5) == "line ");
+            assert(reader.getchar() == '1');
+        }
+    }
+
+    std::filesystem::remove(test_file);
+}
+
+void test_parallel_lines()
+{
+    const std::string content = make_content();
+    std::vector<std::string> expected = split_lines(content);
+    std::sort(expected.begin(), expected.end());
+    const std::filesystem::path test_file = "test_file.zst";
+    write_file(test_file, compress(content, 700, true));
+
+    const zstd_reader reader(test_file.string());
+    for (size_t n_threads : {1, 2, 3, 8, 100})
+    {
+        std::mutex mutex;
+        std::vector<std::string> lines;
+        reader.parallel_lines(n_threads,
+                              [&](std::string_view line)
+                              {
+                                  const std::lock_guard lock {mutex};
+                                  lines.emplace_back(line);
+                              });
+        std::sort(lines.begin(), lines.end());
+        assert(lines == expected);
+    }
+
+    // Lines of one chunk arrive in order.
+    std::vector<std::vector<std::string>> chunks(4);
+    reader.parallel_lines(4,
+                          [&](size_t chunk, std::string_view line)
+                          { chunks[chunk].emplace_back(line); });
+    std::vector<std::string> joined;
+    for (const auto& chunk : chunks) { joined.insert(joined.end(), chunk.begin(), chunk.end()); }
+    assert(joined == split_lines(content));
+
+    std::filesystem::remove(test_file);
+}
+
+void test_errors()
+{
+    const std::filesystem::path test_file = "test_file.zst";
+
+    write_file(test_file, "plain text, not compressed");
+    try
+    {
+        zstd_reader reader(test_file.string());
+        assert(false);
+    }
+    catch (const std::invalid_argument&)
+    {}
+
+    // A seek table whose sizes do not add up.
+    std::string damaged = compress("some\ntext\n", 4, true);
+    damaged[damaged.size() - 9 - 8] ^= 1;
+    write_file(test_file, damaged);
+    try
+    {
+        zstd_reader reader(test_file.string());
+        assert(false);
+    }
+    catch (const std::invalid_argument&)
+    {}
+
+    try
+    {
+        zstd_reader reader("non_existent_file.zst");
+        assert(false);
+    }
+    catch (const std::system_error&)
+    {}
+
+    std::filesystem::remove(test_file);
+}
+
+int main()
+{
+    test_lines_and_views();
+    test_parallel_lines();
+    test_errors();
+
+    std::cout << "All tests passed!" << '\n';
+}
@@ -0,0 +1,616 @@
+#pragma once
+
+#include "mmap_simd.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>  // perror
+#include <cstring>
+#include <fcntl.h> // open
+#include <format>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <vector>
+#include <linux/io_uring.h>
+#include <sys/mman.h>    // mmap, munmap
+#include <sys/stat.h>    // fstat
+#include <sys/syscall.h> // io_uring_setup, io_uring_enter, io_uring_register
+#include <sys/uio.h>     // iovec
+#include <unistd.h>      // close
+
+// Sequential reader with the read()/getline()/lines()/chars() interface of mmap_reader, backed by
+// io_uring reads into a ring of page-aligned buffers instead of a memory mapping.
+//
+// A file that is scanned once pays for every page fault of a mapping and for the TLB shootdowns of
+// munmap; here the kernel fills the buffers ahead of the reader instead, and with options::direct
+// the page cache is bypassed as well. Views returned by getline() and lines() are valid until the
+// next read.
+class uring_reader
+{
+public:
+    struct options
+    {
+        bool direct {false};          // O_DIRECT: bypass the page cache (path constructor only)
+        size_t buffer_size {1 << 20}; // bytes per read, rounded up to 4096 and capped at 1 GiB
+        unsigned queue_depth {4};     // reads in flight, at least 2
+    };
+
+private:
+    static constexpr size_t alignment {4096};
+    // The length of an io_uring read is 32 bits wide.
+    static constexpr size_t max_buffer_size {size_t {1} << 30};
+
+    struct File
+    {
+    private:
+        static int open(std::string_view path, bool direct)
+        {
+            const int fd = ::open(path.data(), O_RDONLY | (direct ? O_DIRECT : 0));
+
+            if (fd == -1)
+            {
+                throw std::system_error {errno,
+                                         std::system_category(),
+                                         std::format("uring_reader: cannot open file {}", path)};
+            }
+
+            return fd;
+        }
+
+        void close()
+        {
+            if (should_close && ::close(fd) == -1) { perror("uring_reader: close file failed"); }
+        }
+
+    public:
+        int fd;
+        bool should_close;
+
+        File(std::string_view path, bool direct) : fd {open(path, direct)}, should_close {true} {}
+
+        explicit File(int fd) : fd {fd}, should_close {false}
+        {
+            if (fd < 0) { throw std::invalid_argument {"uring_reader: invalid file descriptor"}; }
+        }
+
+        ~File() { close(); }
+
+        File(const File&) = delete;
+        File& operator=(const File&) = delete;
+        File(File&& that) noexcept = delete;
+        File& operator=(File&& that) noexcept = delete;
+    };
+
+    // The submission and completion queues shared with the kernel. The destructor waits for the
+    // reads still in flight, so they never land in buffers that are already unmapped.
+    struct Ring
+    {
+    private:
+        static int setup(unsigned entries, io_uring_params& params)
+        {
+            const auto fd = static_cast<int>(::syscall(__NR_io_uring_setup, entries, &params));
+            if (fd == -1)
+            {
+                throw std::system_error {
+                    errno, std::system_category(), "uring_reader: io_uring_setup failed"};
+            }
+            return fd;
+        }
+
+        void* map(size_t size, off_t offset) const
+        {
+            void* ptr = ::mmap(
+                nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, offset);
+            if (ptr == MAP_FAILED)
+            {
+                throw std::system_error {
+                    errno, std::system_category(), "uring_reader: cannot map io_uring queues"};
+            }
+            return ptr;
+        }
+
+        void unmap() noexcept
+        {
+            if (sqes != nullptr) { ::munmap(sqes, params.sq_entries * sizeof(io_uring_sqe)); }
+            if (cq_ptr != nullptr && cq_ptr != sq_ptr) { ::munmap(cq_ptr, cq_size); }
+            if (sq_ptr != nullptr) { ::munmap(sq_ptr, sq_size); }
+            if (::close(fd) == -1) { perror("uring_reader: close io_uring failed"); }
+        }
+
+        template <typename T>
+        T* field(void* base, unsigned offset) const noexcept
+        {
+            return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+        }
+
+        int enter(unsigned to_submit, unsigned min_complete) const noexcept
+        {
+            const unsigned flags = min_complete > 0 ? IORING_ENTER_GETEVENTS : 0;
+            return static_cast<int>(
+                ::syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0));
+        }
+
+    public:
+        io_uring_params params {};
+        int fd;
+        size_t sq_size {0};
+        size_t cq_size {0};
+        void* sq_ptr {nullptr};
+        void* cq_ptr {nullptr};
+        io_uring_sqe* sqes {nullptr};
+        unsigned tail {0};      // submission queue tail, published to the kernel by wait()
+        unsigned queued {0};    // entries added since the last submission
+        unsigned in_flight {0}; // entries whose completion has not been consumed
+
+        explicit Ring(unsigned entries) : fd {setup(entries, params)}
+        {
+            sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            cq_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0)
+            {
+                sq_size = cq_size = std::max(sq_size, cq_size);
+            }
+
+            try
+            {
+                sq_ptr = map(sq_size, IORING_OFF_SQ_RING);
+                cq_ptr = (params.features & IORING_FEAT_SINGLE_MMAP) != 0
+                             ? sq_ptr
+                             : map(cq_size, IORING_OFF_CQ_RING);
+                sqes = static_cast<io_uring_sqe*>(
+                    map(params.sq_entries * sizeof(io_uring_sqe), IORING_OFF_SQES));
+            }
+            catch (...)
+            {
+                unmap();
+                throw;
+            }
+        }
+
+        ~Ring()
+        {
+            io_uring_cqe cqe {};
+            while (in_flight > 0)
+            {
+                if (!pop(cqe) && wait(1) < 0 && errno != EINTR) { break; }
+            }
+            unmap();
+        }
+
+        Ring(const Ring&) = delete;
+        Ring& operator=(const Ring&) = delete;
+        Ring(Ring&& that) noexcept = delete;
+        Ring& operator=(Ring&& that) noexcept = delete;
+
+        // Returns a zeroed entry to fill in, queued for the next wait().
+        io_uring_sqe& push() noexcept
+        {
+            const unsigned mask = *field<unsigned>(sq_ptr, params.sq_off.ring_mask);
+            const unsigned index = tail++ & mask;
+
+            field<unsigned>(sq_ptr, params.sq_off.array)[index] = index;
+            io_uring_sqe& sqe = sqes[index];
+            std::memset(&sqe, 0, sizeof(sqe));
+
+            ++queued;
+            ++in_flight;
+            return sqe;
+        }
+
+        // Submits the queued entries and waits for min_complete completions.
+        int wait(unsigned min_complete) noexcept
+        {
+            std::atomic_ref {*field<unsigned>(sq_ptr, params.sq_off.tail)}.store(
+                tail, std::memory_order_release);
+
+            const int submitted = enter(queued, min_complete);
+            if (submitted > 0) { queued -= static_cast<unsigned>(submitted); }
+            return submitted;
+        }
+
+        bool pop(io_uring_cqe& out) noexcept
+        {
+            unsigned* head = field<unsigned>(cq_ptr, params.cq_off.head);
+            const unsigned tail =
+                std::atomic_ref {*field<unsigned>(cq_ptr, params.cq_off.tail)}.load(
+                    std::memory_order_acquire);
+            if (*head == tail) { return false; }
+
+            const unsigned mask = *field<unsigned>(cq_ptr, params.cq_off.ring_mask);
+            out = field<io_uring_cqe>(cq_ptr, params.cq_off.cqes)[*head & mask];
+            std::atomic_ref {*head}.store(*head + 1, std::memory_order_release);
+
+            --in_flight;
+            return true;
+        }
+
+        bool register_buffers(std::span<const iovec> buffers) const noexcept
+        {
+            return ::syscall(__NR_io_uring_register,
+                             fd,
+                             IORING_REGISTER_BUFFERS,
+                             buffers.data(),
+                             static_cast<unsigned>(buffers.size())) == 0;
+        }
+    };
+
+    struct Buffers
+    {
+    private:
+        static char* allocate(size_t size)
+        {
+            void* ptr =
+                ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (ptr == MAP_FAILED)
+            {
+                throw std::system_error {
+                    errno, std::system_category(), "uring_reader: cannot allocate buffers"};
+            }
+            return static_cast<char*>(ptr);
+        }
+
+    public:
+        size_t size;
+        unsigned count;
+        char* ptr;
+
+        Buffers(size_t size, unsigned count) : size {size}, count {count}, ptr {allocate(size * count)}
+        {}
+
+        ~Buffers()
+        {
+            if (::munmap(ptr, size * count) == -1) { perror("uring_reader: munmap buffers failed"); }
+        }
+
+        Buffers(const Buffers&) = delete;
+        Buffers& operator=(const Buffers&) = delete;
+        Buffers(Buffers&& that) noexcept = delete;
+        Buffers& operator=(Buffers&& that) noexcept = delete;
+
+        char* operator[](size_t i) const noexcept { return ptr + i * size; }
+    };
+
+    // One buffer of the ring and the chunk of the file it is being filled with.
+    struct Slot
+    {
+        size_t offset {0};
+        size_t expected {0};
+        size_t filled {0};
+        bool done {true};
+        size_t requested {0}; // start of the read in flight, filled rounded down to alignment
+    };
+
+    File file;
+    size_t total_size;
+    Buffers buffers;
+    Ring ring; // after buffers, so that it drains the reads in flight before they are unmapped
+    std::vector<Slot> slots;
+    bool fixed_buffers {false};
+    size_t next_offset {0};
+    unsigned current {0};
+    std::string_view chunk;
+    size_t chunk_pos {0};
+    size_t read_pos {0};
+    std::string carry;
+
+    static options normalized(options opts)
+    {
+        opts.buffer_size = std::clamp(opts.buffer_size, alignment, max_buffer_size);
+        opts.buffer_size = (opts.buffer_size + alignment - 1) / alignment * alignment;
+        opts.queue_depth = std::max(opts.queue_depth, 2U);
+        return opts;
+    }
+
+    static size_t file_size(int fd)
+    {
+        struct stat state_buf;
+        if (::fstat(fd, &state_buf) == -1)
+        {
+            throw std::system_error {errno,
+                                     std::system_category(),
+                                     std::string {"uring_reader: fstat failed with fd = "} +
+                                         std::to_string(fd)};
+        }
+
+        return state_buf.st_size;
+    }
+
+    void queue_read(unsigned index)
+    {
+        Slot& slot = slots[index];
+        io_uring_sqe& sqe = ring.push();
+
+        // Always asks for the rest of the buffer from an aligned position, so that O_DIRECT reads
+        // keep an aligned offset and length after a short read. The bytes read again land where
+        // they already are.
+        slot.requested = slot.filled & ~(alignment - 1);
+        sqe.opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+        sqe.fd = file.fd;
+        sqe.off = slot.offset + slot.requested;
+        sqe.addr = reinterpret_cast<uintptr_t>(buffers[index] + slot.requested);
+        sqe.len = static_cast<unsigned>(buffers.size - slot.requested);
+        sqe.buf_index = static_cast<uint16_t>(index);
+        sqe.user_data = index;
+    }
+
+    // Starts filling the buffer with the next chunk of the file, if there is one.
+    void fill(unsigned index)
+    {
+        if (next_offset >= total_size) { return; }
+
+        slots[index] = {next_offset, std::min(buffers.size, total_size - next_offset), 0, false};
+        next_offset += buffers.size;
+        queue_read(index);
+    }
+
+    void complete(const io_uring_cqe& cqe)
+    {
+        const auto index = static_cast<unsigned>(cqe.user_data);
+        Slot& slot = slots[index];
+
+        if (cqe.res < 0)
+        {
+            if (cqe.res == -EINTR || cqe.res == -EAGAIN)
+            {
+                queue_read(index);
+                return;
+            }
+            throw std::system_error {-cqe.res, std::system_category(), "uring_reader: read failed"};
+        }
+        const size_t end = slot.requested + static_cast<size_t>(cqe.res);
+        if (end <= slot.filled && slot.filled < slot.expected)
+        {
+            throw std::runtime_error {"uring_reader: file truncated while reading"};
+        }
+
+        slot.filled = std::max(slot.filled, end);
+        if (slot.filled < slot.expected) { queue_read(index); }
+        else
+        {
+            slot.filled = slot.expected;
+            slot.done = true;
+        }
+    }
+
+    void wait_for(unsigned index)
+    {
+        io_uring_cqe cqe {};
+        while (!slots[index].done)
+        {
+            if (ring.pop(cqe))
+            {
+                complete(cqe);
+                continue;
+            }
+            if (ring.wait(1) < 0 && errno != EINTR)
+            {
+                throw std::system_error {
+                    errno, std::system_category(), "uring_reader: io_uring_enter failed"};
+            }
+        }
+    }
+
+    // Returns the unread part of the current chunk, moving on to the next one when it is used up
+    // and handing the buffer back to the kernel for the chunk after the last one in flight.
+    std::string_view available()
+    {
+        if (chunk_pos == chunk.size())
+        {
+            if (chunk.data() != nullptr)
+            {
+                fill(current);
+                current = (current + 1) % buffers.count;
+                if (ring.queued > 0) { ring.wait(0); }
+            }
+            wait_for(current);
+            chunk = {buffers[current], slots[current].filled};
+            chunk_pos = 0;
+        }
+        return chunk.substr(chunk_pos);
+    }
+
+    void consume(size_t n) noexcept
+    {
+        chunk_pos += n;
+        read_pos += n;
+    }
+
+    [[nodiscard]]
+    bool eof() const noexcept
+    {
+        return read_pos >= total_size;
+    }
+
+    char next_char()
+    {
+        const char c = available().front();
+        consume(1);
+        return c;
+    }
+
+    std::string_view next_line(char delimiter)
+    {
+        std::string_view rest = available();
+        const char* found = mmap_simd::find(rest.data(), rest.data() + rest.size(), delimiter);
+        if (found != rest.data() + rest.size())
+        {
+            const std::string_view line {rest.data(), static_cast<size_t>(found - rest.data())};
+            consume(line.size() + 1);
+            return line;
+        }
+
+        // The line continues in the next buffer. Copy it out, since this one goes back to the
+        // kernel.
+        carry.assign(rest);
+        consume(rest.size());
+        while (!eof())
+        {
+            rest = available();
+            found = mmap_simd::find(rest.data(), rest.data() + rest.size(), delimiter);
+            const auto n = static_cast<size_t>(found - rest.data());
+            carry.append(rest.data(), n);
+            if (found != rest.data() + rest.size())
+            {
+                consume(n + 1);
+                break;
+            }
+            consume(n);
+        }
+        return carry;
+    }
+
+    void start()
+    {
+        std::vector<iovec> iovecs;
+        for (unsigned i = 0; i < buffers.count; ++i) { iovecs.push_back({buffers[i], buffers.size}); }
+        // Registering pins the buffers once instead of on every read; without it, e.g. under a
+        // low RLIMIT_MEMLOCK, plain reads are used.
+        fixed_buffers = ring.register_buffers(iovecs);
+
+        for (unsigned i = 0; i < buffers.count; ++i) { fill(i); }
+        if (ring.queued > 0 && ring.wait(0) < 0)
+        {
+            throw std::system_error {
+                errno, std::system_category(), "uring_reader: io_uring_enter failed"};
+        }
+    }
+
+    struct Sentinel
+    {};
+
+    class LineReader
+    {
+    private:
+        uring_reader& reader;
+        char delimiter;
+
+        class iterator
+        {
+        private:
+            uring_reader& reader;
+            char delimiter;
+
+        public:
+            iterator(uring_reader& in_, char delimiter_) : reader {in_}, delimiter {delimiter_} {}
+
+            std::string_view operator*() const { return reader.next_line(delimiter); }
+
+            iterator& operator++() { return *this; }
+
+            bool operator!=(Sentinel /*unused*/) const noexcept { return !reader.eof(); }
+        };
+
+    public:
+        explicit LineReader(uring_reader& r, char delim) : reader {r}, delimiter {delim} {}
+
+        iterator begin() { return iterator {reader, delimiter}; }
+        Sentinel end() { return {}; }
+    };
+
+    class CharReader
+    {
+    private:
+        uring_reader& reader;
+
+        class iterator
+        {
+        private:
+            uring_reader& reader;
+
+        public:
+            explicit iterator(uring_reader& in_) : reader {in_} {}
+
+            char operator*() const { return reader.next_char(); }
+
+            iterator& operator++() { return *this; }
+
+            bool operator!=(Sentinel /*unused*/) const noexcept { return !reader.eof(); }
+        };
+
+    public:
+        explicit CharReader(uring_reader& r) : reader {r} {}
+
+        iterator begin() { return iterator {reader}; }
+        Sentinel end() { return {}; }
+    };
+
+public:
+    explicit uring_reader(std::string_view path) : uring_reader {path, options {}} {}
+    explicit uring_reader(int fd) : uring_reader {fd, options {}} {}
+
+    // Throws std::system_error if the file cannot be opened or io_uring is unavailable, e.g.
+    // disabled by a seccomp policy.
+    uring_reader(std::string_view path, const options& opts)
+        : file {path, opts.direct},
+          total_size {file_size(file.fd)},
+          buffers {normalized(opts).buffer_size, normalized(opts).queue_depth},
+          ring {buffers.count},
+          slots(buffers.count)
+    {
+        start();
+    }
+
+    // Reads fd from its start. O_DIRECT, if wanted, must already be set on fd.
+    uring_reader(int fd, const options& opts)
+        : file {fd},
+          total_size {file_size(fd)},
+          buffers {normalized(opts).buffer_size, normalized(opts).queue_depth},
+          ring {buffers.count},
+          slots(buffers.count)
+    {
+        start();
+    }
+
+    explicit operator bool() const noexcept { return !eof(); }
+
+    [[nodiscard]]
+    size_t size() const noexcept
+    {
+        return total_size;
+    }
+
+    [[nodiscard]]
+    size_t tell() const noexcept
+    {
+        return read_pos;
+    }
+
+    std::span<char> read(std::span<char> buf)
+    {
+        size_t copied = 0;
+        while (copied < buf.size() && !eof())
+        {
+            const std::string_view rest = available();
+            const size_t n = std::min(buf.size() - copied, rest.size());
+            std::memcpy(buf.data() + copied, rest.data(), n);
+            consume(n);
+            copied += n;
+        }
+
+        return buf.first(copied);
+    }
+
+    [[nodiscard]]
+    std::optional<std::string_view> getline(char delimiter = '\n')
+    {
+        if (eof()) { return std::nullopt; }
+        return next_line(delimiter);
+    }
+
+    [[nodiscard]]
+    std::optional<char> getchar()
+    {
+        if (eof()) { return std::nullopt; }
+        return next_char();
+    }
+
+    LineReader lines(char delimiter = '\n') { return LineReader {*this, delimiter}; }
+
+    CharReader chars() { return CharReader {*this}; }
+};
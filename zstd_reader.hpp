@@ -0,0 +1,587 @@
+#pragma once
+
+#include "mmap_parallel.hpp"
+#include "mmap_reader.hpp"
+#include "mmap_simd.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <new>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <zstd.h> // link with -lzstd
+
+// Reader for zstd-compressed files with the read()/getline()/lines()/view()/pread() interface of
+// mmap_reader, addressing the decompressed data.
+//
+// The compressed file is mapped with mmap_reader, and its frames are decompressed on demand into
+// a small cache of the least recently used ones. Files in the zstd seekable format (`zstd
+// --seekable`, or the seekable API in zstd's contrib) are indexed from the seek table at their
+// end; other multi-frame files are indexed by walking their frame headers, which must record the
+// content size, as `zstd` does by default. A file compressed as a single frame is decompressed as
+// a whole on first access, so compress large files in frames of a few MiB to keep random access
+// cheap and scans parallel.
+class zstd_reader
+{
+public:
+    struct options
+    {
+        size_t cache_blocks {8}; // decompressed frames kept in memory, at least 1
+    };
+
+private:
+    static constexpr uint32_t seekable_magic {0x8F92EAB1};
+    static constexpr uint32_t skippable_magic {0x184D2A5E};
+    static constexpr size_t seek_footer_size {9};
+    static constexpr size_t skippable_header_size {8};
+
+    struct Frame
+    {
+        size_t compressed_offset;
+        size_t compressed_size;
+        size_t offset; // in the decompressed data
+        size_t size;
+    };
+
+    struct Context
+    {
+        ZSTD_DCtx* dctx;
+
+        Context() : dctx {ZSTD_createDCtx()}
+        {
+            if (dctx == nullptr) { throw std::bad_alloc {}; }
+        }
+
+        Context(const Context&) = delete;
+        Context& operator=(const Context&) = delete;
+
+        ~Context() { ZSTD_freeDCtx(dctx); }
+    };
+
+    // Least recently used decompressed frames. Each thread scanning in parallel has its own.
+    class BlockCache
+    {
+    private:
+        static constexpr size_t no_frame {SIZE_MAX};
+
+        struct Block
+        {
+            size_t frame {no_frame};
+            uint64_t used {0};
+            size_t capacity {0};
+            std::unique_ptr<char[]> data;
+        };
+
+        Context context;
+        std::vector<Block> blocks;
+        uint64_t clock {0};
+
+    public:
+        explicit BlockCache(size_t n) : blocks(std::max<size_t>(n, 1)) {}
+
+        std::string_view get(const mmap_reader& compressed, const Frame& frame, size_t index)
+        {
+            Block* victim = &blocks.front();
+            for (Block& block : blocks)
+            {
+                if (block.frame == index)
+                {
+                    block.used = ++clock;
+                    return {block.data.get(), frame.size};
+                }
+                if (block.used < victim->used) { victim = &block; }
+            }
+
+            victim->frame = no_frame;
+            if (victim->capacity < frame.size)
+            {
+                victim->data = std::make_unique_for_overwrite<char[]>(frame.size);
+                victim->capacity = frame.size;
+            }
+
+            const std::string_view src =
+                compressed.view(frame.compressed_offset, frame.compressed_size);
+            const size_t n = ZSTD_decompressDCtx(
+                context.dctx, victim->data.get(), frame.size, src.data(), src.size());
+            if (ZSTD_isError(n))
+            {
+                throw std::runtime_error {std::string {"zstd_reader: "} + ZSTD_getErrorName(n)};
+            }
+            if (n != frame.size)
+            {
+                throw std::runtime_error {"zstd_reader: frame shorter than its recorded size"};
+            }
+
+            victim->frame = index;
+            victim->used = ++clock;
+            return {victim->data.get(), frame.size};
+        }
+    };
+
+    // A sequential read position in the decompressed data, up to end.
+    struct Stream
+    {
+        size_t pos {0};
+        size_t end {0};
+        size_t frame {0}; // index of the frame holding pos, if pos < end
+        std::string carry;
+    };
+
+    [[nodiscard]]
+    Stream stream_at(size_t pos, size_t frame) const
+    {
+        Stream at;
+        at.pos = pos;
+        at.end = total_size;
+        at.frame = frame;
+        return at;
+    }
+
+    static uint32_t load_le32(const char* p) noexcept
+    {
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i)
+        {
+            value |= static_cast<uint32_t>(static_cast<unsigned char>(p[i])) << (8 * i);
+        }
+        return value;
+    }
+
+    // Reads the seek table of the seekable format, if the file ends with one.
+    static bool read_seek_table(const mmap_reader& compressed, std::vector<Frame>& frames)
+    {
+        const size_t file_size = compressed.size();
+        if (file_size < skippable_header_size + seek_footer_size) { return false; }
+
+        const std::string_view footer =
+            compressed.view(file_size - seek_footer_size, seek_footer_size);
+        if (load_le32(footer.data() + 5) != seekable_magic) { return false; }
+
+        const size_t count = load_le32(footer.data());
+        const auto descriptor = static_cast<unsigned char>(footer[4]);
+        if ((descriptor & 0x7c) != 0)
+        {
+            throw std::invalid_argument {"zstd_reader: unsupported seek table descriptor"};
+        }
+
+        // Entries hold the compressed and decompressed size of a frame, and optionally the low
+        // 32 bits of its XXH64; zstd verifies frames that carry their own checksum instead.
+        const size_t entry_size = (descriptor & 0x80) != 0 ? 12 : 8;
+        const size_t table_size = count * entry_size + seek_footer_size;
+        if (table_size + skippable_header_size > file_size)
+        {
+            throw std::invalid_argument {"zstd_reader: seek table larger than the file"};
+        }
+
+        const size_t table_offset = file_size - table_size - skippable_header_size;
+        const std::string_view table =
+            compressed.view(table_offset, table_size + skippable_header_size);
+        if ((load_le32(table.data()) & 0xFFFFFFF0) != (skippable_magic & 0xFFFFFFF0) ||
+            load_le32(table.data() + 4) != table_size)
+        {
+            throw std::invalid_argument {"zstd_reader: malformed seek table"};
+        }
+
+        size_t compressed_offset = 0;
+        size_t offset = 0;
+        frames.clear();
+        frames.reserve(count);
+        for (size_t i = 0; i < count; ++i)
+        {
+            const char* entry = table.data() + skippable_header_size + i * entry_size;
+            const size_t compressed_size = load_le32(entry);
+            const size_t size = load_le32(entry + 4);
+            if (size > 0) { frames.push_back({compressed_offset, compressed_size, offset, size}); }
+            compressed_offset += compressed_size;
+            offset += size;
+        }
+
+        if (compressed_offset != table_offset)
+        {
+            throw std::invalid_argument {"zstd_reader: seek table does not match the file"};
+        }
+        return true;
+    }
+
+    // Indexes a file without a seek table by walking its frames.
+    static void walk_frames(const mmap_reader& compressed, std::vector<Frame>& frames)
+    {
+        const std::string_view data = compressed.view(0, compressed.size());
+
+        size_t compressed_offset = 0;
+        size_t offset = 0;
+        while (compressed_offset < data.size())
+        {
+            const char* src = data.data() + compressed_offset;
+            const size_t remaining = data.size() - compressed_offset;
+
+            const size_t compressed_size = ZSTD_findFrameCompressedSize(src, remaining);
+            if (ZSTD_isError(compressed_size))
+            {
+                throw std::invalid_argument {std::string {"zstd_reader: "} +
+                                             ZSTD_getErrorName(compressed_size)};
+            }
+
+            // Skippable frames have a content size of 0.
+            const unsigned long long size = ZSTD_getFrameContentSize(src, remaining);
+            if (size == ZSTD_CONTENTSIZE_UNKNOWN)
+            {
+                throw std::invalid_argument {
+                    "zstd_reader: frame without content size; use the seekable format"};
+            }
+            if (size == ZSTD_CONTENTSIZE_ERROR)
+            {
+                throw std::invalid_argument {"zstd_reader: not a zstd file"};
+            }
+
+            if (size > 0)
+            {
+                frames.push_back({compressed_offset, compressed_size, offset,
+                                  static_cast<size_t>(size)});
+            }
+            compressed_offset += compressed_size;
+            offset += static_cast<size_t>(size);
+        }
+    }
+
+    static std::vector<Frame> index_frames(const mmap_reader& compressed)
+    {
+        std::vector<Frame> frames;
+        if (!read_seek_table(compressed, frames)) { walk_frames(compressed, frames); }
+        return frames;
+    }
+
+    [[nodiscard]]
+    size_t frame_of(size_t offset) const noexcept
+    {
+        const auto found = std::upper_bound(frames.begin(),
+                                            frames.end(),
+                                            offset,
+                                            [](size_t value, const Frame& frame)
+                                            { return value < frame.offset; });
+        return static_cast<size_t>(found - frames.begin()) - 1;
+    }
+
+    // Returns the decompressed data from stream.pos to the end of its frame.
+    std::string_view available(Stream& stream, BlockCache& blocks) const
+    {
+        const Frame* frame = &frames[stream.frame];
+        if (stream.pos < frame->offset || stream.pos >= frame->offset + frame->size)
+        {
+            stream.frame = frame_of(stream.pos);
+            frame = &frames[stream.frame];
+        }
+
+        const std::string_view block = blocks.get(compressed, *frame, stream.frame);
+        return block.substr(stream.pos - frame->offset);
+    }
+
+    std::string_view next_line(Stream& stream, BlockCache& blocks, char delimiter) const
+    {
+        std::string_view rest = available(stream, blocks);
+        const char* found = mmap_simd::find(rest.data(), rest.data() + rest.size(), delimiter);
+        if (found != rest.data() + rest.size())
+        {
+            const std::string_view line {rest.data(), static_cast<size_t>(found - rest.data())};
+            stream.pos += line.size() + 1;
+            return line;
+        }
+
+        // The line continues in the next frame, which may evict this one from the cache.
+        stream.carry.assign(rest);
+        stream.pos += rest.size();
+        while (stream.pos < stream.end)
+        {
+            rest = available(stream, blocks);
+            found = mmap_simd::find(rest.data(), rest.data() + rest.size(), delimiter);
+            const auto n = static_cast<size_t>(found - rest.data());
+            stream.carry.append(rest.data(), n);
+            if (found != rest.data() + rest.size())
+            {
+                stream.pos += n + 1;
+                break;
+            }
+            stream.pos += n;
+        }
+        return stream.carry;
+    }
+
+    // Moves stream.pos past the next delimiter. Returns false if there is none.
+    bool skip_past(Stream& stream, BlockCache& blocks, char delimiter) const
+    {
+        while (stream.pos < stream.end)
+        {
+            const std::string_view rest = available(stream, blocks);
+            const char* found = mmap_simd::find(rest.data(), rest.data() + rest.size(), delimiter);
+            stream.pos += static_cast<size_t>(found - rest.data());
+            if (found != rest.data() + rest.size())
+            {
+                ++stream.pos;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template <typename Work>
+    static void run_parallel(size_t n, Work work)
+    {
+        mmap_parallel::run(n, std::move(work));
+    }
+
+    [[nodiscard]]
+    bool eof() const noexcept
+    {
+        return stream.pos >= total_size;
+    }
+
+    struct Sentinel
+    {};
+
+    class LineReader
+    {
+    private:
+        zstd_reader& reader;
+        char delimiter;
+
+        class iterator
+        {
+        private:
+            zstd_reader& reader;
+            char delimiter;
+
+        public:
+            iterator(zstd_reader& in_, char delimiter_) : reader {in_}, delimiter {delimiter_} {}
+
+            std::string_view operator*() const
+            {
+                return reader.next_line(reader.stream, reader.blocks, delimiter);
+            }
+
+            iterator& operator++() { return *this; }
+
+            bool operator!=(Sentinel /*unused*/) const noexcept { return !reader.eof(); }
+        };
+
+    public:
+        explicit LineReader(zstd_reader& r, char delim) : reader {r}, delimiter {delim} {}
+
+        iterator begin() { return iterator {reader, delimiter}; }
+        Sentinel end() { return {}; }
+    };
+
+    class CharReader
+    {
+    private:
+        zstd_reader& reader;
+
+        class iterator
+        {
+        private:
+            zstd_reader& reader;
+
+        public:
+            explicit iterator(zstd_reader& in_) : reader {in_} {}
+
+            char operator*() const
+            {
+                const char c = reader.available(reader.stream, reader.blocks).front();
+                ++reader.stream.pos;
+                return c;
+            }
+
+            iterator& operator++() { return *this; }
+
+            bool operator!=(Sentinel /*unused*/) const noexcept { return !reader.eof(); }
+        };
+
+    public:
+        explicit CharReader(zstd_reader& r) : reader {r} {}
+
+        iterator begin() { return iterator {reader}; }
+        Sentinel end() { return {}; }
+    };
+
+public:
+    explicit zstd_reader(std::string_view path) : zstd_reader {path, options {}} {}
+    explicit zstd_reader(int fd) : zstd_reader {fd, options {}} {}
+
+    // Throws std::system_error if the file cannot be opened or mapped, and std::invalid_argument
+    // if it is not a zstd file that can be indexed.
+    zstd_reader(std::string_view path, const options& opts)
+        : compressed {path},
+          frames {index_frames(compressed)},
+          total_size {frames.empty() ? 0 : frames.back().offset + frames.back().size},
+          blocks {opts.cache_blocks}
+    {
+        stream.end = total_size;
+    }
+
+    // Reads fd from its start. The file descriptor must stay open while the reader is used.
+    zstd_reader(int fd, const options& opts)
+        : compressed {fd},
+          frames {index_frames(compressed)},
+          total_size {frames.empty() ? 0 : frames.back().offset + frames.back().size},
+          blocks {opts.cache_blocks}
+    {
+        stream.end = total_size;
+    }
+
+    explicit operator bool() const noexcept { return !eof(); }
+
+    // Returns the size of the decompressed data.
+    [[nodiscard]]
+    size_t size() const noexcept
+    {
+        return total_size;
+    }
+
+    [[nodiscard]]
+    size_t compressed_size() const noexcept
+    {
+        return compressed.size();
+    }
+
+    [[nodiscard]]
+    size_t frame_count() const noexcept
+    {
+        return frames.size();
+    }
+
+    [[nodiscard]]
+    size_t tell() const noexcept
+    {
+        return stream.pos;
+    }
+
+    void seek(size_t pos) noexcept { stream.pos = std::min(pos, total_size); }
+
+    std::span<char> read(std::span<char> buf)
+    {
+        const size_t n = pread(buf, stream.pos);
+        stream.pos += n;
+        return buf.first(n);
+    }
+
+    size_t pread(std::span<char> buf, size_t offset)
+    {
+        if (offset >= total_size) { return 0; }
+
+        Stream at = stream_at(offset, stream.frame);
+        const size_t to_read = std::min(buf.size(), total_size - offset);
+        size_t copied = 0;
+        while (copied < to_read)
+        {
+            const std::string_view rest = available(at, blocks);
+            const size_t n = std::min(to_read - copied, rest.size());
+            std::memcpy(buf.data() + copied, rest.data(), n);
+            at.pos += n;
+            copied += n;
+        }
+        return copied;
+    }
+
+    // Returns [offset, offset + len), clamped to the data. The view points into the cache if the
+    // range lies in one frame and into an internal string otherwise; it is valid until the next
+    // call that reads from the reader.
+    [[nodiscard]]
+    std::string_view view(size_t offset, size_t len)
+    {
+        if (offset >= total_size) { return {}; }
+
+        len = std::min(len, total_size - offset);
+        Stream at = stream_at(offset, stream.frame);
+        const std::string_view rest = available(at, blocks);
+        if (len <= rest.size()) { return rest.substr(0, len); }
+
+        scratch.resize(len);
+        scratch.resize(pread(scratch, offset));
+        return scratch;
+    }
+
+    [[nodiscard]]
+    std::string str(size_t offset, size_t len)
+    {
+        return std::string {view(offset, len)};
+    }
+
+    [[nodiscard]]
+    std::optional<std::string_view> getline(char delimiter = '\n')
+    {
+        if (eof()) { return std::nullopt; }
+        return next_line(stream, blocks, delimiter);
+    }
+
+    [[nodiscard]]
+    std::optional<char> getchar()
+    {
+        if (eof()) { return std::nullopt; }
+        const char c = available(stream, blocks).front();
+        ++stream.pos;
+        return c;
+    }
+
+    // Views returned by lines() and getline() are valid until the next read.
+    LineReader lines(char delimiter = '\n') { return LineReader {*this, delimiter}; }
+
+    CharReader chars() { return CharReader {*this}; }
+
+    // Calls callback(line) or callback(chunk_index, line) for every line, decompressing with up to
+    // n_threads threads. Each thread takes a run of whole frames plus the end of the line that
+    // crosses into the next run; lines of one chunk are visited in order. The read position and
+    // the cache are not used.
+    template <typename Callback>
+    void parallel_lines(size_t n_threads, Callback callback, char delimiter = '\n') const
+    {
+        constexpr bool with_index = std::is_invocable_v<Callback&, size_t, std::string_view>;
+        if (frames.empty()) { return; }
+
+        // Chunk i covers frames [first[i], first[i + 1]), of roughly equal decompressed size.
+        std::vector<size_t> first {0};
+        const size_t n = std::max<size_t>(n_threads, 1);
+        for (size_t i = 1; i < n; ++i)
+        {
+            const size_t index = frame_of(total_size / n * i);
+            if (index > first.back()) { first.push_back(index); }
+        }
+        first.push_back(frames.size());
+
+        run_parallel(first.size() - 1,
+                     [&](size_t chunk)
+                     {
+                         BlockCache own_blocks {1};
+                         const size_t begin = frames[first[chunk]].offset;
+                         const bool last = chunk + 2 == first.size();
+                         const size_t end = last ? total_size : frames[first[chunk + 1]].offset;
+
+                         // The line starting before begin belongs to the previous chunk, which
+                         // reads on past its end until the line is complete.
+                         Stream own = stream_at(begin, first[chunk]);
+                         if (chunk > 0 && !skip_past(own, own_blocks, delimiter)) { return; }
+
+                         while (own.pos < end || (!last && own.pos == end))
+                         {
+                             const std::string_view line = next_line(own, own_blocks, delimiter);
+                             if constexpr (with_index) { callback(chunk, line); }
+                             else { callback(line); }
+                         }
+                     });
+    }
+
+private:
+    mmap_reader compressed;
+    std::vector<Frame> frames;
+    size_t total_size;
+    BlockCache blocks;
+    Stream stream;
+    std::string scratch;
+};